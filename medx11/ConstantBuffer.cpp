@@ -2,9 +2,12 @@
 // All Rights Reserved
 
 #include <medx11/ConstantBuffer.h>
+#include <medx11/ConstantIntern.h>
 #include <me/exception/FailedToCreate.h>
 #include <me/exception/FailedToLock.h>
 #include <me/exception/NotImplemented.h>
+#include <cstring>
+#include <algorithm>
 
 using namespace medx11;
 using namespace me;
@@ -15,11 +18,35 @@ ConstantBuffer::ConstantBuffer( const me::render::IRenderer * renderer, me::rend
 	, m_parameters{ parameters }
 {
 	Create( parameters );
+	m_renderer->GetConstantIntern()->Add( this );
+}
+
+ConstantBuffer::ConstantBuffer( const me::render::IRenderer * renderer, me::render::ConstantBufferParameters parameters, std::vector< size_t > usedSizes, std::vector< size_t > bindSizes )
+	: m_renderer{ dynamic_cast< const Renderer * >(renderer ) }
+	, m_parameters{ parameters }
+	, m_usedSizes{ usedSizes }
+	, m_bindSizes{ bindSizes }
+{
+	Create( parameters );
+	m_renderer->GetConstantIntern()->Add( this );
 }
 
 ConstantBuffer::~ConstantBuffer()
 {
 	Destroy();
+	if ( m_renderer )
+	{
+		m_renderer->GetConstantIntern()->Remove( this );
+	}
+}
+
+void ConstantBuffer::Detach()
+{
+	for( auto && immutable : m_immutables )
+	{
+		immutable = nullptr;
+	}
+	m_renderer = nullptr;
 }
 
 const me::render::ConstantTable * ConstantBuffer::GetTable() const
@@ -42,17 +69,55 @@ void ConstantBuffer::Create( ConstantBufferParameters parameters )
 
 	auto dxDevice = m_renderer->GetDxDevice();
 
+	// Suballocate from the constant ring when we can, else each buffer is its own.
+	m_useRing = m_renderer->GetConstantRing()->Available();
+
+	// Without reflected sizes, bind the table's.
+	m_bindSizes.resize( m_table.BufferCount(), 0 );
+	for( size_t bufferIndex = 0, buffer_count = m_table.BufferCount(); bufferIndex < buffer_count; bufferIndex++ )
+	{
+		size_t & bindSize = m_bindSizes[ bufferIndex ];
+		bindSize = ( (std::max)( bindSize, (size_t)m_table.GetSizeInBytes( bufferIndex ) ) + ConstantRing::Alignment - 1 ) / ConstantRing::Alignment * ConstantRing::Alignment;
+	}
+
 	for( size_t bufferIndex = 0, buffer_count = m_table.BufferCount(); bufferIndex < buffer_count; bufferIndex++ )
 	{
-		D3D11_BUFFER_DESC constantBufferDesc{};
-		constantBufferDesc.ByteWidth = (UINT)m_table.GetSizeInBytes( bufferIndex );
-		constantBufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-		constantBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
-		constantBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-		ID3D11Buffer * createdBuffer;
-		HRESULT result = dxDevice->CreateBuffer( &constantBufferDesc, nullptr, &createdBuffer );
+		ID3D11Buffer * createdBuffer = nullptr;
+		if ( ! m_useRing )
+		{
+			D3D11_BUFFER_DESC constantBufferDesc{};
+			constantBufferDesc.ByteWidth = (UINT)m_bindSizes[ bufferIndex ];
+			constantBufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+			constantBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+			constantBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+			HRESULT result = dxDevice->CreateBuffer( &constantBufferDesc, nullptr, &createdBuffer );
+			assert( !WIN_FAILED( result ) );
+		}
 		m_buffers.push_back( createdBuffer );
-		assert( !WIN_FAILED( result ) );
+		m_allocations.push_back( ConstantRing::Allocation{} );
+		m_frequencies.push_back( bufferIndex == m_table.GetWorld().buffer ? Frequency::PerObject : Frequency::Infer );
+		m_immutables.push_back( nullptr );
+		m_unchanged.push_back( 0 );
+
+		// Build the defaults once, so locks can apply them with a single copy.
+		std::vector< unsigned char > defaults;
+		if ( m_table.HasDefaults( bufferIndex ) )
+		{
+			defaults.resize( m_table.GetSizeInBytes( bufferIndex ) );
+			for( auto && variable : m_table.GetVariables( bufferIndex ) )
+			{
+				if( variable.hasDefault )
+				{
+					memcpy( &defaults[ variable.offsetInBytes ], &variable.defaultValue[0], variable.defaultValue.size() * sizeof( float ) );
+				}
+			}
+		}
+		m_defaults.push_back( defaults );
+
+		std::vector< unsigned char > shadow( m_table.GetSizeInBytes( bufferIndex ) );
+		m_shadows.push_back( shadow );
+		m_uploaded.push_back( shadow );
+		m_uploadSizes.push_back( bufferIndex < m_usedSizes.size() ? m_usedSizes[ bufferIndex ] : shadow.size() );
 	}
 }
 
@@ -60,11 +125,28 @@ void ConstantBuffer::Destroy()
 {
 	for( auto && buffer : m_buffers )
 	{
-		buffer->Release();
+		if ( buffer )
+		{
+			buffer->Release();
+		}
+	}
+	for( size_t buffer = 0; buffer < m_immutables.size(); ++buffer )
+	{
+		ReleaseImmutable( buffer );
 	}
 	m_buffers.clear();
+	m_allocations.clear();
+	m_frequencies.clear();
+	m_immutables.clear();
+	m_unchanged.clear();
+	m_defaults.clear();
+	m_shadows.clear();
+	m_uploaded.clear();
+	m_uploadSizes.clear();
+	m_uploadedOnce = {};
 	m_locked = {};
 	m_bufferAccessed = {};
+	m_holdsDefaults = {};
 }
 
 size_t ConstantBuffer::GetBufferCount() const
@@ -110,7 +192,6 @@ void ConstantBuffer::Update( const RenderInfo & renderInfo, const unify::Matrix
 		}
 
 		UnlockConstants( bufferIndex, lock );
-		bufferIndex++;
 	}
 }
 
@@ -121,97 +202,181 @@ void ConstantBuffer::Use( size_t startSlot, size_t startBuffer )
 		throw unify::Exception( "Vertex shader is still locked, while attempting to use it!" );
 	}
 
-	// Ensure all buffers have been accessed (defaults)
+	// Ensure all buffers have been accessed (defaults), unless they still hold nothing but their defaults.
 	for( size_t buffer = 0, size = m_buffers.size(); buffer < size; ++buffer )
 	{
-		if( !m_table.HasDefaults( buffer ) ) continue;
+		if( m_defaults[ buffer ].empty() ) continue;
 
 		// Access test...
-		if( ( m_bufferAccessed & (1 << buffer) ) != (1 << buffer) )
+		if( ( ( m_bufferAccessed | m_holdsDefaults ) & (1 << buffer) ) != (1 << buffer) )
 		{
 			unify::DataLock lock;
 			LockConstants( buffer, lock );
 			UnlockConstants( buffer, lock );
+			m_holdsDefaults = m_holdsDefaults | (1 << buffer);
 		}
 	}
 
-	if( m_buffers.size() > 0 )
+	if( m_buffers.size() > startBuffer )
 	{
-
-		using me::render::ResourceType;
-		using namespace render;
-
-		auto dxContext = m_renderer->GetDxContext();
-
-		switch( m_parameters.type )
+		// Allocations from an earlier frame went with the ring's pages, so write again what the GPU last had.
+		auto constantRing = m_renderer->GetConstantRing();
+		std::vector< ID3D11Buffer * > buffers;
+		std::vector< UINT > firstConstants;
+		std::vector< UINT > numConstants;
+		for( size_t buffer = startBuffer, size = m_buffers.size(); buffer < size; ++buffer )
 		{
-		case ResourceType::PixelShader:
-			dxContext->PSSetConstantBuffers( (UINT)startSlot, (UINT)m_buffers.size(), &m_buffers[ startBuffer ] );
-			break;
-
-		case ResourceType::VertexShader:
-			dxContext->VSSetConstantBuffers((UINT)startSlot, (UINT)m_buffers.size(), &m_buffers[startBuffer] );
-			break;
-
-		case ResourceType::ComputeShader:
-			dxContext->CSSetConstantBuffers((UINT)startSlot, (UINT)m_buffers.size(), &m_buffers[startBuffer] );
-			break;
-
-		case ResourceType::DomainShader:
-			dxContext->DSSetConstantBuffers((UINT)startSlot, (UINT)m_buffers.size(), &m_buffers[startBuffer] );
-			break;
-
-		case ResourceType::GeometryShader:
-			dxContext->GSSetConstantBuffers((UINT)startSlot, (UINT)m_buffers.size(), &m_buffers[startBuffer] );
-			break;
+			if( m_immutables[ buffer ] )
+			{
+				buffers.push_back( m_immutables[ buffer ] );
+				firstConstants.push_back( 0 );
+				numConstants.push_back( (UINT)( m_bindSizes[ buffer ] / 16 ) );
+			}
+			else if( m_useRing )
+			{
+				ConstantRing::Allocation & allocation = m_allocations[ buffer ];
+				if( ! constantRing->Current( allocation ) && m_uploadSizes[ buffer ] != 0 )
+				{
+					m_renderer->UploadConstants( allocation, &m_uploaded[ buffer ][0], m_uploadSizes[ buffer ], true, m_bindSizes[ buffer ] );
+				}
+				buffers.push_back( allocation.buffer );
+				firstConstants.push_back( allocation.firstConstant );
+				numConstants.push_back( allocation.numConstants );
+			}
+			else
+			{
+				buffers.push_back( m_buffers[ buffer ] );
+			}
+		}
 
-		default:
-			throw unify::Exception( "ResourceType::ToString: Not a valid usage type!" );
+		// Offsets are only given, and only possible, with the ring.
+		if( ! m_useRing )
+		{
+			firstConstants.clear();
+			numConstants.clear();
 		}
+
+		m_renderer->UseConstantBuffers( m_parameters.type, startSlot, buffers, firstConstants, numConstants );
 	}
 
 	m_bufferAccessed = 0;
 }
 
 void ConstantBuffer::LockConstants( size_t bufferIndex, unify::DataLock & lock )
+{
+	LockConstants( bufferIndex, lock, false );
+}
+
+void ConstantBuffer::LockConstants( size_t bufferIndex, unify::DataLock & lock, bool overwrite )
 {
 	if( (m_locked & (1 << bufferIndex)) == (1 << bufferIndex) ) throw exception::FailedToLock( "Failed to lock vertex shader constant buffer!" );
 
 	m_bufferAccessed = m_bufferAccessed | (1 << bufferIndex);
 	m_locked = m_locked | (1 << bufferIndex);
+	m_holdsDefaults = m_holdsDefaults & ~(1 << bufferIndex);
 
-	auto dxDevice = m_renderer->GetDxDevice();
-	auto dxContext = m_renderer->GetDxContext();
+	// Writes go to our shadow, and only reach the GPU on unlock if they changed anything.
+	std::vector< unsigned char > & shadow = m_shadows[ bufferIndex ];
+	lock.SetLock( &shadow[0], m_table.GetSizeInBytes( bufferIndex ), unify::DataLockAccess::ReadWrite, 0 );
+
+	if( ! overwrite && ! m_defaults[ bufferIndex ].empty() )
+	{
+		memcpy( &shadow[0], &m_defaults[ bufferIndex ][0], m_defaults[ bufferIndex ].size() );
+	}
+}
+
+void ConstantBuffer::UnlockConstants( size_t buffer, unify::DataLock & lock )
+{
+	if( (m_locked & (1 << buffer)) != (1 << buffer) ) throw exception::FailedToLock( "Failed to unlock vertex shader constant buffer (buffer not locked)!" );
+
+	std::vector< unsigned char > & shadow = m_shadows[ buffer ];
+	std::vector< unsigned char > & uploaded = m_uploaded[ buffer ];
+	// Only the bytes the shader reads count, and a buffer it reads none of never changes.
+	size_t size = m_uploadSizes[ buffer ];
+	bool changed = size != 0 && ( ( m_uploadedOnce & (1 << buffer) ) == 0 || memcmp( &shadow[0], &uploaded[0], size ) != 0 );
+
+	m_unchanged[ buffer ] = changed ? 0 : m_unchanged[ buffer ] + 1;
+
+	if( m_immutables[ buffer ] && ! changed )
+	{
+		m_renderer->UploadConstants( m_immutables[ buffer ], &shadow[0], size, false );
+	}
+	else if( m_immutables[ buffer ] && m_frequencies[ buffer ] == Frequency::PerMaterial )
+	{
+		CreateImmutable( buffer );
+	}
+	else if( m_frequencies[ buffer ] != Frequency::PerMaterial )
+	{
+		// An inferred immutable buffer that changed was a guess gone wrong, so stream it again.
+		ReleaseImmutable( buffer );
+		if( m_useRing )
+		{
+			m_renderer->UploadConstants( m_allocations[buffer], &shadow[0], size, changed, m_bindSizes[ buffer ] );
+		}
+		else
+		{
+			m_renderer->UploadConstants( m_buffers[buffer], &shadow[0], size, changed );
+		}
+	}
+
+	if( changed )
+	{
+		uploaded = shadow;
+		m_uploadedOnce = m_uploadedOnce | (1 << buffer);
+	}
 
-	D3D11_MAPPED_SUBRESOURCE subresource{};
-	HRESULT result = dxContext->Map( m_buffers[bufferIndex], bufferIndex, D3D11_MAP::D3D11_MAP_WRITE_DISCARD, 0, &subresource );
-	if( WIN_FAILED( result ) )
+	if( ! m_immutables[ buffer ] && size != 0 && ( m_frequencies[ buffer ] == Frequency::PerMaterial || ( m_frequencies[ buffer ] == Frequency::Infer && m_unchanged[ buffer ] >= PromoteAfter ) ) )
 	{
-		throw unify::Exception( "Failed to lock " + me::render::ResourceType::ToString( m_parameters.type ) + " constant buffer!" );
+		CreateImmutable( buffer );
 	}
 
-	lock.SetLock( subresource.pData, m_table.GetSizeInBytes( bufferIndex ), unify::DataLockAccess::ReadWrite, 0 );
+	m_locked = m_locked & ~(1 << buffer);
+}
 
-	// Roughly handle defaults...
-	for( auto variable : m_table.GetVariables( bufferIndex ) )
+void ConstantBuffer::SetFrequency( size_t bufferIndex, Frequency::TYPE frequency )
+{
+	m_frequencies[ bufferIndex ] = frequency;
+	m_unchanged[ bufferIndex ] = 0;
+	if( frequency != Frequency::PerMaterial && m_immutables[ bufferIndex ] )
 	{
-		if( variable.hasDefault )
+		// Our own buffer missed whatever went to the immutable one. Ring allocations are rewritten on use anyway.
+		ReleaseImmutable( bufferIndex );
+		if( ! m_useRing )
 		{
-			lock.CopyBytesFrom( &variable.defaultValue[0], variable.offsetInBytes, variable.defaultValue.size() * sizeof( float ) );
+			m_renderer->UploadConstants( m_buffers[ bufferIndex ], &m_uploaded[ bufferIndex ][0], m_uploadSizes[ bufferIndex ], true );
 		}
 	}
 }
 
-void ConstantBuffer::UnlockConstants( size_t buffer, unify::DataLock & lock )
+ConstantBuffer::Frequency::TYPE ConstantBuffer::GetFrequency( size_t bufferIndex ) const
 {
-	if( (m_locked & (1 << buffer)) != (1 << buffer) ) throw exception::FailedToLock( "Failed to unlock vertex shader constant buffer (buffer not locked)!" );
+	return m_frequencies[ bufferIndex ];
+}
 
-	auto dxDevice = m_renderer->GetDxDevice();
-	auto dxContext = m_renderer->GetDxContext();
+bool ConstantBuffer::IsImmutable( size_t bufferIndex ) const
+{
+	return m_immutables[ bufferIndex ] != nullptr;
+}
 
-	dxContext->Unmap( m_buffers[buffer], buffer );
+void ConstantBuffer::CreateImmutable( size_t bufferIndex )
+{
+	ReleaseImmutable( bufferIndex );
+
+	// Sized to what we bind, whole ring alignments, so it binds by offset the same as ring allocations. Identical
+	// contents share one buffer, whichever constant buffers they come from.
+	const std::vector< unsigned char > & shadow = m_shadows[ bufferIndex ];
+	std::vector< unsigned char > data( m_bindSizes[ bufferIndex ] );
+	memcpy( &data[0], &shadow[0], shadow.size() );
+	m_immutables[ bufferIndex ] = m_renderer->GetConstantIntern()->Acquire( &data[0], data.size() );
+}
 
-	m_locked = m_locked & ~(1 << buffer);
+void ConstantBuffer::ReleaseImmutable( size_t bufferIndex )
+{
+	if( m_immutables[ bufferIndex ] )
+	{
+		m_renderer->GetConstantIntern()->Release( m_immutables[ bufferIndex ] );
+		m_immutables[ bufferIndex ] = nullptr;
+	}
 }
 
 ResourceType::TYPE ConstantBuffer::GetType() const
@@ -11,8 +11,31 @@ namespace medx11
 {
 	class ConstantBuffer : public me::render::IConstantBuffer
 	{
+		friend class Renderer;
 	public:
+		/// <summary>
+		/// How often a buffer's contents change, deciding how it reaches the GPU.
+		/// </summary>
+		struct Frequency
+		{
+			enum TYPE
+			{
+				Infer, // Streamed, until its contents stay unchanged for PromoteAfter unlocks, then treated as PerMaterial until they change.
+				PerObject, // Streamed, expected to change every draw.
+				PerFrame, // Streamed; within a frame unchanged contents are not uploaded again.
+				PerMaterial // Kept in an immutable buffer, recreated only when its contents change.
+			};
+		};
+
+		static const size_t PromoteAfter = 64;
+
 		ConstantBuffer( const me::render::IRenderer * renderer, me::render::ConstantBufferParameters parameters );
+
+		/// <summary>
+		/// Upload only the first usedSizes[n] bytes of buffer n, as reflected from the shader, but bind bindSizes[n] bytes,
+		/// the shader's declared size (see ConstantLayout).
+		/// </summary>
+		ConstantBuffer( const me::render::IRenderer * renderer, me::render::ConstantBufferParameters parameters, std::vector< size_t > usedSizes, std::vector< size_t > bindSizes );
 		~ConstantBuffer();
 
 	public: // me::render::IConstantBuffer
@@ -33,16 +56,57 @@ namespace medx11
 		void LockConstants( size_t bufferIndex, unify::DataLock & lock ) override;
 		void UnlockConstants( size_t buffer, unify::DataLock & lock ) override;
 
+		/// <summary>
+		/// Lock a buffer, filled with its defaults, unless the caller overwrites all of it and says so.
+		/// </summary>
+		void LockConstants( size_t bufferIndex, unify::DataLock & lock, bool overwrite );
+
+		/// <summary>
+		/// Annotate a buffer's update frequency. Buffers holding the world matrix start as PerObject, others as Infer.
+		/// </summary>
+		void SetFrequency( size_t bufferIndex, Frequency::TYPE frequency );
+		Frequency::TYPE GetFrequency( size_t bufferIndex ) const;
+
+		/// <summary>
+		/// True if a buffer is currently held in an immutable buffer, annotated or inferred.
+		/// </summary>
+		bool IsImmutable( size_t bufferIndex ) const;
+
 		me::render::ResourceType::TYPE GetType() const override;
 
 		me::render::BufferUsage::TYPE GetUsage() const override;
 
 	protected:
+		/// <summary>
+		/// Replace a buffer's immutable buffer with one holding its shadow.
+		/// </summary>
+		void CreateImmutable( size_t bufferIndex );
+		void ReleaseImmutable( size_t bufferIndex );
+
+		/// <summary>
+		/// Called by the renderer as it is destroyed before us. Our interned buffers go with it, so we drop them and
+		/// forget the renderer, so that releasing us later doesn't call back into it.
+		/// </summary>
+		void Detach();
+
 		const Renderer * m_renderer;
 		me::render::ConstantBufferParameters m_parameters;
 		me::render::ConstantTable m_table;
-		std::vector< ID3D11Buffer * > m_buffers;
+		std::vector< ID3D11Buffer * > m_buffers; // Null when using the constant ring.
+		std::vector< ConstantRing::Allocation > m_allocations; // Where each buffer is in the constant ring, when using it.
+		bool m_useRing;
+		std::vector< Frequency::TYPE > m_frequencies;
+		std::vector< ID3D11Buffer * > m_immutables; // Per buffer, while held immutable.
+		std::vector< size_t > m_unchanged; // Unlocks in a row that left each buffer unchanged.
+		std::vector< std::vector< unsigned char > > m_defaults; // Packed image of each buffer's defaults, empty without defaults.
+		std::vector< std::vector< unsigned char > > m_shadows; // What locks write to.
+		std::vector< size_t > m_usedSizes; // As given, empty to upload whole buffers.
+		std::vector< size_t > m_uploadSizes; // Bytes of each buffer we upload and compare.
+		std::vector< size_t > m_bindSizes; // As given, raised to the table's size in whole ring alignments on Create.
+		std::vector< std::vector< unsigned char > > m_uploaded; // What the GPU has, to skip unchanged uploads.
+		size_t m_uploadedOnce; // Buffers the GPU has received anything for.
 		size_t m_locked;
 		size_t m_bufferAccessed;
+		size_t m_holdsDefaults; // Buffers last written with nothing but their defaults.
 	};
 }
\ No newline at end of file
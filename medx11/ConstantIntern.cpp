@@ -0,0 +1,126 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#include <medx11/ConstantIntern.h>
+#include <medx11/Renderer.h>
+#include <me/exception/FailedToCreate.h>
+#include <cstring>
+#include <cassert>
+
+using namespace medx11;
+using namespace me;
+
+ConstantIntern::ConstantIntern( Renderer * renderer )
+	: m_renderer{ renderer }
+	, m_references{ 0 }
+{
+}
+
+ConstantIntern::~ConstantIntern()
+{
+}
+
+ID3D11Buffer * ConstantIntern::Acquire( const void * data, size_t sizeInBytes )
+{
+	uint64_t hash = Hash( data, sizeInBytes );
+
+	// Equal hashes are compared in full, so a collision costs a buffer, never the wrong constants.
+	auto range = m_byHash.equal_range( hash );
+	for ( auto itr = range.first; itr != range.second; ++itr )
+	{
+		Entry & entry = m_entries[ itr->second ];
+		if ( entry.data.size() == sizeInBytes && memcmp( &entry.data[0], data, sizeInBytes ) == 0 )
+		{
+			entry.references++;
+			m_references++;
+			return entry.buffer;
+		}
+	}
+
+	D3D11_BUFFER_DESC desc{};
+	desc.ByteWidth = (UINT)sizeInBytes;
+	desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	desc.Usage = D3D11_USAGE_IMMUTABLE;
+	D3D11_SUBRESOURCE_DATA initialData{};
+	initialData.pSysMem = data;
+	Entry entry{};
+	HRESULT result = m_renderer->GetDxDevice()->CreateBuffer( &desc, &initialData, &entry.buffer );
+	if ( WIN_FAILED( result ) )
+	{
+		throw exception::FailedToCreate( "Failed to create immutable constant buffer!" );
+	}
+	entry.data.assign( (const unsigned char *)data, (const unsigned char *)data + sizeInBytes );
+	entry.hash = hash;
+	entry.references = 1;
+	m_references++;
+
+	ID3D11Buffer * buffer = entry.buffer;
+	m_entries[ buffer ] = entry;
+	m_byHash.insert( std::make_pair( hash, buffer ) );
+	return buffer;
+}
+
+void ConstantIntern::Release( ID3D11Buffer * buffer )
+{
+	auto itr = m_entries.find( buffer );
+	assert( itr != m_entries.end() );
+	if ( itr == m_entries.end() )
+	{
+		return;
+	}
+
+	m_references--;
+	if ( --itr->second.references != 0 )
+	{
+		return;
+	}
+
+	auto range = m_byHash.equal_range( itr->second.hash );
+	for ( auto hashItr = range.first; hashItr != range.second; ++hashItr )
+	{
+		if ( hashItr->second == buffer )
+		{
+			m_byHash.erase( hashItr );
+			break;
+		}
+	}
+	m_entries.erase( itr );
+}
+
+void ConstantIntern::Add( ConstantBuffer * constantBuffer )
+{
+	m_constantBuffers.insert( constantBuffer );
+}
+
+void ConstantIntern::Remove( ConstantBuffer * constantBuffer )
+{
+	m_constantBuffers.erase( constantBuffer );
+}
+
+std::vector< ConstantBuffer * > ConstantIntern::GetConstantBuffers() const
+{
+	return std::vector< ConstantBuffer * >( m_constantBuffers.begin(), m_constantBuffers.end() );
+}
+
+ConstantIntern::Stats ConstantIntern::GetStats() const
+{
+	Stats stats{ m_entries.size(), m_references, 0 };
+	for ( auto && entry : m_entries )
+	{
+		stats.sizeInBytes += entry.second.data.size();
+	}
+	return stats;
+}
+
+uint64_t ConstantIntern::Hash( const void * data, size_t sizeInBytes )
+{
+	// FNV-1a.
+	const unsigned char * bytes = (const unsigned char *)data;
+	uint64_t hash = 14695981039346656037ULL;
+	for ( size_t i = 0; i < sizeInBytes; i++ )
+	{
+		hash ^= bytes[ i ];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
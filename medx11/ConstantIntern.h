@@ -0,0 +1,71 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#pragma once
+
+#include <medx11/DirectX.h>
+#include <atlbase.h>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+namespace medx11
+{
+	class Renderer;
+	class ConstantBuffer;
+
+	/// <summary>
+	/// Shares immutable constant buffers between everything holding identical constants, such as the same material on
+	/// many props. Buffers are found by a hash of their contents, and reference counted.
+	/// </summary>
+	class ConstantIntern
+	{
+	public:
+		struct Stats
+		{
+			size_t unique; // Distinct buffers.
+			size_t total; // References to them, which without interning would each be a buffer.
+			size_t sizeInBytes; // Of the distinct buffers.
+		};
+
+		ConstantIntern( Renderer * renderer );
+		~ConstantIntern();
+
+		/// <summary>
+		/// Get an immutable constant buffer holding exactly these bytes, creating it if it does not yet exist.
+		/// Every Acquire is matched by a Release.
+		/// </summary>
+		ID3D11Buffer * Acquire( const void * data, size_t sizeInBytes );
+
+		void Release( ID3D11Buffer * buffer );
+
+		/// <summary>
+		/// Track the constant buffers alive, so the renderer can detach any that outlive it.
+		/// </summary>
+		void Add( ConstantBuffer * constantBuffer );
+		void Remove( ConstantBuffer * constantBuffer );
+		std::vector< ConstantBuffer * > GetConstantBuffers() const;
+
+		Stats GetStats() const;
+
+	private:
+		struct Entry
+		{
+			CComPtr< ID3D11Buffer > buffer;
+			std::vector< unsigned char > data;
+			uint64_t hash;
+			size_t references;
+		};
+
+		static uint64_t Hash( const void * data, size_t sizeInBytes );
+
+		Renderer * m_renderer;
+		std::unordered_multimap< uint64_t, ID3D11Buffer * > m_byHash;
+		std::map< ID3D11Buffer *, Entry > m_entries;
+		size_t m_references;
+		std::set< ConstantBuffer * > m_constantBuffers;
+	};
+}
\ No newline at end of file
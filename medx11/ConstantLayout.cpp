@@ -0,0 +1,154 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#include <medx11/ConstantLayout.h>
+#include <medx11/DirectX.h>
+#include <me/exception/FailedToCreate.h>
+#include <d3d11shader.h>
+#include <atlbase.h>
+#include <algorithm>
+
+using namespace medx11;
+using namespace me;
+
+ConstantLayout::ConstantLayout()
+{
+}
+
+ConstantLayout ConstantLayout::Reflect( const void * bytecode, size_t length )
+{
+	CComPtr< ID3D11ShaderReflection > reflection;
+	HRESULT result = D3DReflect( bytecode, length, IID_ID3D11ShaderReflection, (void**)&reflection );
+	if ( WIN_FAILED( result ) )
+	{
+		throw exception::FailedToCreate( "Failed to reflect shader bytecode!" );
+	}
+
+	D3D11_SHADER_DESC shaderDesc{};
+	reflection->GetDesc( &shaderDesc );
+
+	ConstantLayout layout;
+	for ( UINT bufferIndex = 0; bufferIndex < shaderDesc.ConstantBuffers; bufferIndex++ )
+	{
+		ID3D11ShaderReflectionConstantBuffer * constantBuffer = reflection->GetConstantBufferByIndex( bufferIndex );
+		D3D11_SHADER_BUFFER_DESC bufferDesc{};
+		constantBuffer->GetDesc( &bufferDesc );
+		if ( bufferDesc.Type != D3D_CT_CBUFFER )
+		{
+			continue;
+		}
+
+		D3D11_SHADER_INPUT_BIND_DESC bindDesc{};
+		if ( WIN_FAILED( reflection->GetResourceBindingDescByName( bufferDesc.Name, &bindDesc ) ) )
+		{
+			continue;
+		}
+
+		Buffer buffer{ true, bufferDesc.Name, bufferDesc.Size, 0 };
+		for ( UINT variableIndex = 0; variableIndex < bufferDesc.Variables; variableIndex++ )
+		{
+			D3D11_SHADER_VARIABLE_DESC variableDesc{};
+			constantBuffer->GetVariableByIndex( variableIndex )->GetDesc( &variableDesc );
+
+			Variable variable{ variableDesc.Name, variableDesc.StartOffset, variableDesc.Size, ( variableDesc.uFlags & D3D_SVF_USED ) != 0 };
+			if ( variable.used )
+			{
+				buffer.usedSizeInBytes = (std::max)( buffer.usedSizeInBytes, variable.offsetInBytes + variable.sizeInBytes );
+			}
+			buffer.variables.push_back( variable );
+		}
+
+		if ( layout.m_buffers.size() <= bindDesc.BindPoint )
+		{
+			layout.m_buffers.resize( bindDesc.BindPoint + 1, Buffer{ false, std::string(), 0, 0 } );
+		}
+		layout.m_buffers[ bindDesc.BindPoint ] = buffer;
+	}
+	return layout;
+}
+
+const std::vector< ConstantLayout::Buffer > & ConstantLayout::GetBuffers() const
+{
+	return m_buffers;
+}
+
+std::vector< size_t > ConstantLayout::GetUsedSizes( const me::render::ConstantTable & table ) const
+{
+	std::vector< size_t > sizes;
+	for ( size_t bufferIndex = 0, bufferCount = table.BufferCount(); bufferIndex < bufferCount; bufferIndex++ )
+	{
+		size_t size = 0;
+		if ( bufferIndex < m_buffers.size() && m_buffers[ bufferIndex ].present )
+		{
+			size = (std::min)( m_buffers[ bufferIndex ].usedSizeInBytes, (size_t)table.GetSizeInBytes( bufferIndex ) );
+		}
+		sizes.push_back( size );
+	}
+	return sizes;
+}
+
+std::vector< size_t > ConstantLayout::GetBindSizes( const me::render::ConstantTable & table ) const
+{
+	const size_t blockSize = 16 * 16;
+
+	std::vector< size_t > sizes;
+	for ( size_t bufferIndex = 0, bufferCount = table.BufferCount(); bufferIndex < bufferCount; bufferIndex++ )
+	{
+		size_t size = table.GetSizeInBytes( bufferIndex );
+		if ( bufferIndex < m_buffers.size() && m_buffers[ bufferIndex ].present )
+		{
+			size = (std::max)( size, m_buffers[ bufferIndex ].sizeInBytes );
+		}
+		sizes.push_back( ( size + blockSize - 1 ) / blockSize * blockSize );
+	}
+	return sizes;
+}
+
+std::vector< std::string > ConstantLayout::Compare( const me::render::ConstantTable & table, unsigned int ignoreSlots ) const
+{
+	std::vector< std::string > mismatches;
+
+	for ( size_t bufferIndex = 0, bufferCount = table.BufferCount(); bufferIndex < bufferCount; bufferIndex++ )
+	{
+		std::string slot = std::to_string( bufferIndex );
+		if ( bufferIndex >= m_buffers.size() || ! m_buffers[ bufferIndex ].present )
+		{
+			mismatches.push_back( "constant buffer " + slot + " is not declared by the shader, and will not be uploaded" );
+			continue;
+		}
+
+		const Buffer & buffer = m_buffers[ bufferIndex ];
+		size_t tableSize = table.GetSizeInBytes( bufferIndex );
+		if ( tableSize < buffer.sizeInBytes )
+		{
+			mismatches.push_back( "constant buffer " + slot + " (" + buffer.name + ") is " + std::to_string( tableSize ) + " bytes, smaller than the shader's " + std::to_string( buffer.sizeInBytes ) );
+		}
+		else if ( tableSize > buffer.sizeInBytes )
+		{
+			mismatches.push_back( "constant buffer " + slot + " (" + buffer.name + ") is " + std::to_string( tableSize ) + " bytes, larger than the shader's " + std::to_string( buffer.sizeInBytes ) );
+		}
+
+		for ( auto && tableVariable : table.GetVariables( bufferIndex ) )
+		{
+			auto match = std::find_if( buffer.variables.begin(), buffer.variables.end(), [&]( const Variable & variable ) { return variable.offsetInBytes == tableVariable.offsetInBytes; } );
+			if ( match == buffer.variables.end() )
+			{
+				mismatches.push_back( "constant buffer " + slot + " (" + buffer.name + ") has no variable at offset " + std::to_string( tableVariable.offsetInBytes ) );
+			}
+			else if ( ! match->used )
+			{
+				mismatches.push_back( "constant buffer " + slot + " (" + buffer.name + ") variable " + match->name + " is not used by the shader" );
+			}
+		}
+	}
+
+	for ( size_t bufferIndex = table.BufferCount(); bufferIndex < m_buffers.size(); bufferIndex++ )
+	{
+		if ( m_buffers[ bufferIndex ].present && ( ignoreSlots & ( 1 << bufferIndex ) ) == 0 )
+		{
+			mismatches.push_back( "constant buffer " + std::to_string( bufferIndex ) + " (" + m_buffers[ bufferIndex ].name + ") is declared by the shader, but missing from the constant table" );
+		}
+	}
+
+	return mismatches;
+}
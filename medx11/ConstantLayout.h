@@ -0,0 +1,66 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#pragma once
+
+#include <me/render/IRenderer.h>
+#include <vector>
+#include <string>
+#include <cstddef>
+
+namespace medx11
+{
+	/// <summary>
+	/// The constant buffers a compiled shader actually declares, read from its bytecode with D3DReflect, by bind slot.
+	/// Used to check the constant table we were given against the shader, and to upload only the part of each buffer
+	/// the shader reads.
+	/// </summary>
+	class ConstantLayout
+	{
+	public:
+		struct Variable
+		{
+			std::string name;
+			size_t offsetInBytes;
+			size_t sizeInBytes;
+			bool used; // Referenced by the shader, as the compiler sees it.
+		};
+
+		struct Buffer
+		{
+			bool present; // False for slots the shader has no constant buffer at.
+			std::string name;
+			size_t sizeInBytes;
+			size_t usedSizeInBytes; // Up to the end of the last used variable, 0 if none are used.
+			std::vector< Variable > variables;
+		};
+
+		ConstantLayout();
+
+		static ConstantLayout Reflect( const void * bytecode, size_t length );
+
+		const std::vector< Buffer > & GetBuffers() const;
+
+		/// <summary>
+		/// Bytes of each of a table's buffers the shader reads, assuming buffer n binds to slot n. Buffers the shader does
+		/// not declare read nothing.
+		/// </summary>
+		std::vector< size_t > GetUsedSizes( const me::render::ConstantTable & table ) const;
+
+		/// <summary>
+		/// Bytes of each of a table's buffers to bind: at least the shader's declared cbuffer size (and the table's),
+		/// rounded up to whole 16 constant (256 byte) blocks, however little of it is uploaded.
+		/// </summary>
+		std::vector< size_t > GetBindSizes( const me::render::ConstantTable & table ) const;
+
+		/// <summary>
+		/// Describe where a table disagrees with the shader: missing or differently sized buffers, and variables that do
+		/// not start where the shader has one. Slots in the ignoreSlots mask (bit n for slot n), those the renderer binds
+		/// itself, are not compared.
+		/// </summary>
+		std::vector< std::string > Compare( const me::render::ConstantTable & table, unsigned int ignoreSlots ) const;
+
+	private:
+		std::vector< Buffer > m_buffers;
+	};
+}
\ No newline at end of file
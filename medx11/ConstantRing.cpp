@@ -0,0 +1,124 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#include <medx11/ConstantRing.h>
+#include <medx11/Renderer.h>
+#include <me/exception/FailedToCreate.h>
+#include <me/exception/FailedToLock.h>
+#include <cstring>
+#include <algorithm>
+
+using namespace medx11;
+using namespace me;
+
+ConstantRing::ConstantRing( Renderer * renderer, size_t pageSizeInBytes )
+	: m_renderer{ renderer }
+	, m_pageSizeInBytes{ ( pageSizeInBytes + Alignment - 1 ) / Alignment * Alignment }
+	, m_available{ false }
+	, m_page{ 0 }
+	, m_offset{ 0 }
+	, m_mapped{ nullptr }
+	, m_frame{ 1 }
+{
+	// Offset binds need an 11.1 context, and NO_OVERWRITE on constant buffers needs the runtime to allow it.
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options{};
+	if ( m_renderer->GetDxContext1() && SUCCEEDED( m_renderer->GetDxDevice()->CheckFeatureSupport( D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof( options ) ) ) )
+	{
+		m_available = options.ConstantBufferOffsetting && options.MapNoOverwriteOnDynamicConstantBuffer;
+	}
+}
+
+ConstantRing::~ConstantRing()
+{
+	Flush();
+}
+
+bool ConstantRing::Available() const
+{
+	return m_available;
+}
+
+void ConstantRing::BeginFrame()
+{
+	Flush();
+	for ( auto && page : m_pages )
+	{
+		page.written = false;
+	}
+	m_page = 0;
+	m_offset = 0;
+	m_frame++;
+}
+
+ConstantRing::Allocation ConstantRing::Write( const void * data, size_t sizeInBytes, size_t reserveInBytes )
+{
+	size_t alignedSize = ( (std::max)( sizeInBytes, reserveInBytes ) + Alignment - 1 ) / Alignment * Alignment;
+	if ( ! m_available || alignedSize == 0 || alignedSize > m_pageSizeInBytes )
+	{
+		throw exception::FailedToLock( "Not a valid constant ring allocation!" );
+	}
+
+	if ( m_pages.empty() || m_offset + alignedSize > m_pageSizeInBytes )
+	{
+		Flush();
+		if ( ! m_pages.empty() )
+		{
+			m_page++;
+		}
+		m_offset = 0;
+	}
+
+	if ( m_page == m_pages.size() )
+	{
+		D3D11_BUFFER_DESC desc{};
+		desc.ByteWidth = (UINT)m_pageSizeInBytes;
+		desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		desc.Usage = D3D11_USAGE_DYNAMIC;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		Page page{};
+		HRESULT result = m_renderer->GetDxDevice()->CreateBuffer( &desc, nullptr, &page.buffer );
+		if ( WIN_FAILED( result ) )
+		{
+			throw exception::FailedToCreate( "Failed to create constant ring page!" );
+		}
+		m_pages.push_back( page );
+	}
+
+	Page & page = m_pages[ m_page ];
+	if ( ! m_mapped )
+	{
+		D3D11_MAPPED_SUBRESOURCE subresource{};
+		HRESULT result = m_renderer->GetDxContext()->Map( page.buffer, 0, page.written ? D3D11_MAP_WRITE_NO_OVERWRITE : D3D11_MAP_WRITE_DISCARD, 0, &subresource );
+		if ( WIN_FAILED( result ) )
+		{
+			throw exception::FailedToLock( "Failed to map constant ring page!" );
+		}
+		m_mapped = (unsigned char *)subresource.pData;
+		page.written = true;
+	}
+
+	memcpy( m_mapped + m_offset, data, sizeInBytes );
+
+	Allocation allocation{ page.buffer, (UINT)( m_offset / 16 ), (UINT)( alignedSize / 16 ), m_frame };
+	m_offset += alignedSize;
+	return allocation;
+}
+
+void ConstantRing::Flush()
+{
+	if ( m_mapped )
+	{
+		m_renderer->GetDxContext()->Unmap( m_pages[ m_page ].buffer, 0 );
+		m_mapped = nullptr;
+	}
+}
+
+bool ConstantRing::Current( const Allocation & allocation ) const
+{
+	return allocation.buffer != nullptr && allocation.frame == m_frame;
+}
+
+size_t ConstantRing::GetPageCount() const
+{
+	return m_pages.size();
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#pragma once
+
+#include <medx11/DirectX.h>
+#include <atlbase.h>
+#include <vector>
+#include <cstddef>
+
+namespace medx11
+{
+	class Renderer;
+
+	/// <summary>
+	/// Suballocates constants for the current frame from a few large dynamic constant buffers ("pages"), written with
+	/// NO_OVERWRITE and bound by offset (Direct3D 11.1). Each page is discarded on its first write of a frame, so
+	/// allocations are only valid for the frame they were made in.
+	/// Without 11.1 constant buffer offsetting the ring is unavailable, and constant buffers keep their own buffers.
+	/// </summary>
+	class ConstantRing
+	{
+	public:
+		/// <summary>
+		/// Offsets and sizes are in 16 byte constants, as the 11.1 binds take them, in multiples of Alignment.
+		/// </summary>
+		struct Allocation
+		{
+			ID3D11Buffer * buffer;
+			UINT firstConstant;
+			UINT numConstants;
+			size_t frame;
+		};
+
+		static const size_t Alignment = 256;
+
+		ConstantRing( Renderer * renderer, size_t pageSizeInBytes = 512 * 1024 );
+		~ConstantRing();
+
+		bool Available() const;
+
+		/// <summary>
+		/// Start a new frame, invalidating all allocations.
+		/// </summary>
+		void BeginFrame();
+
+		/// <summary>
+		/// Copy constants into the ring. The allocation spans at least reserveInBytes, so that it can be bound at a
+		/// shader's full cbuffer size when only part of it is written. The current page stays mapped for further writes
+		/// until Flush.
+		/// </summary>
+		Allocation Write( const void * data, size_t sizeInBytes, size_t reserveInBytes = 0 );
+
+		/// <summary>
+		/// Unmap the current page, which must happen before a draw reads from it.
+		/// </summary>
+		void Flush();
+
+		/// <summary>
+		/// True if an allocation was made this frame, so its constants are still in the ring.
+		/// </summary>
+		bool Current( const Allocation & allocation ) const;
+
+		size_t GetPageCount() const;
+
+	private:
+		struct Page
+		{
+			CComPtr< ID3D11Buffer > buffer;
+			bool written; // Discarded and written to this frame.
+		};
+
+		Renderer * m_renderer;
+		size_t m_pageSizeInBytes;
+		bool m_available;
+		std::vector< Page > m_pages;
+		size_t m_page;
+		size_t m_offset; // In bytes, into the current page.
+		unsigned char * m_mapped; // The current page while mapped.
+		size_t m_frame;
+	};
+}
\ No newline at end of file
@@ -3,6 +3,8 @@
 //
 
 #include <medx11/Conversion.h>
+#include <DirectXTex.h>
+#include <algorithm>
 
 template<> 
 DXGI_FORMAT unify::Cast( me::render::Format::TYPE format )
@@ -82,22 +84,22 @@ DXGI_FORMAT unify::Cast( me::render::Format::TYPE format )
 	case Format::G8R8_G8B8_UNorm: return DXGI_FORMAT_G8R8_G8B8_UNORM;
 	case Format::BC1_Typeless: return DXGI_FORMAT_BC1_TYPELESS;
 	case Format::BC1_UNorm: return DXGI_FORMAT_BC1_UNORM;
-	case Format::BC2_Typeless: return DXGI_FORMAT_BC1_UNORM_SRGB;
-	case Format::BC2_UNorm: return DXGI_FORMAT_BC2_TYPELESS;
-	case Format::BC2_UNorm_SRGB: return DXGI_FORMAT_BC2_UNORM;
-	case Format::BC3_Typeless: return DXGI_FORMAT_BC2_UNORM_SRGB;
-	case Format::BC3_UNorm: return DXGI_FORMAT_BC3_TYPELESS;
-	case Format::BC3_UNorm_SRGB: return DXGI_FORMAT_BC3_UNORM;
-	case Format::BC4_Typeless: return DXGI_FORMAT_BC3_UNORM_SRGB;
-	case Format::BC4_UNorm: return DXGI_FORMAT_BC4_TYPELESS;
-	case Format::BC4_SNorm: return DXGI_FORMAT_BC4_UNORM;
-	case Format::BC5_Typeless: return DXGI_FORMAT_BC4_SNORM;
-	case Format::BC5_UNorm: return DXGI_FORMAT_BC5_TYPELESS;
-	case Format::BC5_SNorm: return DXGI_FORMAT_BC5_UNORM;
-	case Format::B5G6R5_UNorm: return DXGI_FORMAT_BC5_SNORM;
-	case Format::B5G5R5A1_UNorm: return DXGI_FORMAT_B5G6R5_UNORM;
-	case Format::B8G8R8A8_UNorm: return DXGI_FORMAT_B5G5R5A1_UNORM;
-	case Format::B8G8R8X8_UNorm: return DXGI_FORMAT_B8G8R8A8_UNORM;
+	case Format::BC2_Typeless: return DXGI_FORMAT_BC2_TYPELESS;
+	case Format::BC2_UNorm: return DXGI_FORMAT_BC2_UNORM;
+	case Format::BC2_UNorm_SRGB: return DXGI_FORMAT_BC2_UNORM_SRGB;
+	case Format::BC3_Typeless: return DXGI_FORMAT_BC3_TYPELESS;
+	case Format::BC3_UNorm: return DXGI_FORMAT_BC3_UNORM;
+	case Format::BC3_UNorm_SRGB: return DXGI_FORMAT_BC3_UNORM_SRGB;
+	case Format::BC4_Typeless: return DXGI_FORMAT_BC4_TYPELESS;
+	case Format::BC4_UNorm: return DXGI_FORMAT_BC4_UNORM;
+	case Format::BC4_SNorm: return DXGI_FORMAT_BC4_SNORM;
+	case Format::BC5_Typeless: return DXGI_FORMAT_BC5_TYPELESS;
+	case Format::BC5_UNorm: return DXGI_FORMAT_BC5_UNORM;
+	case Format::BC5_SNorm: return DXGI_FORMAT_BC5_SNORM;
+	case Format::B5G6R5_UNorm: return DXGI_FORMAT_B5G6R5_UNORM;
+	case Format::B5G5R5A1_UNorm: return DXGI_FORMAT_B5G5R5A1_UNORM;
+	case Format::B8G8R8A8_UNorm: return DXGI_FORMAT_B8G8R8A8_UNORM;
+	case Format::B8G8R8X8_UNorm: return DXGI_FORMAT_B8G8R8X8_UNORM;
 	case Format::R10G10B10_XR_BIAS_A2_UNorm: return DXGI_FORMAT_R10G10B10_XR_BIAS_A2_UNORM;
 	case Format::B8G8R8A8Typeless: return DXGI_FORMAT_B8G8R8A8_TYPELESS;
 	case Format::B8G8R8A8UNormSRGB: return DXGI_FORMAT_B8G8R8A8_UNORM_SRGB;
@@ -208,22 +210,22 @@ me::render::Format::TYPE unify::Cast( DXGI_FORMAT format )
 	case DXGI_FORMAT_G8R8_G8B8_UNORM: return Format::G8R8_G8B8_UNorm;
 	case DXGI_FORMAT_BC1_TYPELESS: return Format::BC1_Typeless;
 	case DXGI_FORMAT_BC1_UNORM: return Format::BC1_UNorm;
-	case DXGI_FORMAT_BC1_UNORM_SRGB: return Format::BC2_Typeless;
-	case DXGI_FORMAT_BC2_TYPELESS: return Format::BC2_UNorm;
-	case DXGI_FORMAT_BC2_UNORM: return Format::BC2_UNorm_SRGB;
-	case DXGI_FORMAT_BC2_UNORM_SRGB: return Format::BC3_Typeless;
-	case DXGI_FORMAT_BC3_TYPELESS: return Format::BC3_UNorm;
-	case DXGI_FORMAT_BC3_UNORM: return Format::BC3_UNorm_SRGB;
-	case DXGI_FORMAT_BC3_UNORM_SRGB: return Format::BC4_Typeless;
-	case DXGI_FORMAT_BC4_TYPELESS: return Format::BC4_UNorm;
-	case DXGI_FORMAT_BC4_UNORM: return Format::BC4_SNorm;
-	case DXGI_FORMAT_BC4_SNORM: return Format::BC5_Typeless;
-	case DXGI_FORMAT_BC5_TYPELESS: return Format::BC5_UNorm;
-	case DXGI_FORMAT_BC5_UNORM: return Format::BC5_SNorm;
-	case DXGI_FORMAT_BC5_SNORM: return Format::B5G6R5_UNorm;
-	case DXGI_FORMAT_B5G6R5_UNORM: return Format::B5G5R5A1_UNorm;
-	case DXGI_FORMAT_B5G5R5A1_UNORM: return Format::B8G8R8A8_UNorm;
-	case DXGI_FORMAT_B8G8R8A8_UNORM: return Format::B8G8R8X8_UNorm;
+	case DXGI_FORMAT_BC2_TYPELESS: return Format::BC2_Typeless;
+	case DXGI_FORMAT_BC2_UNORM: return Format::BC2_UNorm;
+	case DXGI_FORMAT_BC2_UNORM_SRGB: return Format::BC2_UNorm_SRGB;
+	case DXGI_FORMAT_BC3_TYPELESS: return Format::BC3_Typeless;
+	case DXGI_FORMAT_BC3_UNORM: return Format::BC3_UNorm;
+	case DXGI_FORMAT_BC3_UNORM_SRGB: return Format::BC3_UNorm_SRGB;
+	case DXGI_FORMAT_BC4_TYPELESS: return Format::BC4_Typeless;
+	case DXGI_FORMAT_BC4_UNORM: return Format::BC4_UNorm;
+	case DXGI_FORMAT_BC4_SNORM: return Format::BC4_SNorm;
+	case DXGI_FORMAT_BC5_TYPELESS: return Format::BC5_Typeless;
+	case DXGI_FORMAT_BC5_UNORM: return Format::BC5_UNorm;
+	case DXGI_FORMAT_BC5_SNORM: return Format::BC5_SNorm;
+	case DXGI_FORMAT_B5G6R5_UNORM: return Format::B5G6R5_UNorm;
+	case DXGI_FORMAT_B5G5R5A1_UNORM: return Format::B5G5R5A1_UNorm;
+	case DXGI_FORMAT_B8G8R8A8_UNORM: return Format::B8G8R8A8_UNorm;
+	case DXGI_FORMAT_B8G8R8X8_UNORM: return Format::B8G8R8X8_UNorm;
 	case DXGI_FORMAT_R10G10B10_XR_BIAS_A2_UNORM: return Format::R10G10B10_XR_BIAS_A2_UNorm;
 	case DXGI_FORMAT_B8G8R8A8_TYPELESS: return Format::B8G8R8A8Typeless;
 	case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB: return Format::B8G8R8A8UNormSRGB;
@@ -289,3 +291,20 @@ me::render::BufferUsage::TYPE unify::Cast( D3D11_USAGE usage )
 
 	throw unify::Exception( "Invalid usage!" );
 }
+
+medx11::FormatElement medx11::GetFormatElement( DXGI_FORMAT format )
+{
+	size_t bitsPerPixel = DirectX::BitsPerPixel( format );
+	if ( DirectX::IsCompressed( format ) )
+	{
+		return FormatElement{ 4, 4, bitsPerPixel * 16 / 8 };
+	}
+	else if ( DirectX::IsPacked( format ) )
+	{
+		return FormatElement{ 2, 1, bitsPerPixel * 2 / 8 };
+	}
+	else
+	{
+		return FormatElement{ 1, 1, (std::max)( bitsPerPixel / 8, (size_t)1 ) };
+	}
+}
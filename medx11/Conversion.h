@@ -19,3 +19,19 @@ namespace unify
 	template<> D3D11_USAGE Cast( me::render::BufferUsage::TYPE usage );
 	template<> me::render::BufferUsage::TYPE Cast( D3D11_USAGE usage );
 }
+
+namespace medx11
+{
+	/// <summary>
+	/// The smallest addressable unit of a format's image data; a pixel, a 4x4 block for block compressed formats, or a
+	/// pixel pair for packed formats. Offsets into image rows, and update regions, work in whole elements.
+	/// </summary>
+	struct FormatElement
+	{
+		unsigned int width;
+		unsigned int height;
+		size_t bytes;
+	};
+
+	FormatElement GetFormatElement( DXGI_FORMAT format );
+}
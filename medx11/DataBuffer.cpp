@@ -5,21 +5,26 @@
 #include <me/exception/FailedToCreate.h>
 #include <me/exception/FailedToLock.h>
 #include <me/exception/NotImplemented.h>
-#include <me/exception/Exception.h>
+#include <cstring>
 
 using namespace medx11;
 using namespace me;
 using namespace render;
 
-DataBuffer::DataBuffer( IRenderer * renderer )
+DataBuffer::DataBuffer( IRenderer * renderer, View::TYPE view )
 	: m_renderer( dynamic_cast< Renderer * >(renderer) )
-	, m_usage( BufferUsage::Default )
-	// TODO: , m_shaderResourceView{}
+	, m_view{ view }
+	, m_noOverwrite{ false }
 {
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options{};
+	if ( SUCCEEDED( m_renderer->GetDxDevice()->CheckFeatureSupport( D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof( options ) ) ) )
+	{
+		m_noOverwrite = options.MapNoOverwriteOnDynamicBufferSRV ? true : false;
+	}
 }
 
-DataBuffer::DataBuffer( IRenderer * renderer, DataBufferParameters parameters )
-	: DataBuffer( renderer )
+DataBuffer::DataBuffer( IRenderer * renderer, DataBufferParameters parameters, View::TYPE view )
+	: DataBuffer( renderer, view )
 {
 	Create( parameters );
 }
@@ -34,199 +39,227 @@ void DataBuffer::Create( DataBufferParameters parameters )
 {
 	Destroy();
 
-	bool gaps = false; // We do not support gaps in buffers.
-	for( size_t slot = 0; slot < vd->NumberOfSlots(); slot++ )
-	{
-		size_t count = 0;
-		const void * source = 0;
-		if ( slot < parameters.countAndSource.size() )
-		{
-			count = parameters.countAndSource[slot].count;
-			source = parameters.countAndSource[slot].source;
-		}
-
-		if ( count == 0 )
-		{
-			if ( vd->GetInstances( slot ) > 0 )
-			{
-				count = vd->GetInstances( slot );
-			}
-			else
-			{
-				gaps = true;
-				continue;
-			}
-		}
-		else if ( gaps == true )
-		{
-			throw exception::FailedToCreate( "Vertex buffer has empty gaps, likely due to requested create sizes and instancing!" );
-		}
-
-		BufferUsage::TYPE usage = parameters.usage;
-		usage = BufferUsage::Dynamic;
-
-		m_usage.push_back( usage );
-		m_strides.push_back( parameters.stride );
-		m_lengths.push_back( count );
-
-		// Ensure we have some sort of idea what we need to be...
-		if ( GetSizeInBytes( slot ) == 0 )
-		{
-			throw exception::FailedToCreate( "Not a valid data buffer size!" );
-		}
-
-		auto dxDevice = m_renderer->GetDxDevice();
-
-		// Ensure that if we are BufferUsage::Immutable, then source is not null.
-		if ( usage == BufferUsage::Immutable && source == nullptr )
-		{
-			throw exception::FailedToCreate( "Data buffer is immutable, yet source is null!" );
-		}
-
-		D3D11_USAGE usageDX{};
-		unsigned int CPUAccessFlags = 0; // TODO: This needs to be managed better (from parameters or XML?)
-		switch ( m_usage[slot] )
-		{
-		case BufferUsage::Default:
-			usageDX = D3D11_USAGE_DEFAULT;
-			break;
-		case BufferUsage::Immutable:
-			usageDX = D3D11_USAGE_IMMUTABLE;
-			break;
-		case BufferUsage::Dynamic:
-			usageDX = D3D11_USAGE_DYNAMIC;
-			CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-			break;
-		case BufferUsage::Staging:
-			usageDX = D3D11_USAGE_STAGING;
-			break;
-		}
-
-		D3D11_BUFFER_DESC DataBufferDesc{};
-		DataBufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-		DataBufferDesc.ByteWidth = parameters.stride;
-		DataBufferDesc.Usage = usageDX;
-		DataBufferDesc.CPUAccessFlags = CPUAccessFlags;
-
-		HRESULT result;
-		ID3D11Buffer * buffer;
-		if ( source != nullptr )
-		{
-			D3D11_SUBRESOURCE_DATA initialData{};
-			initialData.pSysMem = source;
-			result = dxDevice->CreateBuffer( &DataBufferDesc, &initialData, &buffer );
-		}
-		else
-		{
-			result = dxDevice->CreateBuffer( &DataBufferDesc, nullptr, &buffer );
-		}
-		OnFailedThrow( result, "Failed to create vertex buffer!" );
-		m_buffers.push_back( buffer );
+	for( auto && countAndSource : parameters.countAndSource )
+	{
+		Add( parameters.stride, countAndSource.count, countAndSource.source, parameters.usage );
+	}
+}
+
+void DataBuffer::Add( size_t stride, size_t count, const void * source, BufferUsage::TYPE usage )
+{
+	if ( stride * count == 0 )
+	{
+		throw exception::FailedToCreate( "Not a valid data buffer size!" );
+	}
+
+	if ( m_view == View::Raw && stride % 4 != 0 )
+	{
+		throw exception::FailedToCreate( "Raw data buffer stride must be a multiple of 4!" );
+	}
+
+	// Ensure that if we are BufferUsage::Immutable, then source is not null.
+	if ( usage == BufferUsage::Immutable && source == nullptr )
+	{
+		throw exception::FailedToCreate( "Data buffer is immutable, yet source is null!" );
+	}
+
+	D3D11_USAGE usageDX{};
+	unsigned int CPUAccessFlags = 0;
+	switch ( usage )
+	{
+	case BufferUsage::Default:
+		usageDX = D3D11_USAGE_DEFAULT;
+		break;
+	case BufferUsage::Immutable:
+		usageDX = D3D11_USAGE_IMMUTABLE;
+		break;
+	case BufferUsage::Dynamic:
+		usageDX = D3D11_USAGE_DYNAMIC;
+		CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		break;
+	case BufferUsage::Staging:
+		throw exception::FailedToCreate( "Data buffers are read by shaders, so can't be staging!" );
+	}
+
+	D3D11_BUFFER_DESC dataBufferDesc{};
+	dataBufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	dataBufferDesc.ByteWidth = (UINT)( stride * count );
+	dataBufferDesc.Usage = usageDX;
+	dataBufferDesc.CPUAccessFlags = CPUAccessFlags;
+	if ( m_view == View::Structured )
+	{
+		dataBufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+		dataBufferDesc.StructureByteStride = (UINT)stride;
+	}
+	else
+	{
+		dataBufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+	}
+
+	auto dxDevice = m_renderer->GetDxDevice();
+
+	D3D11_SUBRESOURCE_DATA initialData{};
+	initialData.pSysMem = source;
+	CComPtr< ID3D11Buffer > buffer;
+	HRESULT result = dxDevice->CreateBuffer( &dataBufferDesc, source ? &initialData : nullptr, &buffer );
+	if ( WIN_FAILED( result ) )
+	{
+		throw exception::FailedToCreate( "Failed to create data buffer!" );
+	}
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc{};
+	viewDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFEREX;
+	if ( m_view == View::Structured )
+	{
+		viewDesc.Format = DXGI_FORMAT_UNKNOWN;
+		viewDesc.BufferEx.NumElements = (UINT)count;
+	}
+	else
+	{
+		viewDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+		viewDesc.BufferEx.NumElements = (UINT)( stride * count / 4 );
+		viewDesc.BufferEx.Flags = D3D11_BUFFEREX_SRV_FLAG_RAW;
+	}
+
+	CComPtr< ID3D11ShaderResourceView > view;
+	result = dxDevice->CreateShaderResourceView( buffer, &viewDesc, &view );
+	if ( WIN_FAILED( result ) )
+	{
+		throw exception::FailedToCreate( "Failed to create data buffer view!" );
 	}
+
+	m_buffers.push_back( buffer );
+	m_views.push_back( view );
+	m_usage.push_back( usage );
+	m_strides.push_back( stride );
+	m_lengths.push_back( count );
+	m_appendCursors.push_back( count ); // So the first append discards.
+	m_locked.push_back( false );
 }
 
 void DataBuffer::Destroy()
 {
-	m_buffers.Clear();
-	m_lengths.clear();
+	m_views.clear();
+	m_buffers.clear();
+	m_usage.clear();
 	m_strides.clear();
+	m_lengths.clear();
+	m_appendCursors.clear();
+	m_locked.clear();
 }
 
-void DataBuffer::Use( ConstantBufferUse bufferUse ) const
+void DataBuffer::Use( ResourceType::TYPE type, size_t startSlot ) const
 {
+	if ( m_views.empty() )
+	{
+		return;
+	}
+
 	auto dxContext = m_renderer->GetDxContext();
 
-	switch( bufferUse )
+	std::vector< ID3D11ShaderResourceView * > views( m_views.begin(), m_views.end() );
+	UINT count = (UINT)views.size();
+
+	switch( type )
 	{
-		case ConstantBufferUse::PixelShader:
-		dxContext->PSSetConstantBuffers( 0, m_buffers.Size(), m_buffers.GetBuffers() );
+	case ResourceType::PixelShader:
+		dxContext->PSSetShaderResources( (UINT)startSlot, count, &views[0] );
 		break;
 
-		case ConstantBufferUse::VertexShader:
-		dxContext->VSSetConstantBuffers( 0, m_buffers.Size(), m_buffers.GetBuffers() );
+	case ResourceType::VertexShader:
+		dxContext->VSSetShaderResources( (UINT)startSlot, count, &views[0] );
 		break;
 
-		case ConstantBufferUse::ComputeShader:
-		dxContext->CSSetConstantBuffers( 0, m_buffers.Size(), m_buffers.GetBuffers() );
-		break;
-		
-		case ConstantBufferUse::DomainShader:
-		dxContext->DSSetConstantBuffers( 0, m_buffers.Size(), m_buffers.GetBuffers() );
+	case ResourceType::ComputeShader:
+		dxContext->CSSetShaderResources( (UINT)startSlot, count, &views[0] );
 		break;
 
-		case ConstantBufferUse::GeometryShader:
-		dxContext->GSSetConstantBuffers( 0, m_buffers.Size(), m_buffers.GetBuffers() );
+	case ResourceType::DomainShader:
+		dxContext->DSSetShaderResources( (UINT)startSlot, count, &views[0] );
 		break;
 
-		case ConstantBufferUse::HullShader:
-		dxContext->HSSetConstantBuffers( 0, m_buffers.Size(), m_buffers.GetBuffers() );
+	case ResourceType::GeometryShader:
+		dxContext->GSSetShaderResources( (UINT)startSlot, count, &views[0] );
 		break;
+
+	default:
+		throw unify::Exception( "ResourceType::ToString: Not a valid usage type!" );
 	}
 }
 
+ID3D11ShaderResourceView * DataBuffer::GetView( size_t bufferIndex ) const
+{
+	return m_views[ bufferIndex ];
+}
+
 void DataBuffer::Lock( size_t bufferIndex, unify::DataLock & lock )
 {
-	if ( bufferIndex >= m_buffers.size() ) throw exception::FailedToLock( "Failed to lock vertex  buffer (buffer index out of range)!" );
-	if ( m_locked[ bufferIndex ] ) throw exception::FailedToLock( "Failed to lock vertex  buffer (buffer already locked)!" );
+	if ( bufferIndex >= m_buffers.size() ) throw exception::FailedToLock( "Failed to lock data buffer (buffer index out of range)!" );
+	if ( m_locked[ bufferIndex ] ) throw exception::FailedToLock( "Failed to lock data buffer (buffer already locked)!" );
+	if ( m_usage[ bufferIndex ] != BufferUsage::Dynamic ) throw exception::FailedToLock( "Failed to lock data buffer (not dynamic)!" );
 
 	auto dxContext = m_renderer->GetDxContext();
 	D3D11_MAPPED_SUBRESOURCE subresource{};
-	HRESULT result = dxContext->Map( m_buffers[ bufferIndex ], bufferIndex, D3D11_MAP::D3D11_MAP_WRITE_DISCARD, 0, &subresource );
-	if ( FAILED( result ) )
+	HRESULT result = dxContext->Map( m_buffers[ bufferIndex ], 0, D3D11_MAP_WRITE_DISCARD, 0, &subresource );
+	if ( WIN_FAILED( result ) )
 	{
-		throw unify::Exception( "Failed to set vertex shader!" );
-	}		
+		throw exception::FailedToLock( "Failed to lock data buffer!" );
+	}
 
-	lock.SetLock( subresource.pData, GetSizeInBytes(bufferIndex), unify::DataLock::ReadWrite, 0 );
-	m_locked[bufferIndex] = true;
+	lock.SetLock( subresource.pData, (unsigned int)GetSizeInBytes( bufferIndex ), unify::DataLockAccess::ReadWrite, 0 );
+	m_locked[ bufferIndex ] = true;
+	m_appendCursors[ bufferIndex ] = m_lengths[ bufferIndex ];
 }
 
-void DataBuffer::LockReadOnly( size_t bufferIndex, unify::DataLock & lock ) const
+void DataBuffer::Unlock( size_t bufferIndex, unify::DataLock & lock )
 {
-	if ( bufferIndex >= m_buffers.size() ) throw exception::FailedToLock( "Failed to lock vertex  buffer (buffer index out of range)!" );
-	if ( m_locked[ bufferIndex ] ) throw exception::FailedToLock( "Failed to lock vertex  buffer (buffer already locked)!" );
+	if ( bufferIndex >= m_buffers.size() ) throw exception::FailedToLock( "Failed to unlock data buffer (buffer index out of range)!" );
+	if ( ! m_locked[ bufferIndex ] ) throw exception::FailedToLock( "Failed to unlock data buffer (buffer not locked)!" );
 
-	auto dxContext = m_renderer->GetDxContext();
-	D3D11_MAPPED_SUBRESOURCE subresource{};
-	HRESULT result = dxContext->Map( m_buffers[ bufferIndex ], bufferIndex, D3D11_MAP::D3D11_MAP_WRITE_DISCARD, 0, &subresource );
-	if ( FAILED( result ) )
-	{
-		throw unify::Exception( "Failed to set vertex shader!" );
-	}		
-
-	lock.SetLock( subresource.pData, GetSizeInBytes(bufferIndex), unify::DataLock::Readonly, 0 );
-	m_locked[bufferIndex] = true;
+	m_renderer->GetDxContext()->Unmap( m_buffers[ bufferIndex ], 0 );
+	m_locked[ bufferIndex ] = false;
 }
 
-void DataBuffer::Unlock( size_t bufferIndex, unify::DataLock & lock )
+size_t DataBuffer::Append( size_t bufferIndex, const void * source, size_t count )
 {
-	if ( bufferIndex >= m_buffers.size() ) throw exception::FailedToLock( "Failed to unlock vertex  buffer (buffer index out of range)!" );
-	if ( ! m_locked[ bufferIndex ] ) throw exception::FailedToLock( "Failed to unlock vertex  buffer (buffer not locked)!" );
+	if ( bufferIndex >= m_buffers.size() ) throw exception::FailedToLock( "Failed to lock data buffer (buffer index out of range)!" );
+	if ( m_locked[ bufferIndex ] ) throw exception::FailedToLock( "Failed to lock data buffer (buffer already locked)!" );
+	if ( m_usage[ bufferIndex ] != BufferUsage::Dynamic ) throw exception::FailedToLock( "Failed to lock data buffer (not dynamic)!" );
+	if ( count > m_lengths[ bufferIndex ] ) throw exception::FailedToLock( "Failed to lock data buffer (append larger than buffer)!" );
+
+	// Elements behind the cursor may still be in use by the GPU, so we only discard once we wrap.
+	size_t offset = m_appendCursors[ bufferIndex ];
+	D3D11_MAP mapType = D3D11_MAP_WRITE_NO_OVERWRITE;
+	if ( ! m_noOverwrite || offset + count > m_lengths[ bufferIndex ] )
+	{
+		offset = 0;
+		mapType = D3D11_MAP_WRITE_DISCARD;
+	}
 
-	auto dxDevice = m_renderer->GetDxDevice();
 	auto dxContext = m_renderer->GetDxContext();
+	D3D11_MAPPED_SUBRESOURCE subresource{};
+	HRESULT result = dxContext->Map( m_buffers[ bufferIndex ], 0, mapType, 0, &subresource );
+	if ( WIN_FAILED( result ) )
+	{
+		throw exception::FailedToLock( "Failed to lock data buffer!" );
+	}
+	memcpy( (unsigned char *)subresource.pData + offset * m_strides[ bufferIndex ], source, count * m_strides[ bufferIndex ] );
+	dxContext->Unmap( m_buffers[ bufferIndex ], 0 );
 
-	dxContext->Unmap( m_buffers[ bufferIndex ], bufferIndex );
-
-	m_locked[bufferIndex] = false;
+	m_appendCursors[ bufferIndex ] = offset + count;
+	return offset;
 }
 
-void DataBuffer::UnlockReadOnly( size_t bufferIndex, unify::DataLock & lock ) const
+void DataBuffer::Rewind( size_t bufferIndex )
 {
-	if ( bufferIndex >= m_buffers.size() ) throw exception::FailedToLock( "Failed to unlock vertex  buffer (buffer index out of range)!" );
-	if ( ! m_locked[ bufferIndex ] ) throw exception::FailedToLock( "Failed to unlock vertex  buffer (buffer not locked)!" );
-
-	auto dxDevice = m_renderer->GetDxDevice();
-	auto dxContext = m_renderer->GetDxContext();
+	if ( bufferIndex >= m_buffers.size() ) throw exception::FailedToLock( "Failed to rewind data buffer (buffer index out of range)!" );
 
-	dxContext->Unmap( m_buffers[ bufferIndex ], bufferIndex );
-	
-	m_locked[bufferIndex] = false;
+	m_appendCursors[ bufferIndex ] = m_lengths[ bufferIndex ];
 }
 
 bool DataBuffer::Valid() const
 {
-	return m_buffers.size() == m_strides.size();
+	return ! m_buffers.empty() && m_buffers.size() == m_views.size();
 }
 
 bool DataBuffer::Locked( size_t bufferIndex ) const
@@ -239,6 +272,11 @@ BufferUsage::TYPE DataBuffer::GetUsage( size_t bufferIndex ) const
 	return m_usage[ bufferIndex ];
 }
 
+size_t DataBuffer::GetBufferCount() const
+{
+	return m_buffers.size();
+}
+
 size_t DataBuffer::GetStride( size_t bufferIndex ) const
 {
 	return m_strides[ bufferIndex ];
@@ -5,39 +5,91 @@
 
 #include <medx11/Renderer.h>
 #include <me/render/IDataBuffer.h>
+#include <me/render/BufferUsage.h>
+#include <me/render/ResourceType.h>
+#include <atlbase.h>
+#include <vector>
 
 namespace medx11
 {
+	/// <summary>
+	/// Buffers of data read by shaders through a shader resource view, as a StructuredBuffer (elements of stride
+	/// bytes) or a ByteAddressBuffer (raw, stride must be a multiple of 4).
+	/// Dynamic buffers can be streamed into with Append, which writes behind what the GPU may still be reading.
+	/// </summary>
 	class DataBuffer
 	{
 	public:
-		DataBuffer( me::render::IRenderer * renderer );
-		DataBuffer( me::render::IRenderer * renderer, me::render::DataBufferParameters parameters );
+		struct View
+		{
+			enum TYPE
+			{
+				Structured,
+				Raw
+			};
+		};
+
+		DataBuffer( me::render::IRenderer * renderer, View::TYPE view = View::Structured );
+		DataBuffer( me::render::IRenderer * renderer, me::render::DataBufferParameters parameters, View::TYPE view = View::Structured );
 		~DataBuffer();
 
-	public: // me::renderer::IDataBuffer
-		void Create( me::render::DataBufferParameters parameters ) override;
+		/// <summary>
+		/// Create a buffer for each count and source of the parameters, all of parameters.stride.
+		/// </summary>
+		void Create( me::render::DataBufferParameters parameters );
+
+		/// <summary>
+		/// Add a buffer of count elements. Source may be null unless the usage is immutable.
+		/// </summary>
+		void Add( size_t stride, size_t count, const void * source, me::render::BufferUsage::TYPE usage );
 
-	public: // me::IBuffer
 		void Destroy();
-		void Use( ConstantBufferUse bufferUse ) const override;
 
-		void Lock( size_t bufferIndex, unify::DataLock & lock ) override;
-		void LockReadOnly( size_t bufferIndex, unify::DataLock & lock ) const override;
-		void Unlock( size_t bufferIndex, unify::DataLock & lock ) override;
-		void UnlockReadOnly( size_t bufferIndex, unify::DataLock & lock ) const override;
-		
+		/// <summary>
+		/// Bind our views to a shader stage, from startSlot.
+		/// </summary>
+		void Use( me::render::ResourceType::TYPE type, size_t startSlot ) const;
+
+		ID3D11ShaderResourceView * GetView( size_t bufferIndex ) const;
+
+		/// <summary>
+		/// Lock a dynamic buffer for writing, discarding its contents.
+		/// </summary>
+		void Lock( size_t bufferIndex, unify::DataLock & lock );
+		void Unlock( size_t bufferIndex, unify::DataLock & lock );
+
+		/// <summary>
+		/// Copy count elements after the last append, returning the index of the first. Earlier elements are left alone
+		/// for the GPU (NO_OVERWRITE) until the buffer is full, then it is discarded and appends start over from 0.
+		/// Without 11.1 support for NO_OVERWRITE on shader resource buffers every append discards.
+		/// </summary>
+		size_t Append( size_t bufferIndex, const void * source, size_t count );
+
+		/// <summary>
+		/// Have the next append discard the buffer and start over from 0, such as at the start of a frame.
+		/// </summary>
+		void Rewind( size_t bufferIndex );
+
 		bool Valid() const;
 
-		bool Locked( size_t bufferIndex ) const override;
-		me::render::BufferUsage::TYPE GetUsage( size_t bufferIndex ) const override;
-		size_t GetStride( size_t bufferIndex ) const override;
-		size_t GetLength( size_t bufferIndex ) const override;
-		size_t GetSizeInBytes( size_t bufferIndex ) const override;
+		bool Locked( size_t bufferIndex ) const;
+		me::render::BufferUsage::TYPE GetUsage( size_t bufferIndex ) const;
+		size_t GetBufferCount() const;
+		size_t GetStride( size_t bufferIndex ) const;
+		size_t GetLength( size_t bufferIndex ) const;
+		size_t GetSizeInBytes( size_t bufferIndex ) const;
 
 	protected:
 		const Renderer * m_renderer;
+		View::TYPE m_view;
+		bool m_noOverwrite; // NO_OVERWRITE maps are allowed on dynamic buffers with views.
 
-		BufferArray m_buffers;
+		std::vector< CComPtr< ID3D11Buffer > > m_buffers;
+		std::vector< CComPtr< ID3D11ShaderResourceView > > m_views;
+		std::vector< me::render::BufferUsage::TYPE > m_usage;
+		std::vector< size_t > m_strides;
+		std::vector< size_t > m_lengths;
+		std::vector< size_t > m_appendCursors;
+		std::vector< bool > m_locked;
 	};
 }
\ No newline at end of file
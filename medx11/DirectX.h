@@ -18,6 +18,7 @@
 #pragma warning( disable: 4005 ) // warning C4005: 'MAKEFOURCC': macro redefinition\
 
 #include <D3D11.h>
+#include <d3d11_1.h>
 #include <D3DCompiler.h>
 #include <DirectXMath.h>
 
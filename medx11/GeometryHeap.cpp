@@ -0,0 +1,285 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#include <medx11/GeometryHeap.h>
+#include <medx11/Renderer.h>
+#include <me/exception/FailedToCreate.h>
+#include <algorithm>
+#include <iterator>
+
+using namespace medx11;
+using namespace me;
+
+GeometryHeap::GeometryHeap( Renderer * renderer, size_t pageSizeInBytes )
+	: m_renderer{ renderer }
+	, m_pageSizeInBytes{ pageSizeInBytes }
+{
+}
+
+GeometryHeap::~GeometryHeap()
+{
+}
+
+size_t GeometryHeap::Allocate( size_t stride, size_t count, const void * source )
+{
+	if ( stride * count == 0 )
+	{
+		throw exception::FailedToCreate( "Not a valid geometry heap allocation size!" );
+	}
+
+	auto & pages = m_pools[ stride ];
+
+	Allocation allocation{ stride, 0, 0, count, true };
+
+	// First fit, favoring earlier pages so later ones drain and can be reclaimed by Defragment.
+	bool found = false;
+	for ( size_t pageIndex = 0; ! found && pageIndex < pages.size(); pageIndex++ )
+	{
+		auto & freeBlocks = pages[ pageIndex ].freeBlocks;
+		for ( auto itr = freeBlocks.begin(); itr != freeBlocks.end(); ++itr )
+		{
+			if ( itr->second < count ) continue;
+
+			size_t offset = itr->first;
+			size_t remaining = itr->second - count;
+			freeBlocks.erase( itr );
+			if ( remaining )
+			{
+				freeBlocks[ offset + count ] = remaining;
+			}
+
+			allocation.page = pageIndex;
+			allocation.offset = offset;
+			found = true;
+			break;
+		}
+	}
+
+	if ( ! found )
+	{
+		Page page{};
+		page.capacity = (std::max)( m_pageSizeInBytes / stride, count );
+		page.buffer = CreatePage( stride, page.capacity );
+		if ( page.capacity > count )
+		{
+			page.freeBlocks[ count ] = page.capacity - count;
+		}
+
+		allocation.page = pages.size();
+		allocation.offset = 0;
+		pages.push_back( page );
+	}
+
+	size_t handle = 0;
+	if ( m_freeAllocations.empty() )
+	{
+		handle = m_allocations.size();
+		m_allocations.push_back( allocation );
+	}
+	else
+	{
+		handle = m_freeAllocations.back();
+		m_freeAllocations.pop_back();
+		m_allocations[ handle ] = allocation;
+	}
+
+	if ( source )
+	{
+		Update( handle, 0, count, source );
+	}
+
+	return handle;
+}
+
+void GeometryHeap::Free( size_t handle )
+{
+	if ( handle >= m_allocations.size() || ! m_allocations[ handle ].live )
+	{
+		return;
+	}
+
+	Allocation & allocation = m_allocations[ handle ];
+	auto & freeBlocks = m_pools[ allocation.stride ][ allocation.page ].freeBlocks;
+
+	size_t offset = allocation.offset;
+	size_t count = allocation.count;
+
+	// Coalesce with the free blocks on either side.
+	auto next = freeBlocks.lower_bound( offset );
+	if ( next != freeBlocks.end() && offset + count == next->first )
+	{
+		count += next->second;
+		next = freeBlocks.erase( next );
+	}
+
+	if ( next != freeBlocks.begin() && std::prev( next )->first + std::prev( next )->second == offset )
+	{
+		std::prev( next )->second += count;
+	}
+	else
+	{
+		freeBlocks[ offset ] = count;
+	}
+
+	allocation.live = false;
+	m_freeAllocations.push_back( handle );
+}
+
+void GeometryHeap::Update( size_t handle, size_t offset, size_t count, const void * source )
+{
+	const Allocation & allocation = m_allocations[ handle ];
+	if ( offset + count > allocation.count )
+	{
+		throw unify::Exception( "Geometry heap update out of range of allocation!" );
+	}
+
+	size_t begin = ( allocation.offset + offset ) * allocation.stride;
+	size_t end = begin + count * allocation.stride;
+	D3D11_BOX box{ (UINT)begin, 0, 0, (UINT)end, 1, 1 };
+
+	auto dxContext = m_renderer->GetDxContext();
+	dxContext->UpdateSubresource( m_pools[ allocation.stride ][ allocation.page ].buffer, 0, &box, source, 0, 0 );
+}
+
+GeometryHeap::Block GeometryHeap::Get( size_t handle ) const
+{
+	const Allocation & allocation = m_allocations[ handle ];
+	const Page & page = m_pools.find( allocation.stride )->second[ allocation.page ];
+	return Block{ page.buffer, allocation.stride, allocation.offset, allocation.count };
+}
+
+void GeometryHeap::Copy( ID3D11Buffer * destination, size_t destinationOffset, ID3D11Buffer * source, size_t sourceOffset, size_t sizeInBytes )
+{
+	if ( sizeInBytes == 0 )
+	{
+		return;
+	}
+
+	auto dxContext = m_renderer->GetDxContext();
+	D3D11_BOX box{ (UINT)sourceOffset, 0, 0, (UINT)( sourceOffset + sizeInBytes ), 1, 1 };
+
+	// A buffer is a single subresource, which can't be both the source and destination of a copy.
+	if ( destination == source )
+	{
+		CComPtr< ID3D11Buffer > bounce = CreatePage( 1, sizeInBytes );
+		dxContext->CopySubresourceRegion( bounce, 0, 0, 0, 0, source, 0, &box );
+		box = D3D11_BOX{ 0, 0, 0, (UINT)sizeInBytes, 1, 1 };
+		source = bounce;
+		dxContext->CopySubresourceRegion( destination, 0, (UINT)destinationOffset, 0, 0, source, 0, &box );
+		return;
+	}
+
+	dxContext->CopySubresourceRegion( destination, 0, (UINT)destinationOffset, 0, 0, source, 0, &box );
+}
+
+void GeometryHeap::Defragment()
+{
+	auto dxContext = m_renderer->GetDxContext();
+
+	for ( auto && pool : m_pools )
+	{
+		size_t stride = pool.first;
+		auto & pages = pool.second;
+
+		std::vector< size_t > live;
+		for ( size_t handle = 0; handle < m_allocations.size(); handle++ )
+		{
+			if ( m_allocations[ handle ].live && m_allocations[ handle ].stride == stride )
+			{
+				live.push_back( handle );
+			}
+		}
+
+		// Keep the current order, so allocations made together stay together.
+		std::sort( live.begin(), live.end(), [&]( size_t a, size_t b )
+		{
+			if ( m_allocations[ a ].page != m_allocations[ b ].page ) return m_allocations[ a ].page < m_allocations[ b ].page;
+			return m_allocations[ a ].offset < m_allocations[ b ].offset;
+		} );
+
+		std::vector< Page > packed;
+		std::vector< size_t > used;
+		for ( auto && handle : live )
+		{
+			Allocation & allocation = m_allocations[ handle ];
+
+			if ( packed.empty() || used.back() + allocation.count > packed.back().capacity )
+			{
+				Page page{};
+				page.capacity = (std::max)( m_pageSizeInBytes / stride, allocation.count );
+				page.buffer = CreatePage( stride, page.capacity );
+				packed.push_back( page );
+				used.push_back( 0 );
+			}
+
+			D3D11_BOX box{ (UINT)( allocation.offset * stride ), 0, 0, (UINT)( ( allocation.offset + allocation.count ) * stride ), 1, 1 };
+			dxContext->CopySubresourceRegion( packed.back().buffer, 0, (UINT)( used.back() * stride ), 0, 0, pages[ allocation.page ].buffer, 0, &box );
+
+			allocation.page = packed.size() - 1;
+			allocation.offset = used.back();
+			used.back() += allocation.count;
+		}
+
+		for ( size_t pageIndex = 0; pageIndex < packed.size(); pageIndex++ )
+		{
+			if ( used[ pageIndex ] < packed[ pageIndex ].capacity )
+			{
+				packed[ pageIndex ].freeBlocks[ used[ pageIndex ] ] = packed[ pageIndex ].capacity - used[ pageIndex ];
+			}
+		}
+
+		pages = packed;
+	}
+}
+
+GeometryHeap::Stats GeometryHeap::GetStats() const
+{
+	Stats stats{};
+	size_t freeInBytes = 0;
+	for ( auto && pool : m_pools )
+	{
+		for ( auto && page : pool.second )
+		{
+			stats.pages++;
+			stats.capacityInBytes += page.capacity * pool.first;
+			for ( auto && block : page.freeBlocks )
+			{
+				stats.freeBlocks++;
+				freeInBytes += block.second * pool.first;
+				stats.largestFreeBlockInBytes = (std::max)( stats.largestFreeBlockInBytes, block.second * pool.first );
+			}
+		}
+	}
+
+	for ( auto && allocation : m_allocations )
+	{
+		if ( ! allocation.live ) continue;
+		stats.allocations++;
+		stats.usedInBytes += allocation.count * allocation.stride;
+	}
+
+	if ( freeInBytes )
+	{
+		stats.fragmentation = 1.0f - (float)stats.largestFreeBlockInBytes / freeInBytes;
+	}
+	return stats;
+}
+
+CComPtr< ID3D11Buffer > GeometryHeap::CreatePage( size_t stride, size_t capacity )
+{
+	auto dxDevice = m_renderer->GetDxDevice();
+
+	D3D11_BUFFER_DESC bufferDesc{};
+	bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	bufferDesc.ByteWidth = (UINT)( stride * capacity );
+	bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+	bufferDesc.CPUAccessFlags = 0;
+
+	CComPtr< ID3D11Buffer > buffer;
+	HRESULT result = dxDevice->CreateBuffer( &bufferDesc, nullptr, &buffer );
+	if ( WIN_FAILED( result ) )
+	{
+		throw exception::FailedToCreate( "Failed to create geometry heap page of " + unify::Cast< std::string >( bufferDesc.ByteWidth ) + " bytes!" );
+	}
+	return buffer;
+}
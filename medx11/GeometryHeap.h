@@ -0,0 +1,103 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#pragma once
+
+#include <medx11/DirectX.h>
+#include <atlbase.h>
+#include <vector>
+#include <map>
+#include <cstddef>
+
+namespace medx11
+{
+	class Renderer;
+
+	/// <summary>
+	/// Suballocates vertex data from large shared vertex buffers ("pages"), one set of pages per vertex stride.
+	/// Allocations are measured in vertices, so a draw can address its vertices through the base vertex, and meshes
+	/// sharing a page share a single bind.
+	/// Allocations are handles, as defragmenting moves their data.
+	/// </summary>
+	class GeometryHeap
+	{
+	public:
+		static const size_t None = (size_t)-1;
+
+		/// <summary>
+		/// Where an allocation's vertices currently are.
+		/// </summary>
+		struct Block
+		{
+			ID3D11Buffer * buffer;
+			size_t stride;
+			size_t offset; // In vertices.
+			size_t count;
+		};
+
+		struct Stats
+		{
+			size_t pages;
+			size_t allocations;
+			size_t capacityInBytes;
+			size_t usedInBytes;
+			size_t freeBlocks;
+			size_t largestFreeBlockInBytes;
+			float fragmentation; // 0 when all free space is in one block, approaching 1 as it scatters.
+		};
+
+		GeometryHeap( Renderer * renderer, size_t pageSizeInBytes = 4 * 1024 * 1024 );
+		~GeometryHeap();
+
+		/// <summary>
+		/// Allocate count vertices of a stride, optionally filling them from source. Returns the allocation's handle.
+		/// </summary>
+		size_t Allocate( size_t stride, size_t count, const void * source );
+
+		void Free( size_t allocation );
+
+		/// <summary>
+		/// Overwrite count vertices of an allocation, from offset (in vertices) into the allocation.
+		/// </summary>
+		void Update( size_t allocation, size_t offset, size_t count, const void * source );
+
+		Block Get( size_t allocation ) const;
+
+		/// <summary>
+		/// Copy bytes between buffers on the GPU, bouncing through a temporary buffer when copying within one buffer.
+		/// </summary>
+		void Copy( ID3D11Buffer * destination, size_t destinationOffset, ID3D11Buffer * source, size_t sourceOffset, size_t sizeInBytes );
+
+		/// <summary>
+		/// Pack all live allocations into as few pages as possible, copying their data on the GPU.
+		/// </summary>
+		void Defragment();
+
+		Stats GetStats() const;
+
+	private:
+		struct Page
+		{
+			CComPtr< ID3D11Buffer > buffer;
+			size_t capacity; // In vertices.
+			std::map< size_t, size_t > freeBlocks; // Offset to count, in vertices.
+		};
+
+		struct Allocation
+		{
+			size_t stride;
+			size_t page;
+			size_t offset;
+			size_t count;
+			bool live;
+		};
+
+		CComPtr< ID3D11Buffer > CreatePage( size_t stride, size_t capacity );
+
+		Renderer * m_renderer;
+		size_t m_pageSizeInBytes;
+		std::map< size_t, std::vector< Page > > m_pools; // By stride.
+		std::vector< Allocation > m_allocations;
+		std::vector< size_t > m_freeAllocations;
+	};
+}
\ No newline at end of file
@@ -2,20 +2,125 @@
 // All Rights Reserved
 
 #include <medx11/IndexBuffer.h>
+#include <medx11/GeometryHeap.h>
 #include <me/exception/FailedToCreate.h>
 #include <me/exception/FailedToLock.h>
 #include <me/exception/OutOfBounds.h>
 #include <me/exception/NotImplemented.h>
+#include <emmintrin.h>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <cstring>
 
 using namespace medx11;
 using namespace me;
 using namespace render;
 
+namespace
+{
+	/// <summary>
+	/// Returns the largest index, four at a time. SSE2 has no unsigned 32 bit max, so lanes are compared biased into
+	/// the signed range.
+	/// </summary>
+	uint32_t MaxIndex( const uint32_t * indices, size_t count )
+	{
+		const __m128i bias = _mm_set1_epi32( (int)0x80000000 );
+		__m128i biasedMax = bias;
+		size_t i = 0;
+		for ( ; i + 4 <= count; i += 4 )
+		{
+			__m128i biased = _mm_xor_si128( _mm_loadu_si128( (const __m128i *)( indices + i ) ), bias );
+			__m128i greater = _mm_cmpgt_epi32( biased, biasedMax );
+			biasedMax = _mm_or_si128( _mm_and_si128( greater, biased ), _mm_andnot_si128( greater, biasedMax ) );
+		}
+
+		uint32_t lanes[ 4 ];
+		_mm_storeu_si128( (__m128i *)lanes, _mm_xor_si128( biasedMax, bias ) );
+		uint32_t maxIndex = (std::max)( (std::max)( lanes[ 0 ], lanes[ 1 ] ), (std::max)( lanes[ 2 ], lanes[ 3 ] ) );
+		for ( ; i < count; i++ )
+		{
+			maxIndex = (std::max)( maxIndex, indices[ i ] );
+		}
+		return maxIndex;
+	}
+
+	/// <summary>
+	/// Returns true if every index can be stored as 16 bits. 0xFFFF is the strip-cut value for R16 indices, so an
+	/// index buffer referencing vertex 65535 must stay 32 bits.
+	/// </summary>
+	bool FitsIn16Bits( const uint32_t * indices, size_t count )
+	{
+		return MaxIndex( indices, count ) < 0xFFFF;
+	}
+
+	/// <summary>
+	/// Narrow indices known to fit in 16 bits, eight at a time.
+	/// </summary>
+	void NarrowTo16Bits( const uint32_t * source, uint16_t * destination, size_t count )
+	{
+		// Packing saturates as signed, so bias into the signed range and back again.
+		const __m128i bias32 = _mm_set1_epi32( 0x8000 );
+		const __m128i bias16 = _mm_set1_epi16( (short)0x8000 );
+		size_t i = 0;
+		for ( ; i + 8 <= count; i += 8 )
+		{
+			__m128i low = _mm_sub_epi32( _mm_loadu_si128( (const __m128i *)( source + i ) ), bias32 );
+			__m128i high = _mm_sub_epi32( _mm_loadu_si128( (const __m128i *)( source + i + 4 ) ), bias32 );
+			_mm_storeu_si128( (__m128i *)( destination + i ), _mm_add_epi16( _mm_packs_epi32( low, high ), bias16 ) );
+		}
+
+		for ( ; i < count; i++ )
+		{
+			destination[ i ] = (uint16_t)source[ i ];
+		}
+	}
+
+	/// <summary>
+	/// Add a vertex offset to 16 or 32 bit indices, writing them out as 32 bits.
+	/// </summary>
+	void RebaseTo32Bits( const void * source, unsigned int stride, size_t count, uint32_t vertexOffset, uint32_t * destination )
+	{
+		const __m128i offset = _mm_set1_epi32( (int)vertexOffset );
+		size_t i = 0;
+		if ( stride == 2 )
+		{
+			const uint16_t * indices = (const uint16_t *)source;
+			const __m128i zero = _mm_setzero_si128();
+			for ( ; i + 8 <= count; i += 8 )
+			{
+				__m128i packed = _mm_loadu_si128( (const __m128i *)( indices + i ) );
+				_mm_storeu_si128( (__m128i *)( destination + i ), _mm_add_epi32( _mm_unpacklo_epi16( packed, zero ), offset ) );
+				_mm_storeu_si128( (__m128i *)( destination + i + 4 ), _mm_add_epi32( _mm_unpackhi_epi16( packed, zero ), offset ) );
+			}
+
+			for ( ; i < count; i++ )
+			{
+				destination[ i ] = indices[ i ] + vertexOffset;
+			}
+		}
+		else
+		{
+			const uint32_t * indices = (const uint32_t *)source;
+			for ( ; i + 4 <= count; i += 4 )
+			{
+				_mm_storeu_si128( (__m128i *)( destination + i ), _mm_add_epi32( _mm_loadu_si128( (const __m128i *)( indices + i ) ), offset ) );
+			}
+
+			for ( ; i < count; i++ )
+			{
+				destination[ i ] = indices[ i ] + vertexOffset;
+			}
+		}
+	}
+}
+
 IndexBuffer::IndexBuffer( IRenderer * renderer )
 	: m_renderer( dynamic_cast< Renderer * >(renderer) )
 	, m_locked( false )
 	, m_usage( BufferUsage::Default )
 	, m_length( 0 )
+	, m_capacity( 0 )
 	, m_stride( 0 )
 {
 }
@@ -35,134 +140,286 @@ void IndexBuffer::Create( IndexBufferParameters parameters )
 {
 	Destroy();
 
-	auto dxDevice = m_renderer->GetDxDevice();
-
-	HRESULT hr = S_OK;
-
 	m_stride = sizeof( unsigned int );
 	m_length = (unsigned int)parameters.countAndSource[0].count;
 
-	// Fill in a buffer description.
-	D3D11_BUFFER_DESC bufferDesc;
-	bufferDesc.Usage = D3D11_USAGE_DEFAULT;
-	bufferDesc.ByteWidth = m_stride * m_length;
-	bufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
-	bufferDesc.CPUAccessFlags = 0;
-	bufferDesc.MiscFlags = 0;
-	D3D11_SUBRESOURCE_DATA initialData = D3D11_SUBRESOURCE_DATA();
-	initialData.pSysMem = parameters.countAndSource[0].source;
+	// Indices are given as 32 bits. When they all fit we store 16 bits instead, halving memory and index fetch.
+	const void * source = parameters.countAndSource[0].source;
+	if ( source && m_renderer->GetRetainShadows() )
+	{
+		m_indexShadow.assign( (const uint32_t *)source, (const uint32_t *)source + m_length );
+	}
 
-	// Create the buffer with the device.
-	hr = dxDevice->CreateBuffer( &bufferDesc, &initialData, &m_buffer );
-	if ( WIN_FAILED( hr ) )
+	std::vector< uint16_t > narrowed;
+	if ( source && FitsIn16Bits( (const uint32_t *)source, m_length ) )
 	{
-		throw exception::FailedToCreate( "Failed to create index buffer!" );
+		narrowed.resize( m_length );
+		NarrowTo16Bits( (const uint32_t *)source, narrowed.data(), m_length );
+		source = narrowed.data();
+		m_stride = sizeof( uint16_t );
 	}
+
+	m_buffer = CreateBuffer( m_stride * m_length, source );
+	m_capacity = m_length;
 }
 
-void IndexBuffer::Resize( size_t bufferIndex, unsigned int numIndices )
+void IndexBuffer::Create( const void * source, unsigned int count, unsigned int stride )
 {
-	if ( GetUsage(bufferIndex) != BufferUsage::Staging )
+	Destroy();
+
+	if ( stride != sizeof( uint16_t ) && stride != sizeof( uint32_t ) )
 	{
-		throw unify::Exception( "IndexBuffer's usage is not Staging! Cannot resize without CPU read and write access." );
+		throw exception::FailedToCreate( "Index buffer indices must be 16 or 32 bits!" );
 	}
 
-	/*
-	TODO:
+	m_stride = stride;
+	m_length = count;
 
-	unsigned int oldNumberOfIndices = GetLength();
-	size_t oldSize = GetSize();
-	ID3D11Buffer * oldIndexBuffer = m_buffer;
-	m_buffer = 0;
-	m_length = 0;
+	if ( source && m_renderer->GetRetainShadows() )
+	{
+		m_indexShadow.resize( m_length );
+		RebaseTo32Bits( source, m_stride, m_length, 0, m_indexShadow.data() );
+	}
+
+	m_buffer = CreateBuffer( m_stride * m_length, source );
+	m_capacity = m_length;
+}
+
+void IndexBuffer::Resize( size_t bufferIndex, unsigned int numIndices )
+{
+	if ( numIndices < m_indexShadow.size() )
+	{
+		m_indexShadow.resize( numIndices );
+	}
 
-	Create( numIndices, this->GetFormat(), GetUsage(), m_createFlags );
+	if ( numIndices <= m_capacity )
+	{
+		m_length = numIndices;
+		return;
+	}
 
-	HRESULT hr;
-	unsigned char * oldData;
-	hr = oldIndexBuffer->Lock( 0, 0, (void**)&oldData, D3DLOCK_READONLY );
-	if( FAILED(hr) )
+	if ( m_stride == 0 )
 	{
-	throw exception::FailedToLock( "Failed to lock index buffer!" );
+		m_stride = sizeof( unsigned int );
 	}
 
-	unsigned char * newData;
-	hr = m_buffer->Lock( 0, 0, (void**)&newData, D3DLOCK_DISCARD );
-	if( FAILED(hr) )
+	// Grow geometrically, so that repeated appends copy each index only a constant number of times on average.
+	unsigned int capacity = (std::max)( numIndices, m_capacity * 2 );
+	CComPtr< ID3D11Buffer > buffer = CreateBuffer( m_stride * capacity, nullptr );
+
+	if ( m_buffer && m_length )
 	{
-	oldIndexBuffer->Release();
-	oldIndexBuffer = 0;
-	throw exception::FailedToLock( "Failed to lock index buffer!" );
+		D3D11_BOX box{ 0, 0, 0, m_stride * m_length, 1, 1 };
+		m_renderer->GetDxContext()->CopySubresourceRegion( buffer, 0, 0, 0, 0, m_buffer, 0, &box );
 	}
 
-	memcpy( newData, oldData, oldSize );
-	m_buffer->Unlock();
-	oldIndexBuffer->Unlock();
-	oldIndexBuffer->Release();
-	oldIndexBuffer = 0;
-	*/
+	m_buffer = buffer;
+	m_capacity = capacity;
+	m_length = numIndices;
 }
 
-size_t IndexBuffer::Append( size_t bufferIndex, const IndexBuffer & from, size_t vertexOffset  )
+size_t IndexBuffer::Append( size_t bufferIndex, const IndexBuffer & from, size_t vertexOffset )
 {
 	size_t offset = m_length;
+	unsigned int count = from.m_length;
 
-	if ( from.m_length == 0 )
+	if ( count == 0 )
 	{
 		return offset;
 	}
 
-	if ( from.GetUsage(bufferIndex) != BufferUsage::Staging )
+	// Indices that need no rebasing never leave the GPU. The heap's copy bounces through a temporary buffer when we
+	// append to ourselves, as a buffer can't be both the source and destination of a copy.
+	if ( vertexOffset == 0 && ( from.m_stride == m_stride || ! m_buffer ) )
 	{
-		throw unify::Exception( "From IndexBuffer's usage is not Staging!" );
+		if ( ! m_buffer )
+		{
+			m_stride = from.m_stride;
+		}
+
+		AppendShadow( offset, from, count, 0 );
+		Resize( bufferIndex, m_length + count );
+		m_renderer->GetGeometryHeap()->Copy( m_buffer, offset * m_stride, from.m_buffer, 0, count * m_stride );
+		return offset;
 	}
 
-	if ( m_length == 0 )
+	// Rebase from the source's shadow when it has one, else read its indices back.
+	std::vector< uint32_t > rebased( count );
+	if ( from.m_indexShadow.size() == count )
 	{
-		assert( 0 ); // TODO:
-		//Create( from.GetLength(), nullptr, from.GetUsage(), from.m_pimpl->m_createFlags );
+		RebaseTo32Bits( from.m_indexShadow.data(), sizeof( uint32_t ), count, (uint32_t)vertexOffset, rebased.data() );
 	}
 	else
 	{
-		if ( GetUsage(bufferIndex) != BufferUsage::Staging )
-		{
-			throw unify::Exception( "IndexBuffer's usage is not Staging!" );
-		}
-		Resize( bufferIndex, m_length + from.m_length );
+		std::vector< unsigned char > source = from.ReadBack();
+		RebaseTo32Bits( source.data(), from.m_stride, count, (uint32_t)vertexOffset, rebased.data() );
 	}
+	AppendShadow( offset, from, count, (uint32_t)vertexOffset );
 
-	// Copy vertices...
-	IndexLock locksrc, lockdest;
-	Lock( bufferIndex, lockdest );
-
-	from.LockReadOnly( bufferIndex, locksrc );
+	// An empty destination takes its stride from what the rebased indices need, not from the source.
+	if ( ! m_buffer )
+	{
+		m_stride = from.m_stride == sizeof( uint16_t ) && FitsIn16Bits( rebased.data(), count ) ? sizeof( uint16_t ) : sizeof( uint32_t );
+	}
 
-	for ( size_t i = 0; i < locksrc.Count(); ++i )
+	const void * data = rebased.data();
+	std::vector< uint16_t > narrowed;
+	if ( m_stride == 2 )
 	{
-		size_t to = offset + i;
-		const void * rawData = locksrc.GetItemReadonly< unsigned char >( i );
-		if ( locksrc.Stride() == 2 )
+		if ( FitsIn16Bits( rebased.data(), count ) )
 		{
-			unsigned short fromIndex = *static_cast< const short int * >(rawData);
-			lockdest.SetIndex( to, fromIndex + vertexOffset );
+			narrowed.resize( count );
+			NarrowTo16Bits( rebased.data(), narrowed.data(), count );
+			data = narrowed.data();
 		}
 		else
 		{
-			unsigned int fromIndex = *static_cast< const unsigned int * >(rawData);
-			lockdest.SetIndex( to, fromIndex + vertexOffset );
+			Widen();
 		}
 	}
 
-	from.UnlockReadOnly( bufferIndex, locksrc );
-	Unlock( bufferIndex, lockdest );
+	Resize( bufferIndex, m_length + count );
+
+	D3D11_BOX box{ (UINT)( offset * m_stride ), 0, 0, (UINT)( ( offset + count ) * m_stride ), 1, 1 };
+	m_renderer->GetDxContext()->UpdateSubresource( m_buffer, 0, &box, data, 0, 0 );
 
 	return offset;
 }
 
+void IndexBuffer::AppendShadow( size_t offset, const IndexBuffer & from, unsigned int count, uint32_t vertexOffset )
+{
+	// Keep our shadow only while it still matches what is on the GPU. Indexed, as 'from' may be us.
+	if ( m_indexShadow.size() == offset && from.m_indexShadow.size() == count )
+	{
+		m_indexShadow.resize( offset + count );
+		for ( size_t i = 0; i < count; i++ )
+		{
+			m_indexShadow[ offset + i ] = from.m_indexShadow[ i ] + vertexOffset;
+		}
+	}
+	else
+	{
+		m_indexShadow.clear();
+	}
+}
+
+CComPtr< ID3D11Buffer > IndexBuffer::CreateBuffer( unsigned int sizeInBytes, const void * source ) const
+{
+	auto dxDevice = m_renderer->GetDxDevice();
+
+	// Fill in a buffer description.
+	D3D11_BUFFER_DESC bufferDesc{};
+	bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+	bufferDesc.ByteWidth = sizeInBytes;
+	bufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+	bufferDesc.CPUAccessFlags = 0;
+	bufferDesc.MiscFlags = 0;
+	D3D11_SUBRESOURCE_DATA initialData = D3D11_SUBRESOURCE_DATA();
+	initialData.pSysMem = source;
+
+	// Create the buffer with the device.
+	CComPtr< ID3D11Buffer > buffer;
+	HRESULT hr = dxDevice->CreateBuffer( &bufferDesc, source ? &initialData : nullptr, &buffer );
+	if ( WIN_FAILED( hr ) )
+	{
+		throw exception::FailedToCreate( "Failed to create index buffer!" );
+	}
+	return buffer;
+}
+
+std::vector< unsigned char > IndexBuffer::ReadBack() const
+{
+	auto dxDevice = m_renderer->GetDxDevice();
+	auto dxContext = m_renderer->GetDxContext();
+
+	D3D11_BUFFER_DESC bufferDesc{};
+	bufferDesc.Usage = D3D11_USAGE_STAGING;
+	bufferDesc.ByteWidth = m_stride * m_length;
+	bufferDesc.BindFlags = 0;
+	bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+
+	CComPtr< ID3D11Buffer > staging;
+	HRESULT result = dxDevice->CreateBuffer( &bufferDesc, nullptr, &staging );
+	if ( WIN_FAILED( result ) )
+	{
+		throw exception::FailedToCreate( "Failed to create index buffer staging copy!" );
+	}
+
+	D3D11_BOX box{ 0, 0, 0, bufferDesc.ByteWidth, 1, 1 };
+	dxContext->CopySubresourceRegion( staging, 0, 0, 0, 0, m_buffer, 0, &box );
+
+	D3D11_MAPPED_SUBRESOURCE subresource{};
+	result = dxContext->Map( staging, 0, D3D11_MAP_READ, 0, &subresource );
+	if ( WIN_FAILED( result ) )
+	{
+		throw exception::FailedToLock( "Failed to read back index buffer!" );
+	}
+
+	std::vector< unsigned char > indices( (unsigned char *)subresource.pData, (unsigned char *)subresource.pData + bufferDesc.ByteWidth );
+	dxContext->Unmap( staging, 0 );
+	return indices;
+}
+
+std::vector< unsigned char > IndexBuffer::CopyIndices() const
+{
+	if ( m_indexShadow.size() != m_length )
+	{
+		return ReadBack();
+	}
+
+	std::vector< unsigned char > indices( m_stride * m_length );
+	if ( m_length == 0 )
+	{
+		return indices;
+	}
+
+	if ( m_stride == sizeof( uint16_t ) )
+	{
+		NarrowTo16Bits( m_indexShadow.data(), (uint16_t *)indices.data(), m_length );
+	}
+	else
+	{
+		memcpy( indices.data(), m_indexShadow.data(), indices.size() );
+	}
+	return indices;
+}
+
+void IndexBuffer::Widen()
+{
+	// Nothing allocated yet, so the next Resize creates the buffer at the wider stride.
+	if ( m_capacity == 0 || ! m_buffer )
+	{
+		m_stride = sizeof( uint32_t );
+		return;
+	}
+
+	std::vector< uint32_t > widened( m_capacity );
+	if ( m_length )
+	{
+		std::vector< unsigned char > indices = ReadBack();
+		RebaseTo32Bits( indices.data(), m_stride, m_length, 0, widened.data() );
+	}
+
+	m_stride = sizeof( uint32_t );
+	m_buffer = CreateBuffer( m_stride * m_capacity, widened.data() );
+}
+
 void IndexBuffer::Destroy()
 {
 	m_buffer = nullptr;
 	m_length = 0;
+	m_capacity = 0;
+	m_indexShadow.clear();
+}
+
+unsigned int IndexBuffer::GetStride() const
+{
+	return m_stride;
+}
+
+const std::vector< uint32_t > & IndexBuffer::GetIndexShadow() const
+{
+	return m_indexShadow;
 }
 
 size_t IndexBuffer::GetBufferCount() const
@@ -175,15 +432,9 @@ void IndexBuffer::Lock( size_t bufferIndex, unify::DataLock & lock )
 	if ( ! m_buffer ) throw exception::FailedToLock( "Failed to lock index buffer buffer (buffer not created)!" );
 	if ( m_locked ) throw exception::FailedToLock( "Failed to lock index buffer buffer (buffer already locked)!" );
 
-	auto dxContext = m_renderer->GetDxContext();
-	D3D11_MAPPED_SUBRESOURCE subresource{};
-	HRESULT result = dxContext->Map( m_buffer, (UINT)bufferIndex, D3D11_MAP::D3D11_MAP_WRITE_DISCARD, 0, &subresource );
-	if ( WIN_FAILED( result ) )
-	{
-		throw unify::Exception( "Failed to set vertex shader!" );
-	}		
-
-	lock.SetLock( subresource.pData, m_stride * m_length, unify::DataLockAccess::ReadWrite, 0 );
+	// A default usage buffer can't be mapped, so writes go to a CPU copy that is applied on unlock.
+	m_lockCopy = CopyIndices();
+	lock.SetLock( m_lockCopy.data(), m_stride, m_length, unify::DataLockAccess::ReadWrite, 0 );
 	m_locked = true;
 }
 
@@ -192,15 +443,8 @@ void IndexBuffer::LockReadOnly( size_t bufferIndex, unify::DataLock & lock ) con
 	if ( ! m_buffer ) throw exception::FailedToLock( "Failed to lock index buffer buffer (buffer not created)!" );
 	if ( m_locked ) throw exception::FailedToLock( "Failed to lock index buffer buffer (buffer already locked)!" );
 
-	auto dxContext = m_renderer->GetDxContext();
-	D3D11_MAPPED_SUBRESOURCE subresource{};
-	HRESULT result = dxContext->Map( m_buffer, (UINT)bufferIndex, D3D11_MAP::D3D11_MAP_WRITE_DISCARD, 0, &subresource );
-	if ( WIN_FAILED( result ) )
-	{
-		throw unify::Exception( "Failed to set vertex shader!" );
-	}		
-
-	lock.SetLock( subresource.pData, m_stride * m_length, unify::DataLockAccess::Readonly, 0 );
+	m_lockCopy = CopyIndices();
+	lock.SetLock( m_lockCopy.data(), m_stride, m_length, unify::DataLockAccess::Readonly, 0 );
 	m_locked = true;
 }
 
@@ -209,24 +453,33 @@ void IndexBuffer::Unlock( size_t bufferIndex, unify::DataLock & lock )
 	if ( ! m_buffer ) throw exception::FailedToLock( "Failed to unlock index buffer buffer (buffer not created)!" );
 	if ( ! m_locked ) throw exception::FailedToLock( "Failed to unlock index buffer buffer (buffer not locked)!" );
 
-	auto dxDevice = m_renderer->GetDxDevice();
-	auto dxContext = m_renderer->GetDxContext();
+	if ( m_length )
+	{
+		D3D11_BOX box{ 0, 0, 0, m_stride * m_length, 1, 1 };
+		m_renderer->GetDxContext()->UpdateSubresource( m_buffer, 0, &box, m_lockCopy.data(), 0, 0 );
+	}
 
-	dxContext->Unmap( m_buffer, (UINT)bufferIndex );
+	// The lock may have changed any index, so rebuild the shadow from what was written.
+	if ( m_renderer->GetRetainShadows() && m_length )
+	{
+		m_indexShadow.resize( m_length );
+		RebaseTo32Bits( m_lockCopy.data(), m_stride, m_length, 0, m_indexShadow.data() );
+	}
+	else
+	{
+		m_indexShadow.clear();
+	}
 
+	m_lockCopy.clear();
 	m_locked = false;
 }
 
 void IndexBuffer::UnlockReadOnly( size_t bufferIndex, unify::DataLock & lock ) const
 {
 	if ( ! m_buffer ) throw exception::FailedToLock( "Failed to unlock index buffer buffer (buffer not created)!" );
-	if ( m_locked ) throw exception::FailedToLock( "Failed to unlock index buffer buffer (buffer not locked)!" );
-
-	auto dxDevice = m_renderer->GetDxDevice();
-	auto dxContext = m_renderer->GetDxContext();
-
-	dxContext->Unmap( m_buffer, (UINT)bufferIndex );
+	if ( ! m_locked ) throw exception::FailedToLock( "Failed to unlock index buffer buffer (buffer not locked)!" );
 
+	m_lockCopy.clear();
 	m_locked = false;
 }
 
@@ -246,7 +499,7 @@ void IndexBuffer::Use( size_t startBuffer, size_t startSlot ) const
 	}
 
 	// Set the buffer.
-	dxContext->IASetIndexBuffer( m_buffer, DXGI_FORMAT_R32_UINT, 0 );
+	dxContext->IASetIndexBuffer( m_buffer, m_stride == 2 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT, 0 );
 }
 
 bool IndexBuffer::Locked( size_t bufferIndex ) const
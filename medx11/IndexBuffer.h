@@ -5,6 +5,8 @@
 
 #include <atlbase.h>
 #include <memory>
+#include <vector>
+#include <cstdint>
 
 #include <medx11/Renderer.h>
 #include <me/render/IIndexBuffer.h>
@@ -24,15 +26,38 @@ namespace medx11
 		~IndexBuffer();
 
 		void Create( me::render::IndexBufferParameters parameters );
+
+		/// <summary>
+		/// Create from indices already at their stored width (2 or 4 bytes), uploaded as they are.
+		/// </summary>
+		void Create( const void * source, unsigned int count, unsigned int stride );
+
+		/// <summary>
+		/// Change the number of indices, keeping existing ones. Storage grows geometrically, its contents copied on the GPU.
+		/// </summary>
 		void Resize( size_t bufferIndex, unsigned int numIndices );
 
 		/// <summary>
 		/// Append to our existing indices, the indices from ib, adding a vertex offset to each new index.
 		/// Returns the index offset for the first index from 'from'.
+		/// Without a vertex offset the indices are copied on the GPU, otherwise they are rebased from the source's shadow,
+		/// or read back when it has none. We are widened to 32 bit indices if the rebased indices no longer fit in 16 bits.
+		/// 'from' may be this buffer.
 		/// </summary>
 		size_t Append( size_t bufferIndex, const IndexBuffer & from, size_t vertexOffset = 0 );
 		void Destroy();
 
+		/// <summary>
+		/// Size of each index in bytes; 2 when every index fit below the 16 bit strip-cut value at creation, else 4.
+		/// Locks expose indices at this width, and report it as the lock's stride.
+		/// </summary>
+		unsigned int GetStride() const;
+
+		/// <summary>
+		/// Indices from the source data, as 32 bits, when the renderer retains shadows.
+		/// </summary>
+		const std::vector< uint32_t > & GetIndexShadow() const;
+
 		size_t GetBufferCount() const override;
 
 		void Lock( size_t bufferIndex, unify::DataLock & lock ) override;
@@ -48,12 +73,37 @@ namespace medx11
 		me::render::BufferUsage::TYPE GetUsage( size_t bufferIndex ) const override;
 
 	protected:
+		CComPtr< ID3D11Buffer > CreateBuffer( unsigned int sizeInBytes, const void * source ) const;
+
+		/// <summary>
+		/// Copy our indices back from the GPU, through a staging buffer.
+		/// </summary>
+		std::vector< unsigned char > ReadBack() const;
+
+		/// <summary>
+		/// Our indices at our stride, from the shadow when it is current, else read back from the GPU.
+		/// </summary>
+		std::vector< unsigned char > CopyIndices() const;
+
+		/// <summary>
+		/// Extend our shadow with the indices appended from 'from', or drop it if either shadow is missing.
+		/// </summary>
+		void AppendShadow( size_t offset, const IndexBuffer & from, unsigned int count, uint32_t vertexOffset );
+
+		/// <summary>
+		/// Convert our storage from 16 to 32 bit indices.
+		/// </summary>
+		void Widen();
+
 		const Renderer * m_renderer;
 		unsigned int m_createFlags;
 		CComPtr< ID3D11Buffer > m_buffer;
 		mutable bool m_locked;
 		me::render::BufferUsage::TYPE m_usage;
 		unsigned int m_stride; // Size of each item in the buffer.
-		unsigned int m_length; // Number of items we can store in the buffer.
+		unsigned int m_length; // Number of items in the buffer.
+		unsigned int m_capacity; // Number of items we can store in the buffer.
+		std::vector< uint32_t > m_indexShadow;
+		mutable std::vector< unsigned char > m_lockCopy; // Indices handed out by a lock, applied on Unlock.
 	};
 }
\ No newline at end of file
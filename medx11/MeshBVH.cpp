@@ -0,0 +1,449 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#include <medx11/MeshBVH.h>
+#include <medx11/VertexBuffer.h>
+#include <medx11/IndexBuffer.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#include <algorithm>
+#include <limits>
+
+using namespace medx11;
+
+namespace
+{
+	const size_t Bins = 16;
+	const size_t MaxLeafSize = 4;
+
+	/// <summary>
+	/// Half the surface area of a box, which is all the heuristic needs.
+	/// </summary>
+	float HalfArea( const float * min, const float * max )
+	{
+		float x = max[ 0 ] - min[ 0 ];
+		float y = max[ 1 ] - min[ 1 ];
+		float z = max[ 2 ] - min[ 2 ];
+		return x * y + y * z + z * x;
+	}
+
+	void Grow( float * min, float * max, const float * boundsMin, const float * boundsMax )
+	{
+		for ( size_t axis = 0; axis < 3; axis++ )
+		{
+			min[ axis ] = (std::min)( min[ axis ], boundsMin[ axis ] );
+			max[ axis ] = (std::max)( max[ axis ], boundsMax[ axis ] );
+		}
+	}
+
+	void Empty( float * min, float * max )
+	{
+		for ( size_t axis = 0; axis < 3; axis++ )
+		{
+			min[ axis ] = (std::numeric_limits< float >::max)();
+			max[ axis ] = -(std::numeric_limits< float >::max)();
+		}
+	}
+
+	inline __m128 Select( __m128 mask, __m128 a, __m128 b )
+	{
+		return _mm_or_ps( _mm_and_ps( mask, a ), _mm_andnot_ps( mask, b ) );
+	}
+}
+
+MeshBVH::MeshBVH( std::vector< float > x, std::vector< float > y, std::vector< float > z, std::vector< uint32_t > indices )
+	: m_x( std::move( x ) )
+	, m_y( std::move( y ) )
+	, m_z( std::move( z ) )
+	, m_indices( std::move( indices ) )
+{
+	if ( m_indices.empty() )
+	{
+		m_indices.resize( m_x.size() - m_x.size() % 3 );
+		for ( size_t i = 0; i < m_indices.size(); i++ )
+		{
+			m_indices[ i ] = (uint32_t)i;
+		}
+	}
+
+	m_build = std::async( std::launch::async, [this]() { Build(); } ).share();
+}
+
+MeshBVH::MeshBVH( const VertexBuffer & vertices, const IndexBuffer * indices )
+	: MeshBVH( vertices.GetPositionShadow().x, vertices.GetPositionShadow().y, vertices.GetPositionShadow().z, indices ? indices->GetIndexShadow() : std::vector< uint32_t >() )
+{
+	if ( m_x.empty() || ( indices && m_indices.empty() ) )
+	{
+		throw unify::Exception( "Failed to create mesh BVH (buffers have no CPU shadow)!" );
+	}
+}
+
+MeshBVH::~MeshBVH()
+{
+	Wait();
+}
+
+bool MeshBVH::Ready() const
+{
+	return m_build.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready;
+}
+
+void MeshBVH::Wait() const
+{
+	if ( m_build.valid() )
+	{
+		m_build.wait();
+	}
+}
+
+void MeshBVH::Build()
+{
+	size_t triangleCount = m_indices.size() / 3;
+	if ( triangleCount == 0 )
+	{
+		return;
+	}
+
+	// Indices out of range would read past the positions, leave such meshes empty.
+	size_t vertexCount = (std::min)( m_x.size(), (std::min)( m_y.size(), m_z.size() ) );
+	for ( auto && index : m_indices )
+	{
+		if ( index >= vertexCount )
+		{
+			return;
+		}
+	}
+
+	std::vector< float > bounds( triangleCount * 6 );
+	std::vector< float > centroids( triangleCount * 3 );
+	m_triangles.resize( triangleCount );
+	for ( size_t triangle = 0; triangle < triangleCount; triangle++ )
+	{
+		float * min = &bounds[ triangle * 6 ];
+		float * max = min + 3;
+		Empty( min, max );
+		for ( size_t corner = 0; corner < 3; corner++ )
+		{
+			uint32_t index = m_indices[ triangle * 3 + corner ];
+			float position[ 3 ] = { m_x[ index ], m_y[ index ], m_z[ index ] };
+			Grow( min, max, position, position );
+		}
+
+		for ( size_t axis = 0; axis < 3; axis++ )
+		{
+			centroids[ triangle * 3 + axis ] = ( min[ axis ] + max[ axis ] ) * 0.5f;
+		}
+		m_triangles[ triangle ] = (uint32_t)triangle;
+	}
+
+	// A binary tree with at least one triangle per leaf never has more nodes than this, so references stay valid.
+	m_nodes.reserve( triangleCount * 2 - 1 );
+	m_nodes.push_back( Node{} );
+	BuildNode( 0, 0, triangleCount, bounds, centroids );
+
+	// Store triangles in leaf order, ready for intersection, so leaves read memory front to back.
+	m_triangleData.resize( triangleCount * 9 );
+	for ( size_t i = 0; i < triangleCount; i++ )
+	{
+		const uint32_t * corners = &m_indices[ m_triangles[ i ] * 3 ];
+		float * data = &m_triangleData[ i * 9 ];
+		data[ 0 ] = m_x[ corners[ 0 ] ];
+		data[ 1 ] = m_y[ corners[ 0 ] ];
+		data[ 2 ] = m_z[ corners[ 0 ] ];
+		data[ 3 ] = m_x[ corners[ 1 ] ] - data[ 0 ];
+		data[ 4 ] = m_y[ corners[ 1 ] ] - data[ 1 ];
+		data[ 5 ] = m_z[ corners[ 1 ] ] - data[ 2 ];
+		data[ 6 ] = m_x[ corners[ 2 ] ] - data[ 0 ];
+		data[ 7 ] = m_y[ corners[ 2 ] ] - data[ 1 ];
+		data[ 8 ] = m_z[ corners[ 2 ] ] - data[ 2 ];
+	}
+}
+
+void MeshBVH::BuildNode( size_t nodeIndex, size_t start, size_t end, std::vector< float > & bounds, std::vector< float > & centroids )
+{
+	Node node{};
+	float centroidMin[ 3 ];
+	float centroidMax[ 3 ];
+	Empty( node.min, node.max );
+	Empty( centroidMin, centroidMax );
+	for ( size_t i = start; i < end; i++ )
+	{
+		uint32_t triangle = m_triangles[ i ];
+		Grow( node.min, node.max, &bounds[ triangle * 6 ], &bounds[ triangle * 6 + 3 ] );
+		Grow( centroidMin, centroidMax, &centroids[ triangle * 3 ], &centroids[ triangle * 3 ] );
+	}
+
+	size_t count = end - start;
+
+	// Binned surface area heuristic: bin centroids along each axis, and take the cheapest split between bins.
+	float bestCost = (std::numeric_limits< float >::max)();
+	int bestAxis = -1;
+	size_t bestSplit = 0;
+	for ( size_t axis = 0; count > MaxLeafSize && axis < 3; axis++ )
+	{
+		float extent = centroidMax[ axis ] - centroidMin[ axis ];
+		if ( extent <= 0.0f ) continue;
+
+		float scale = Bins / extent;
+		size_t binCount[ Bins ] = {};
+		float binMin[ Bins ][ 3 ];
+		float binMax[ Bins ][ 3 ];
+		for ( size_t bin = 0; bin < Bins; bin++ )
+		{
+			Empty( binMin[ bin ], binMax[ bin ] );
+		}
+
+		for ( size_t i = start; i < end; i++ )
+		{
+			uint32_t triangle = m_triangles[ i ];
+			size_t bin = (std::min)( Bins - 1, (size_t)( ( centroids[ triangle * 3 + axis ] - centroidMin[ axis ] ) * scale ) );
+			binCount[ bin ]++;
+			Grow( binMin[ bin ], binMax[ bin ], &bounds[ triangle * 6 ], &bounds[ triangle * 6 + 3 ] );
+		}
+
+		float rightArea[ Bins ];
+		size_t rightCount[ Bins ];
+		float min[ 3 ];
+		float max[ 3 ];
+		Empty( min, max );
+		size_t total = 0;
+		for ( size_t bin = Bins - 1; bin > 0; bin-- )
+		{
+			Grow( min, max, binMin[ bin ], binMax[ bin ] );
+			total += binCount[ bin ];
+			rightArea[ bin ] = total ? HalfArea( min, max ) : 0.0f;
+			rightCount[ bin ] = total;
+		}
+
+		Empty( min, max );
+		total = 0;
+		for ( size_t split = 1; split < Bins; split++ )
+		{
+			Grow( min, max, binMin[ split - 1 ], binMax[ split - 1 ] );
+			total += binCount[ split - 1 ];
+			if ( total == 0 || rightCount[ split ] == 0 ) continue;
+
+			float cost = HalfArea( min, max ) * total + rightArea[ split ] * rightCount[ split ];
+			if ( cost < bestCost )
+			{
+				bestCost = cost;
+				bestAxis = (int)axis;
+				bestSplit = split;
+			}
+		}
+	}
+
+	// Splitting must pay for the extra traversal step, and leaves must fit their counter.
+	float leafCost = HalfArea( node.min, node.max ) * count;
+	bool leaf = count <= MaxLeafSize || ( bestAxis < 0 && count <= 0xFFFF ) || ( bestCost >= leafCost && count <= MaxLeafSize * 4 );
+	if ( leaf )
+	{
+		node.start = (uint32_t)start;
+		node.count = (uint16_t)count;
+		m_nodes[ nodeIndex ] = node;
+		return;
+	}
+
+	size_t middle = ( start + end ) / 2;
+	if ( bestAxis >= 0 )
+	{
+		float scale = Bins / ( centroidMax[ bestAxis ] - centroidMin[ bestAxis ] );
+		auto itr = std::partition( m_triangles.begin() + start, m_triangles.begin() + end, [&]( uint32_t triangle )
+		{
+			return (std::min)( Bins - 1, (size_t)( ( centroids[ triangle * 3 + bestAxis ] - centroidMin[ bestAxis ] ) * scale ) ) < bestSplit;
+		} );
+		middle = itr - m_triangles.begin();
+		if ( middle == start || middle == end )
+		{
+			middle = ( start + end ) / 2;
+		}
+	}
+
+	node.axis = (uint16_t)( bestAxis < 0 ? 0 : bestAxis );
+	node.count = 0;
+	m_nodes[ nodeIndex ] = node;
+
+	size_t first = m_nodes.size();
+	m_nodes.push_back( Node{} );
+	BuildNode( first, start, middle, bounds, centroids );
+
+	size_t second = m_nodes.size();
+	m_nodes.push_back( Node{} );
+	m_nodes[ nodeIndex ].start = (uint32_t)second;
+	BuildNode( second, middle, end, bounds, centroids );
+}
+
+void MeshBVH::Intersect( const Ray * rays, Hit * hits, size_t count ) const
+{
+	Wait();
+	for ( size_t i = 0; i < count; i += 4 )
+	{
+		IntersectPacket( rays + i, hits + i, (std::min)( (size_t)4, count - i ) );
+	}
+}
+
+MeshBVH::Hit MeshBVH::Intersect( const Ray & ray ) const
+{
+	Hit hit{};
+	Intersect( &ray, &hit, 1 );
+	return hit;
+}
+
+size_t MeshBVH::GetTriangleCount() const
+{
+	Wait();
+	return m_triangles.size();
+}
+
+size_t MeshBVH::GetNodeCount() const
+{
+	Wait();
+	return m_nodes.size();
+}
+
+void MeshBVH::IntersectPacket( const Ray * rays, Hit * hits, size_t count ) const
+{
+	alignas( 16 ) float origin[ 3 ][ 4 ] = {};
+	alignas( 16 ) float direction[ 3 ][ 4 ] = {};
+	alignas( 16 ) float inverse[ 3 ][ 4 ] = {};
+	alignas( 16 ) float closest[ 4 ] = { -1.0f, -1.0f, -1.0f, -1.0f }; // Unused lanes can never hit.
+	for ( size_t lane = 0; lane < count; lane++ )
+	{
+		for ( size_t axis = 0; axis < 3; axis++ )
+		{
+			origin[ axis ][ lane ] = rays[ lane ].origin[ axis ];
+			direction[ axis ][ lane ] = rays[ lane ].direction[ axis ];
+			inverse[ axis ][ lane ] = 1.0f / rays[ lane ].direction[ axis ];
+		}
+		closest[ lane ] = rays[ lane ].maxDistance;
+		hits[ lane ] = Hit{ false, rays[ lane ].maxDistance, 0, 0.0f, 0.0f };
+	}
+
+	if ( m_nodes.empty() )
+	{
+		return;
+	}
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps( 1.0f );
+	const __m128 epsilon = _mm_set1_ps( 1e-12f );
+	const __m128 signBit = _mm_set1_ps( -0.0f );
+
+	const __m128 ox = _mm_load_ps( origin[ 0 ] );
+	const __m128 oy = _mm_load_ps( origin[ 1 ] );
+	const __m128 oz = _mm_load_ps( origin[ 2 ] );
+	const __m128 dx = _mm_load_ps( direction[ 0 ] );
+	const __m128 dy = _mm_load_ps( direction[ 1 ] );
+	const __m128 dz = _mm_load_ps( direction[ 2 ] );
+	const __m128 ix = _mm_load_ps( inverse[ 0 ] );
+	const __m128 iy = _mm_load_ps( inverse[ 1 ] );
+	const __m128 iz = _mm_load_ps( inverse[ 2 ] );
+	const __m128 active = _mm_cmpge_ps( _mm_load_ps( closest ), zero );
+
+	__m128 bestT = _mm_load_ps( closest );
+	__m128 bestU = zero;
+	__m128 bestV = zero;
+	__m128 bestTriangle = zero; // Triangle numbers, kept as bits.
+	__m128 hitMask = zero;
+
+	std::vector< uint32_t > stack;
+	stack.reserve( 64 );
+	stack.push_back( 0 );
+	while ( ! stack.empty() )
+	{
+		uint32_t nodeIndex = stack.back();
+		stack.pop_back();
+		const Node & node = m_nodes[ nodeIndex ];
+
+		// Slab test of all four rays against the node's box.
+		__m128 t0 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.min[ 0 ] ), ox ), ix );
+		__m128 t1 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.max[ 0 ] ), ox ), ix );
+		__m128 tMin = _mm_min_ps( t0, t1 );
+		__m128 tMax = _mm_max_ps( t0, t1 );
+		t0 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.min[ 1 ] ), oy ), iy );
+		t1 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.max[ 1 ] ), oy ), iy );
+		tMin = _mm_max_ps( tMin, _mm_min_ps( t0, t1 ) );
+		tMax = _mm_min_ps( tMax, _mm_max_ps( t0, t1 ) );
+		t0 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.min[ 2 ] ), oz ), iz );
+		t1 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.max[ 2 ] ), oz ), iz );
+		tMin = _mm_max_ps( _mm_max_ps( tMin, _mm_min_ps( t0, t1 ) ), zero );
+		tMax = _mm_min_ps( _mm_min_ps( tMax, _mm_max_ps( t0, t1 ) ), bestT );
+		if ( _mm_movemask_ps( _mm_and_ps( _mm_cmple_ps( tMin, tMax ), active ) ) == 0 )
+		{
+			continue;
+		}
+
+		if ( node.count == 0 )
+		{
+			// Visit the nearer child first, by the first ray's direction, so the closest hit shrinks the rest.
+			uint32_t first = nodeIndex + 1;
+			uint32_t second = node.start;
+			if ( direction[ node.axis ][ 0 ] < 0.0f )
+			{
+				std::swap( first, second );
+			}
+			stack.push_back( second );
+			stack.push_back( first );
+			continue;
+		}
+
+		// Moller-Trumbore, one triangle against all four rays.
+		for ( uint32_t i = node.start; i < node.start + node.count; i++ )
+		{
+			const float * data = &m_triangleData[ i * 9 ];
+			__m128 e1x = _mm_set1_ps( data[ 3 ] );
+			__m128 e1y = _mm_set1_ps( data[ 4 ] );
+			__m128 e1z = _mm_set1_ps( data[ 5 ] );
+			__m128 e2x = _mm_set1_ps( data[ 6 ] );
+			__m128 e2y = _mm_set1_ps( data[ 7 ] );
+			__m128 e2z = _mm_set1_ps( data[ 8 ] );
+
+			__m128 px = _mm_sub_ps( _mm_mul_ps( dy, e2z ), _mm_mul_ps( dz, e2y ) );
+			__m128 py = _mm_sub_ps( _mm_mul_ps( dz, e2x ), _mm_mul_ps( dx, e2z ) );
+			__m128 pz = _mm_sub_ps( _mm_mul_ps( dx, e2y ), _mm_mul_ps( dy, e2x ) );
+			__m128 det = _mm_add_ps( _mm_add_ps( _mm_mul_ps( e1x, px ), _mm_mul_ps( e1y, py ) ), _mm_mul_ps( e1z, pz ) );
+			__m128 invDet = _mm_div_ps( one, det );
+
+			__m128 tx = _mm_sub_ps( ox, _mm_set1_ps( data[ 0 ] ) );
+			__m128 ty = _mm_sub_ps( oy, _mm_set1_ps( data[ 1 ] ) );
+			__m128 tz = _mm_sub_ps( oz, _mm_set1_ps( data[ 2 ] ) );
+			__m128 u = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( tx, px ), _mm_mul_ps( ty, py ) ), _mm_mul_ps( tz, pz ) ), invDet );
+
+			__m128 qx = _mm_sub_ps( _mm_mul_ps( ty, e1z ), _mm_mul_ps( tz, e1y ) );
+			__m128 qy = _mm_sub_ps( _mm_mul_ps( tz, e1x ), _mm_mul_ps( tx, e1z ) );
+			__m128 qz = _mm_sub_ps( _mm_mul_ps( tx, e1y ), _mm_mul_ps( ty, e1x ) );
+			__m128 v = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, qx ), _mm_mul_ps( dy, qy ) ), _mm_mul_ps( dz, qz ) ), invDet );
+			__m128 t = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( e2x, qx ), _mm_mul_ps( e2y, qy ) ), _mm_mul_ps( e2z, qz ) ), invDet );
+
+			__m128 mask = _mm_cmpgt_ps( _mm_andnot_ps( signBit, det ), epsilon );
+			mask = _mm_and_ps( mask, _mm_cmpge_ps( u, zero ) );
+			mask = _mm_and_ps( mask, _mm_cmpge_ps( v, zero ) );
+			mask = _mm_and_ps( mask, _mm_cmple_ps( _mm_add_ps( u, v ), one ) );
+			mask = _mm_and_ps( mask, _mm_cmpgt_ps( t, zero ) );
+			mask = _mm_and_ps( mask, _mm_cmplt_ps( t, bestT ) );
+			mask = _mm_and_ps( mask, active );
+			if ( _mm_movemask_ps( mask ) == 0 ) continue;
+
+			bestT = Select( mask, t, bestT );
+			bestU = Select( mask, u, bestU );
+			bestV = Select( mask, v, bestV );
+			bestTriangle = Select( mask, _mm_castsi128_ps( _mm_set1_epi32( (int)m_triangles[ i ] ) ), bestTriangle );
+			hitMask = _mm_or_ps( hitMask, mask );
+		}
+	}
+
+	alignas( 16 ) float t[ 4 ];
+	alignas( 16 ) float u[ 4 ];
+	alignas( 16 ) float v[ 4 ];
+	alignas( 16 ) uint32_t triangle[ 4 ];
+	_mm_store_ps( t, bestT );
+	_mm_store_ps( u, bestU );
+	_mm_store_ps( v, bestV );
+	_mm_store_si128( (__m128i *)triangle, _mm_castps_si128( bestTriangle ) );
+	int mask = _mm_movemask_ps( hitMask );
+	for ( size_t lane = 0; lane < count; lane++ )
+	{
+		if ( ( mask & ( 1 << lane ) ) == 0 ) continue;
+		hits[ lane ] = Hit{ true, t[ lane ], triangle[ lane ], u[ lane ], v[ lane ] };
+	}
+}
@@ -0,0 +1,90 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#pragma once
+
+#include <vector>
+#include <future>
+#include <cstdint>
+#include <cstddef>
+
+namespace medx11
+{
+	class VertexBuffer;
+	class IndexBuffer;
+
+	/// <summary>
+	/// A bounding volume hierarchy over the triangles of a mesh, built with the surface area heuristic, for picking and
+	/// raycasts without touching the GPU. Built on a worker thread as soon as it is constructed; queries wait for the
+	/// build to finish. Rays are traced four at a time with SSE, in mesh space.
+	/// </summary>
+	class MeshBVH
+	{
+	public:
+		struct Ray
+		{
+			float origin[ 3 ];
+			float direction[ 3 ];
+			float maxDistance;
+		};
+
+		struct Hit
+		{
+			bool hit;
+			float distance; // Along the ray, in multiples of its direction.
+			uint32_t triangle; // Index of the triangle in the mesh's triangle list.
+			float u;
+			float v; // Barycentrics of the hit, relative to the triangle's second and third vertex.
+		};
+
+		/// <summary>
+		/// Positions as separate x, y and z arrays, and a triangle list of indices into them. Without indices every three
+		/// positions are a triangle.
+		/// </summary>
+		MeshBVH( std::vector< float > x, std::vector< float > y, std::vector< float > z, std::vector< uint32_t > indices );
+
+		/// <summary>
+		/// Build from the CPU shadows of a vertex buffer and (optionally) an index buffer, see Renderer::SetRetainShadows.
+		/// </summary>
+		MeshBVH( const VertexBuffer & vertices, const IndexBuffer * indices );
+
+		~MeshBVH();
+
+		bool Ready() const;
+		void Wait() const;
+
+		/// <summary>
+		/// Find the closest hit, if any, of each ray.
+		/// </summary>
+		void Intersect( const Ray * rays, Hit * hits, size_t count ) const;
+		Hit Intersect( const Ray & ray ) const;
+
+		size_t GetTriangleCount() const;
+		size_t GetNodeCount() const;
+
+	private:
+		struct Node
+		{
+			float min[ 3 ];
+			uint32_t start; // First triangle of a leaf, or the second child of an interior node (the first follows it).
+			float max[ 3 ];
+			uint16_t count; // Triangles in a leaf, 0 for interior nodes.
+			uint16_t axis; // Split axis of an interior node, to visit the nearer child first.
+		};
+
+		void Build();
+		void BuildNode( size_t nodeIndex, size_t start, size_t end, std::vector< float > & bounds, std::vector< float > & centroids );
+		void IntersectPacket( const Ray * rays, Hit * hits, size_t count ) const;
+
+		std::vector< float > m_x;
+		std::vector< float > m_y;
+		std::vector< float > m_z;
+		std::vector< uint32_t > m_indices;
+
+		std::vector< Node > m_nodes;
+		std::vector< uint32_t > m_triangles; // Triangle numbers in leaf order.
+		std::vector< float > m_triangleData; // Per triangle in leaf order: first vertex, then both edges from it.
+
+		std::shared_future< void > m_build;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,478 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#include <medx11/MeshFile.h>
+#include <medx11/IndexBuffer.h>
+#include <medx11/MeshOptimizer.h>
+#include <medx11/VertexQuantizer.h>
+#include <me/exception/FailedToCreate.h>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+using namespace medx11;
+using namespace me;
+using namespace render;
+
+namespace
+{
+	uint64_t Align( uint64_t offset )
+	{
+		return ( offset + MeshFile::Alignment - 1 ) & ~(uint64_t)( MeshFile::Alignment - 1 );
+	}
+
+	void Pad( std::ofstream & stream, uint64_t & offset )
+	{
+		static const char zeros[ MeshFile::Alignment ] = {};
+		uint64_t aligned = Align( offset );
+		stream.write( zeros, (std::streamsize)( aligned - offset ) );
+		offset = aligned;
+	}
+}
+
+MeshFile::MeshFile( unify::Path path )
+	: m_path{ path }
+	, m_file{ INVALID_HANDLE_VALUE }
+	, m_mapping{ nullptr }
+	, m_data{ nullptr }
+	, m_size{ 0 }
+{
+	m_file = CreateFileW( unify::Cast< std::wstring >( path.ToString() ).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr );
+	if ( m_file == INVALID_HANDLE_VALUE )
+	{
+		throw unify::Exception( "Failed to open mesh file! (" + path.ToString() + ")" );
+	}
+
+	LARGE_INTEGER size{};
+	if ( ! GetFileSizeEx( m_file, &size ) || size.QuadPart < (LONGLONG)sizeof( Header ) )
+	{
+		Close();
+		throw unify::Exception( "Failed to load mesh file, too small for a header! (" + path.ToString() + ")" );
+	}
+	m_size = (uint64_t)size.QuadPart;
+
+	m_mapping = CreateFileMappingW( m_file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+	if ( m_mapping )
+	{
+		m_data = (const unsigned char *)MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0 );
+	}
+
+	if ( ! m_data )
+	{
+		Close();
+		throw unify::Exception( "Failed to map mesh file! (" + path.ToString() + ")" );
+	}
+
+	try
+	{
+		Validate();
+	}
+	catch ( ... )
+	{
+		Close();
+		throw;
+	}
+}
+
+MeshFile::MeshFile( MeshFile && other )
+	: m_path{ other.m_path }
+	, m_file{ other.m_file }
+	, m_mapping{ other.m_mapping }
+	, m_data{ other.m_data }
+	, m_size{ other.m_size }
+{
+	other.m_file = INVALID_HANDLE_VALUE;
+	other.m_mapping = nullptr;
+	other.m_data = nullptr;
+	other.m_size = 0;
+}
+
+MeshFile & MeshFile::operator=( MeshFile && other )
+{
+	if ( this != &other )
+	{
+		Close();
+		m_path = other.m_path;
+		m_file = other.m_file;
+		m_mapping = other.m_mapping;
+		m_data = other.m_data;
+		m_size = other.m_size;
+		other.m_file = INVALID_HANDLE_VALUE;
+		other.m_mapping = nullptr;
+		other.m_data = nullptr;
+		other.m_size = 0;
+	}
+	return *this;
+}
+
+MeshFile::~MeshFile()
+{
+	Close();
+}
+
+void MeshFile::Close()
+{
+	if ( m_data )
+	{
+		UnmapViewOfFile( m_data );
+		m_data = nullptr;
+	}
+
+	if ( m_mapping )
+	{
+		CloseHandle( m_mapping );
+		m_mapping = nullptr;
+	}
+
+	if ( m_file != INVALID_HANDLE_VALUE )
+	{
+		CloseHandle( m_file );
+		m_file = INVALID_HANDLE_VALUE;
+	}
+}
+
+void MeshFile::Validate() const
+{
+	const Header & header = GetHeader();
+	if ( header.magic != Magic )
+	{
+		throw unify::Exception( "Failed to load mesh file, not a mesh file! (" + m_path.ToString() + ")" );
+	}
+
+	if ( header.version != Version || header.headerSize < sizeof( Header ) )
+	{
+		throw unify::Exception( "Failed to load mesh file, unsupported version " + unify::Cast< std::string >( header.version ) + "! (" + m_path.ToString() + ")" );
+	}
+
+	if ( header.indexStride != 0 && header.indexStride != 2 && header.indexStride != 4 )
+	{
+		throw unify::Exception( "Failed to load mesh file, bad index size! (" + m_path.ToString() + ")" );
+	}
+
+	// Every section must be aligned and lie within the file.
+	auto check = [&]( uint64_t offset, uint64_t count, uint64_t size )
+	{
+		if ( offset % Alignment != 0 || offset > m_size || ( size && count > ( m_size - offset ) / size ) )
+		{
+			throw unify::Exception( "Failed to load mesh file, section out of bounds! (" + m_path.ToString() + ")" );
+		}
+	};
+
+	check( header.elementsOffset, header.elementCount, sizeof( Element ) );
+	check( header.slotsOffset, header.slotCount, sizeof( Slot ) );
+	check( header.submeshesOffset, header.submeshCount, sizeof( Submesh ) );
+	check( header.indicesOffset, header.indexCount, header.indexStride );
+
+	for ( size_t slot = 0; slot < header.slotCount; slot++ )
+	{
+		check( GetSlot( slot ).offset, GetSlot( slot ).vertexCount, GetSlot( slot ).stride );
+	}
+
+	for ( size_t element = 0; element < header.elementCount; element++ )
+	{
+		if ( memchr( GetElement( element ).semanticName, 0, sizeof( Element::semanticName ) ) == nullptr )
+		{
+			throw unify::Exception( "Failed to load mesh file, bad semantic name! (" + m_path.ToString() + ")" );
+		}
+	}
+
+	for ( size_t submesh = 0; submesh < header.submeshCount; submesh++ )
+	{
+		if ( (uint64_t)GetSubmesh( submesh ).startIndex + GetSubmesh( submesh ).indexCount > header.indexCount )
+		{
+			throw unify::Exception( "Failed to load mesh file, submesh out of range of indices! (" + m_path.ToString() + ")" );
+		}
+	}
+}
+
+const MeshFile::Header & MeshFile::GetHeader() const
+{
+	return *(const Header *)m_data;
+}
+
+const MeshFile::Element & MeshFile::GetElement( size_t index ) const
+{
+	return ( (const Element *)( m_data + GetHeader().elementsOffset ) )[ index ];
+}
+
+const MeshFile::Slot & MeshFile::GetSlot( size_t index ) const
+{
+	return ( (const Slot *)( m_data + GetHeader().slotsOffset ) )[ index ];
+}
+
+const MeshFile::Submesh & MeshFile::GetSubmesh( size_t index ) const
+{
+	return ( (const Submesh *)( m_data + GetHeader().submeshesOffset ) )[ index ];
+}
+
+bool MeshFile::IsOptimized() const
+{
+	return ( GetHeader().flags & OptimizedFlag ) != 0;
+}
+
+bool MeshFile::Matches( const VertexDeclaration & vd ) const
+{
+	const Header & header = GetHeader();
+	if ( header.elementCount != vd.GetNumberOfElements() || header.slotCount != vd.NumberOfSlots() )
+	{
+		return false;
+	}
+
+	size_t index = 0;
+	for ( auto & e : vd.Elements() )
+	{
+		const Element & element = GetElement( index++ );
+		if ( _stricmp( element.semanticName, e.SemanticName.c_str() ) != 0
+			|| element.semanticIndex != e.SemanticIndex
+			|| element.format != (uint32_t)e.Format
+			|| element.inputSlot != e.InputSlot
+			|| element.slotClass != (uint32_t)e.SlotClass
+			|| element.instanceDataStepRate != e.InstanceDataStepRate )
+		{
+			return false;
+		}
+	}
+
+	for ( size_t slot = 0; slot < header.slotCount; slot++ )
+	{
+		if ( GetSlot( slot ).stride != vd.GetSizeInBytes( slot ) )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+IVertexBuffer::ptr MeshFile::CreateVertexBuffer( Renderer * renderer, VertexDeclaration::ptr vd, BufferUsage::TYPE usage ) const
+{
+	if ( ! Matches( *vd ) )
+	{
+		throw exception::FailedToCreate( "Mesh file vertex elements do not match the vertex declaration! (" + m_path.ToString() + ")" );
+	}
+
+	const Header & header = GetHeader();
+
+	// Sources point into the mapping, the buffers copy straight from it.
+	VertexBufferParameters parameters;
+	parameters.vertexDeclaration = vd;
+	for ( size_t slot = 0; slot < header.slotCount; slot++ )
+	{
+		parameters.countAndSource.push_back( { (size_t)GetSlot( slot ).vertexCount, m_data + GetSlot( slot ).offset } );
+	}
+	parameters.usage = usage;
+	parameters.bbox = unify::BBox< float >( unify::V3< float >( header.bboxMin[ 0 ], header.bboxMin[ 1 ], header.bboxMin[ 2 ] ), unify::V3< float >( header.bboxMax[ 0 ], header.bboxMax[ 1 ], header.bboxMax[ 2 ] ) );
+	return renderer->ProduceVB( parameters );
+}
+
+IIndexBuffer::ptr MeshFile::CreateIndexBuffer( Renderer * renderer ) const
+{
+	const Header & header = GetHeader();
+	if ( header.indexCount == 0 )
+	{
+		throw exception::FailedToCreate( "Mesh file has no indices! (" + m_path.ToString() + ")" );
+	}
+
+	IndexBuffer * indexBuffer = new IndexBuffer( renderer );
+	IIndexBuffer::ptr result( indexBuffer );
+	indexBuffer->Create( m_data + header.indicesOffset, header.indexCount, header.indexStride );
+	return result;
+}
+
+void MeshFile::Bake( unify::Path path, const VertexDeclaration & vd, const std::vector< Stream > & streams, const uint32_t * indices, size_t indexCount, const std::vector< Submesh > & submeshes, const unify::BBox< float > & bbox, bool optimize )
+{
+	if ( streams.size() != vd.NumberOfSlots() )
+	{
+		throw exception::FailedToCreate( "Failed to bake mesh file, expected a stream per vertex slot! (" + path.ToString() + ")" );
+	}
+
+	// Optimize copies of the indices and per-vertex streams, and write those in place of the originals.
+	std::vector< Stream > sources = streams;
+	std::vector< uint32_t > optimizedIndices;
+	std::vector< std::vector< unsigned char > > optimizedStreams( streams.size() );
+	if ( optimize && indexCount )
+	{
+		VertexQuantizer quantizer;
+		MeshOptimizer optimizer;
+		std::vector< MeshOptimizer::Stream > remapped;
+		size_t vertexCount = 0;
+		const float * positions = nullptr;
+		size_t positionStride = 0;
+		for ( size_t slot = 0; slot < streams.size(); slot++ )
+		{
+			if ( vd.GetInstancing( slot ) != Instancing::None ) continue;
+
+			if ( remapped.empty() )
+			{
+				vertexCount = streams[ slot ].vertexCount;
+			}
+			else if ( streams[ slot ].vertexCount != vertexCount )
+			{
+				throw exception::FailedToCreate( "Failed to bake mesh file, per-vertex streams differ in vertex count! (" + path.ToString() + ")" );
+			}
+
+			size_t stride = vd.GetSizeInBytes( slot );
+			const unsigned char * source = (const unsigned char *)streams[ slot ].source;
+			optimizedStreams[ slot ].assign( source, source + vertexCount * stride );
+			sources[ slot ].source = optimizedStreams[ slot ].data();
+			remapped.push_back( MeshOptimizer::Stream{ optimizedStreams[ slot ].data(), stride } );
+
+			// Overdraw ordering needs positions, as laid out before the vertices are reordered.
+			VertexQuantizer::Layout layout = quantizer.GetLayout( vd, slot );
+			size_t element = 0;
+			for ( auto & e : vd.Elements() )
+			{
+				if ( e.InputSlot != slot ) continue;
+
+				const VertexQuantizer::Element & described = layout.elements[ element++ ];
+				if ( ! positions && _stricmp( e.SemanticName.c_str(), "POSITION" ) == 0 && e.SemanticIndex == 0 && described.components >= 3 )
+				{
+					positions = (const float *)( (const unsigned char *)streams[ slot ].source + described.sourceOffset );
+					positionStride = stride;
+				}
+			}
+		}
+
+		optimizedIndices.assign( indices, indices + indexCount );
+		for ( auto index : optimizedIndices )
+		{
+			if ( index >= vertexCount )
+			{
+				throw exception::FailedToCreate( "Failed to bake mesh file, indices out of range of the vertices! (" + path.ToString() + ")" );
+			}
+		}
+
+		// Triangles are only reordered within their submesh, so submesh ranges still hold.
+		std::vector< Submesh > ranges = submeshes;
+		if ( ranges.empty() )
+		{
+			ranges.push_back( Submesh{ 0, (uint32_t)indexCount } );
+		}
+		for ( auto && range : ranges )
+		{
+			if ( (size_t)range.startIndex + range.indexCount > indexCount )
+			{
+				throw exception::FailedToCreate( "Failed to bake mesh file, submesh out of range of the indices! (" + path.ToString() + ")" );
+			}
+
+			uint32_t * rangeIndices = optimizedIndices.data() + range.startIndex;
+			optimizer.OptimizeVertexCache( rangeIndices, range.indexCount, vertexCount );
+			if ( positions )
+			{
+				optimizer.OptimizeOverdraw( rangeIndices, range.indexCount, vertexCount, positions, positionStride );
+			}
+		}
+		optimizer.OptimizeVertexFetch( optimizedIndices.data(), indexCount, vertexCount, remapped );
+
+		indices = optimizedIndices.data();
+	}
+
+	// 0xFFFF is the strip-cut value for 16 bit indices, so only narrow when every index is below it.
+	uint32_t maxIndex = 0;
+	for ( size_t i = 0; i < indexCount; i++ )
+	{
+		maxIndex = (std::max)( maxIndex, indices[ i ] );
+	}
+	bool narrow = maxIndex < 0xFFFF;
+
+	Header header{};
+	header.magic = Magic;
+	header.version = Version;
+	header.headerSize = sizeof( Header );
+	header.elementCount = (uint32_t)vd.GetNumberOfElements();
+	header.slotCount = (uint32_t)vd.NumberOfSlots();
+	header.submeshCount = (uint32_t)submeshes.size();
+	header.indexStride = indexCount == 0 ? 0 : narrow ? 2 : 4;
+	header.indexCount = (uint32_t)indexCount;
+	header.bboxMin[ 0 ] = bbox.inf.x;
+	header.bboxMin[ 1 ] = bbox.inf.y;
+	header.bboxMin[ 2 ] = bbox.inf.z;
+	header.bboxMax[ 0 ] = bbox.sup.x;
+	header.bboxMax[ 1 ] = bbox.sup.y;
+	header.bboxMax[ 2 ] = bbox.sup.z;
+	header.flags = optimizedIndices.empty() ? 0 : OptimizedFlag;
+
+	std::vector< Element > elements;
+	for ( auto & e : vd.Elements() )
+	{
+		Element element{};
+		if ( e.SemanticName.size() >= sizeof( element.semanticName ) )
+		{
+			throw exception::FailedToCreate( "Failed to bake mesh file, semantic name \"" + e.SemanticName + "\" too long! (" + path.ToString() + ")" );
+		}
+		strcpy_s( element.semanticName, e.SemanticName.c_str() );
+		element.semanticIndex = e.SemanticIndex;
+		element.format = (uint32_t)e.Format;
+		element.inputSlot = (uint32_t)e.InputSlot;
+		element.slotClass = (uint32_t)e.SlotClass;
+		element.instanceDataStepRate = e.InstanceDataStepRate;
+		elements.push_back( element );
+	}
+
+	// Lay sections out back to back, each aligned.
+	uint64_t offset = Align( sizeof( Header ) );
+	header.elementsOffset = offset;
+	offset = Align( offset + elements.size() * sizeof( Element ) );
+	header.slotsOffset = offset;
+	offset = Align( offset + streams.size() * sizeof( Slot ) );
+	header.submeshesOffset = offset;
+	offset = Align( offset + submeshes.size() * sizeof( Submesh ) );
+
+	std::vector< Slot > slots;
+	for ( size_t slot = 0; slot < streams.size(); slot++ )
+	{
+		Slot record{};
+		record.offset = offset;
+		record.vertexCount = streams[ slot ].vertexCount;
+		record.stride = (uint32_t)vd.GetSizeInBytes( slot );
+		slots.push_back( record );
+		offset = Align( offset + record.vertexCount * record.stride );
+	}
+	header.indicesOffset = offset;
+
+	std::ofstream stream( path.ToString(), std::ios::binary | std::ios::trunc );
+	if ( ! stream )
+	{
+		throw exception::FailedToCreate( "Failed to bake mesh file, could not open for writing! (" + path.ToString() + ")" );
+	}
+
+	uint64_t written = 0;
+	auto write = [&]( const void * data, size_t size )
+	{
+		stream.write( (const char *)data, (std::streamsize)size );
+		written += size;
+	};
+
+	write( &header, sizeof( header ) );
+	Pad( stream, written );
+	write( elements.data(), elements.size() * sizeof( Element ) );
+	Pad( stream, written );
+	write( slots.data(), slots.size() * sizeof( Slot ) );
+	Pad( stream, written );
+	write( submeshes.data(), submeshes.size() * sizeof( Submesh ) );
+	Pad( stream, written );
+	for ( size_t slot = 0; slot < streams.size(); slot++ )
+	{
+		write( sources[ slot ].source, (size_t)( slots[ slot ].vertexCount * slots[ slot ].stride ) );
+		Pad( stream, written );
+	}
+
+	if ( narrow )
+	{
+		std::vector< uint16_t > narrowed( indexCount );
+		for ( size_t i = 0; i < indexCount; i++ )
+		{
+			narrowed[ i ] = (uint16_t)indices[ i ];
+		}
+		write( narrowed.data(), narrowed.size() * sizeof( uint16_t ) );
+	}
+	else
+	{
+		write( indices, indexCount * sizeof( uint32_t ) );
+	}
+	Pad( stream, written );
+
+	if ( ! stream )
+	{
+		throw exception::FailedToCreate( "Failed to bake mesh file, write failed! (" + path.ToString() + ")" );
+	}
+}
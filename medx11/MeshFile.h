@@ -0,0 +1,141 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#pragma once
+
+#include <medx11/Renderer.h>
+#include <me/render/VertexDeclaration.h>
+#include <me/render/IVertexBuffer.h>
+#include <me/render/IIndexBuffer.h>
+#include <me/render/BufferUsage.h>
+#include <unify/Path.h>
+#include <unify/BBox.h>
+#include <vector>
+#include <cstdint>
+
+namespace medx11
+{
+	/// <summary>
+	/// A binary mesh container, laid out so its data can be handed to the GPU where it lies: the file is memory mapped,
+	/// and vertex and index buffers are created straight from pointers into the mapping. Every section is 16 byte
+	/// aligned, and offsets are from the start of the file.
+	/// Layout: Header, Element table, Slot table, Submesh table, vertex data per slot, indices.
+	/// </summary>
+	class MeshFile
+	{
+	public:
+		static const uint32_t Magic = 0x424D454D; // "MEMB", little endian.
+		static const uint32_t Version = 1;
+		static const size_t Alignment = 16;
+		static const uint32_t OptimizedFlag = 0x1; // Indices and vertices were reordered by MeshOptimizer when baked.
+
+		struct Header
+		{
+			uint32_t magic;
+			uint32_t version;
+			uint32_t headerSize; // Lets newer headers grow without moving the tables.
+			uint32_t elementCount;
+			uint32_t slotCount;
+			uint32_t submeshCount;
+			uint32_t indexStride; // 2 or 4, 0 if there are no indices.
+			uint32_t indexCount;
+			float bboxMin[ 3 ];
+			float bboxMax[ 3 ];
+			uint64_t elementsOffset;
+			uint64_t slotsOffset;
+			uint64_t submeshesOffset;
+			uint64_t indicesOffset;
+			uint32_t flags; // Was reserved, so files baked before it read as no flags.
+			uint32_t reserved[ 1 ];
+		};
+
+		struct Element
+		{
+			char semanticName[ 32 ];
+			uint32_t semanticIndex;
+			uint32_t format; // me::render::ElementFormat::TYPE
+			uint32_t inputSlot;
+			uint32_t slotClass; // me::render::SlotClass::TYPE
+			uint32_t instanceDataStepRate;
+			uint32_t reserved[ 3 ];
+		};
+
+		struct Slot
+		{
+			uint64_t offset;
+			uint64_t vertexCount;
+			uint32_t stride;
+			uint32_t reserved[ 3 ];
+		};
+
+		struct Submesh
+		{
+			uint32_t startIndex;
+			uint32_t indexCount;
+			float bboxMin[ 3 ];
+			float bboxMax[ 3 ];
+		};
+
+		/// <summary>
+		/// Vertex data for a slot, to bake.
+		/// </summary>
+		struct Stream
+		{
+			size_t vertexCount;
+			const void * source;
+		};
+
+		/// <summary>
+		/// Map a mesh file, read only, validating its header and tables.
+		/// </summary>
+		MeshFile( unify::Path path );
+		~MeshFile();
+
+		/// <summary>
+		/// The file, mapping and view are owned, so a mesh file can be moved but not copied.
+		/// </summary>
+		MeshFile( const MeshFile & ) = delete;
+		MeshFile & operator=( const MeshFile & ) = delete;
+		MeshFile( MeshFile && other );
+		MeshFile & operator=( MeshFile && other );
+
+		const Header & GetHeader() const;
+		const Element & GetElement( size_t index ) const;
+		const Slot & GetSlot( size_t index ) const;
+		const Submesh & GetSubmesh( size_t index ) const;
+
+		/// <summary>
+		/// Returns true if the mesh was run through MeshOptimizer as it was baked, so needs no optimizing at load.
+		/// </summary>
+		bool IsOptimized() const;
+
+		/// <summary>
+		/// The engine owns vertex declarations, so rather than building one we check that the stored elements are those
+		/// of the declaration we are given, in order.
+		/// </summary>
+		bool Matches( const me::render::VertexDeclaration & vd ) const;
+
+		/// <summary>
+		/// Create buffers from the mapped data. The mapping only needs to outlive these calls.
+		/// </summary>
+		me::render::IVertexBuffer::ptr CreateVertexBuffer( Renderer * renderer, me::render::VertexDeclaration::ptr vd, me::render::BufferUsage::TYPE usage ) const;
+		me::render::IIndexBuffer::ptr CreateIndexBuffer( Renderer * renderer ) const;
+
+		/// <summary>
+		/// Write a mesh file, from an asset loaded any other way. Indices are stored as 16 bits when they all fit.
+		/// If optimize is set, the triangles of each submesh and the per-vertex streams are first reordered by
+		/// MeshOptimizer, and the file is flagged as optimized, so the cost is paid once here rather than at each load.
+		/// </summary>
+		static void Bake( unify::Path path, const me::render::VertexDeclaration & vd, const std::vector< Stream > & streams, const uint32_t * indices, size_t indexCount, const std::vector< Submesh > & submeshes, const unify::BBox< float > & bbox, bool optimize = false );
+
+	private:
+		void Validate() const;
+		void Close();
+
+		unify::Path m_path;
+		HANDLE m_file;
+		HANDLE m_mapping;
+		const unsigned char * m_data;
+		uint64_t m_size;
+	};
+}
\ No newline at end of file
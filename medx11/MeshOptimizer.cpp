@@ -0,0 +1,408 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#include <medx11/MeshOptimizer.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace medx11;
+
+namespace
+{
+	// Forsyth's scoring works on an LRU cache larger than the hardware's FIFO, as a model of recency.
+	const size_t ScoringCacheSize = 32;
+	const float CacheDecayPower = 1.5f;
+	const float LastTriangleScore = 0.75f;
+	const float ValenceBoostScale = 2.0f;
+	const float ValenceBoostPower = 0.5f;
+
+	float VertexScore( int cachePosition, size_t remainingTriangles )
+	{
+		if ( remainingTriangles == 0 )
+		{
+			return -1.0f;
+		}
+
+		float score = 0.0f;
+		if ( cachePosition >= 0 )
+		{
+			if ( cachePosition < 3 )
+			{
+				// The vertices of the last triangle are penalized a little, they were just used.
+				score = LastTriangleScore;
+			}
+			else
+			{
+				float scale = 1.0f / ( ScoringCacheSize - 3 );
+				score = std::pow( 1.0f - ( cachePosition - 3 ) * scale, CacheDecayPower );
+			}
+		}
+
+		// Favor vertices with few triangles left, so they are finished off rather than left for a cold cache later.
+		score += ValenceBoostScale * std::pow( (float)remainingTriangles, -ValenceBoostPower );
+		return score;
+	}
+
+	struct Vector3
+	{
+		float x, y, z;
+	};
+
+	Vector3 GetPosition( const float * positions, size_t positionStride, uint32_t index )
+	{
+		const float * position = (const float *)( (const unsigned char *)positions + index * positionStride );
+		return Vector3{ position[ 0 ], position[ 1 ], position[ 2 ] };
+	}
+}
+
+MeshOptimizer::MeshOptimizer( size_t cacheSize )
+	: m_cacheSize{ cacheSize }
+{
+}
+
+MeshOptimizer::Report MeshOptimizer::Optimize( uint32_t * indices, size_t indexCount, size_t vertexCount, const float * positions, size_t positionStride, std::vector< Stream > streams ) const
+{
+	Report report{};
+	report.before = Analyze( indices, indexCount, vertexCount );
+
+	OptimizeVertexCache( indices, indexCount, vertexCount );
+	if ( positions )
+	{
+		OptimizeOverdraw( indices, indexCount, vertexCount, positions, positionStride );
+	}
+	OptimizeVertexFetch( indices, indexCount, vertexCount, streams );
+
+	report.after = Analyze( indices, indexCount, vertexCount );
+	return report;
+}
+
+void MeshOptimizer::OptimizeVertexCache( uint32_t * indices, size_t indexCount, size_t vertexCount ) const
+{
+	size_t triangleCount = indexCount / 3;
+	if ( triangleCount == 0 )
+	{
+		return;
+	}
+
+	// Vertex to triangle adjacency, as offsets into a single list.
+	std::vector< size_t > remaining( vertexCount, 0 );
+	for ( size_t i = 0; i < triangleCount * 3; i++ )
+	{
+		remaining[ indices[ i ] ]++;
+	}
+
+	std::vector< size_t > adjacencyOffsets( vertexCount + 1, 0 );
+	for ( size_t vertex = 0; vertex < vertexCount; vertex++ )
+	{
+		adjacencyOffsets[ vertex + 1 ] = adjacencyOffsets[ vertex ] + remaining[ vertex ];
+	}
+
+	std::vector< size_t > adjacency( triangleCount * 3 );
+	{
+		std::vector< size_t > fill( adjacencyOffsets.begin(), adjacencyOffsets.end() - 1 );
+		for ( size_t triangle = 0; triangle < triangleCount; triangle++ )
+		{
+			for ( size_t corner = 0; corner < 3; corner++ )
+			{
+				adjacency[ fill[ indices[ triangle * 3 + corner ] ]++ ] = triangle;
+			}
+		}
+	}
+
+	std::vector< int > cachePosition( vertexCount, -1 );
+	std::vector< float > vertexScore( vertexCount );
+	for ( size_t vertex = 0; vertex < vertexCount; vertex++ )
+	{
+		vertexScore[ vertex ] = VertexScore( -1, remaining[ vertex ] );
+	}
+
+	std::vector< bool > emitted( triangleCount, false );
+	std::vector< float > triangleScore( triangleCount );
+	for ( size_t triangle = 0; triangle < triangleCount; triangle++ )
+	{
+		const uint32_t * corners = &indices[ triangle * 3 ];
+		triangleScore[ triangle ] = vertexScore[ corners[ 0 ] ] + vertexScore[ corners[ 1 ] ] + vertexScore[ corners[ 2 ] ];
+	}
+
+	std::vector< uint32_t > output;
+	output.reserve( triangleCount * 3 );
+
+	std::vector< uint32_t > cache;
+	std::vector< uint32_t > nextCache;
+	size_t cursor = 0; // All triangles before the cursor have been emitted.
+	size_t best = 0;
+	for ( float bestScore = triangleScore[ 0 ]; output.size() < triangleCount * 3; )
+	{
+		// Nothing in the cache leads anywhere, so continue from the highest scoring remaining triangle.
+		if ( bestScore < 0.0f )
+		{
+			while ( emitted[ cursor ] ) cursor++;
+			best = cursor;
+			bestScore = triangleScore[ best ];
+			for ( size_t triangle = cursor; triangle < triangleCount; triangle++ )
+			{
+				if ( ! emitted[ triangle ] && triangleScore[ triangle ] > bestScore )
+				{
+					best = triangle;
+					bestScore = triangleScore[ triangle ];
+				}
+			}
+		}
+
+		emitted[ best ] = true;
+		const uint32_t * corners = &indices[ best * 3 ];
+		output.insert( output.end(), corners, corners + 3 );
+
+		// Move the triangle's vertices to the front of the cache.
+		nextCache.assign( corners, corners + 3 );
+		for ( auto && vertex : cache )
+		{
+			if ( vertex != corners[ 0 ] && vertex != corners[ 1 ] && vertex != corners[ 2 ] )
+			{
+				nextCache.push_back( vertex );
+			}
+		}
+
+		for ( size_t corner = 0; corner < 3; corner++ )
+		{
+			uint32_t vertex = corners[ corner ];
+			remaining[ vertex ]--;
+
+			// Drop the emitted triangle from the vertex's adjacency.
+			size_t begin = adjacencyOffsets[ vertex ];
+			size_t end = begin + remaining[ vertex ] + 1;
+			for ( size_t i = begin; i < end; i++ )
+			{
+				if ( adjacency[ i ] == best )
+				{
+					std::swap( adjacency[ i ], adjacency[ end - 1 ] );
+					break;
+				}
+			}
+		}
+
+		// Vertices pushed out of the cache lose their cache score.
+		for ( size_t i = ScoringCacheSize; i < nextCache.size(); i++ )
+		{
+			cachePosition[ nextCache[ i ] ] = -1;
+			vertexScore[ nextCache[ i ] ] = VertexScore( -1, remaining[ nextCache[ i ] ] );
+		}
+		if ( nextCache.size() > ScoringCacheSize )
+		{
+			nextCache.resize( ScoringCacheSize );
+		}
+		cache.swap( nextCache );
+
+		for ( size_t i = 0; i < cache.size(); i++ )
+		{
+			cachePosition[ cache[ i ] ] = (int)i;
+			vertexScore[ cache[ i ] ] = VertexScore( (int)i, remaining[ cache[ i ] ] );
+		}
+
+		// Rescore triangles touching the cache, and pick the best of them for next.
+		bestScore = -1.0f;
+		for ( auto && vertex : cache )
+		{
+			for ( size_t i = adjacencyOffsets[ vertex ], end = i + remaining[ vertex ]; i < end; i++ )
+			{
+				size_t triangle = adjacency[ i ];
+				const uint32_t * triangleCorners = &indices[ triangle * 3 ];
+				triangleScore[ triangle ] = vertexScore[ triangleCorners[ 0 ] ] + vertexScore[ triangleCorners[ 1 ] ] + vertexScore[ triangleCorners[ 2 ] ];
+				if ( triangleScore[ triangle ] > bestScore )
+				{
+					best = triangle;
+					bestScore = triangleScore[ triangle ];
+				}
+			}
+		}
+	}
+
+	std::copy( output.begin(), output.end(), indices );
+}
+
+void MeshOptimizer::OptimizeOverdraw( uint32_t * indices, size_t indexCount, size_t vertexCount, const float * positions, size_t positionStride ) const
+{
+	size_t triangleCount = indexCount / 3;
+	if ( triangleCount == 0 )
+	{
+		return;
+	}
+
+	// Split into clusters where a triangle misses the cache on every vertex; the cache is effectively cold there, so
+	// reordering clusters costs little in vertex cache efficiency.
+	std::vector< size_t > clusters;
+	{
+		std::vector< size_t > cachedAt( vertexCount, 0 );
+		size_t time = m_cacheSize + 1;
+		for ( size_t triangle = 0; triangle < triangleCount; triangle++ )
+		{
+			size_t misses = 0;
+			for ( size_t corner = 0; corner < 3; corner++ )
+			{
+				uint32_t vertex = indices[ triangle * 3 + corner ];
+				if ( time - cachedAt[ vertex ] > m_cacheSize )
+				{
+					cachedAt[ vertex ] = time++;
+					misses++;
+				}
+			}
+
+			if ( triangle == 0 || misses == 3 )
+			{
+				clusters.push_back( triangle );
+			}
+		}
+	}
+	clusters.push_back( triangleCount );
+
+	Vector3 meshCentroid{ 0, 0, 0 };
+	float meshArea = 0.0f;
+
+	struct Cluster
+	{
+		size_t begin;
+		size_t end;
+		Vector3 centroid;
+		Vector3 normal;
+		float sortKey;
+	};
+	std::vector< Cluster > sorted;
+
+	for ( size_t c = 0; c + 1 < clusters.size(); c++ )
+	{
+		Cluster cluster{ clusters[ c ], clusters[ c + 1 ], { 0, 0, 0 }, { 0, 0, 0 }, 0.0f };
+		float clusterArea = 0.0f;
+		for ( size_t triangle = cluster.begin; triangle < cluster.end; triangle++ )
+		{
+			Vector3 a = GetPosition( positions, positionStride, indices[ triangle * 3 + 0 ] );
+			Vector3 b = GetPosition( positions, positionStride, indices[ triangle * 3 + 1 ] );
+			Vector3 p = GetPosition( positions, positionStride, indices[ triangle * 3 + 2 ] );
+			Vector3 ab{ b.x - a.x, b.y - a.y, b.z - a.z };
+			Vector3 ap{ p.x - a.x, p.y - a.y, p.z - a.z };
+			Vector3 normal{ ab.y * ap.z - ab.z * ap.y, ab.z * ap.x - ab.x * ap.z, ab.x * ap.y - ab.y * ap.x };
+			float area = std::sqrt( normal.x * normal.x + normal.y * normal.y + normal.z * normal.z );
+
+			// The normal's length is twice the area, so summing normals weights them by area.
+			cluster.normal.x += normal.x;
+			cluster.normal.y += normal.y;
+			cluster.normal.z += normal.z;
+			cluster.centroid.x += ( a.x + b.x + p.x ) / 3.0f * area;
+			cluster.centroid.y += ( a.y + b.y + p.y ) / 3.0f * area;
+			cluster.centroid.z += ( a.z + b.z + p.z ) / 3.0f * area;
+			clusterArea += area;
+		}
+
+		meshCentroid.x += cluster.centroid.x;
+		meshCentroid.y += cluster.centroid.y;
+		meshCentroid.z += cluster.centroid.z;
+		meshArea += clusterArea;
+
+		if ( clusterArea > 0.0f )
+		{
+			cluster.centroid.x /= clusterArea;
+			cluster.centroid.y /= clusterArea;
+			cluster.centroid.z /= clusterArea;
+		}
+		sorted.push_back( cluster );
+	}
+
+	if ( meshArea > 0.0f )
+	{
+		meshCentroid.x /= meshArea;
+		meshCentroid.y /= meshArea;
+		meshCentroid.z /= meshArea;
+	}
+
+	// Clusters facing away from the center are on the outside, and drawn first they occlude those further in.
+	for ( auto && cluster : sorted )
+	{
+		Vector3 out{ cluster.centroid.x - meshCentroid.x, cluster.centroid.y - meshCentroid.y, cluster.centroid.z - meshCentroid.z };
+		float length = std::sqrt( cluster.normal.x * cluster.normal.x + cluster.normal.y * cluster.normal.y + cluster.normal.z * cluster.normal.z );
+		if ( length > 0.0f )
+		{
+			cluster.sortKey = ( out.x * cluster.normal.x + out.y * cluster.normal.y + out.z * cluster.normal.z ) / length;
+		}
+	}
+
+	std::stable_sort( sorted.begin(), sorted.end(), []( const Cluster & a, const Cluster & b )
+	{
+		return a.sortKey > b.sortKey;
+	} );
+
+	std::vector< uint32_t > output;
+	output.reserve( triangleCount * 3 );
+	for ( auto && cluster : sorted )
+	{
+		output.insert( output.end(), indices + cluster.begin * 3, indices + cluster.end * 3 );
+	}
+	std::copy( output.begin(), output.end(), indices );
+}
+
+void MeshOptimizer::OptimizeVertexFetch( uint32_t * indices, size_t indexCount, size_t vertexCount, std::vector< Stream > streams ) const
+{
+	const uint32_t unused = (uint32_t)-1;
+	std::vector< uint32_t > remap( vertexCount, unused );
+	uint32_t next = 0;
+	for ( size_t i = 0; i < indexCount; i++ )
+	{
+		if ( remap[ indices[ i ] ] == unused )
+		{
+			remap[ indices[ i ] ] = next++;
+		}
+		indices[ i ] = remap[ indices[ i ] ];
+	}
+
+	for ( auto && vertex : remap )
+	{
+		if ( vertex == unused )
+		{
+			vertex = next++;
+		}
+	}
+
+	std::vector< unsigned char > original;
+	for ( auto && stream : streams )
+	{
+		original.assign( stream.data, stream.data + stream.stride * vertexCount );
+		for ( size_t vertex = 0; vertex < vertexCount; vertex++ )
+		{
+			memcpy( stream.data + remap[ vertex ] * stream.stride, &original[ vertex * stream.stride ], stream.stride );
+		}
+	}
+}
+
+MeshOptimizer::CacheStats MeshOptimizer::Analyze( const uint32_t * indices, size_t indexCount, size_t vertexCount ) const
+{
+	CacheStats stats{};
+	size_t triangleCount = indexCount / 3;
+	if ( triangleCount == 0 )
+	{
+		return stats;
+	}
+
+	std::vector< size_t > cachedAt( vertexCount, 0 );
+	std::vector< bool > referenced( vertexCount, false );
+	size_t time = m_cacheSize + 1;
+	size_t misses = 0;
+	size_t referencedCount = 0;
+	for ( size_t i = 0; i < triangleCount * 3; i++ )
+	{
+		uint32_t vertex = indices[ i ];
+		if ( time - cachedAt[ vertex ] > m_cacheSize )
+		{
+			cachedAt[ vertex ] = time++;
+			misses++;
+		}
+
+		if ( ! referenced[ vertex ] )
+		{
+			referenced[ vertex ] = true;
+			referencedCount++;
+		}
+	}
+
+	stats.acmr = (float)misses / triangleCount;
+	stats.atvr = (float)misses / referencedCount;
+	return stats;
+}
@@ -0,0 +1,76 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace medx11
+{
+	/// <summary>
+	/// Reorders indexed triangle lists, and their vertices, for the GPU: triangles for the post-transform vertex cache
+	/// (Forsyth), then clusters of triangles to reduce overdraw (Sander et al.), and finally vertices in the order they
+	/// are first used, for vertex fetch locality.
+	/// Works purely on source data, before buffers are created, so that results can be baked and the cost paid once.
+	/// </summary>
+	class MeshOptimizer
+	{
+	public:
+		/// <summary>
+		/// A vertex stream to remap alongside the indices, one per vertex buffer slot.
+		/// </summary>
+		struct Stream
+		{
+			unsigned char * data;
+			size_t stride;
+		};
+
+		/// <summary>
+		/// Average cache miss ratio (misses per triangle, 0.5 at best) and average transform to vertex ratio (misses per
+		/// referenced vertex, 1.0 at best), simulated on a FIFO post-transform cache.
+		/// </summary>
+		struct CacheStats
+		{
+			float acmr;
+			float atvr;
+		};
+
+		struct Report
+		{
+			CacheStats before;
+			CacheStats after;
+		};
+
+		MeshOptimizer( size_t cacheSize = 16 );
+
+		/// <summary>
+		/// Run all passes over a triangle list, in place. Positions are three floats, positionStride bytes apart, as
+		/// laid out before optimization.
+		/// </summary>
+		Report Optimize( uint32_t * indices, size_t indexCount, size_t vertexCount, const float * positions, size_t positionStride, std::vector< Stream > streams ) const;
+
+		/// <summary>
+		/// Reorder triangles for the post-transform vertex cache.
+		/// </summary>
+		void OptimizeVertexCache( uint32_t * indices, size_t indexCount, size_t vertexCount ) const;
+
+		/// <summary>
+		/// Reorder clusters of triangles, split where the vertex cache would be cold anyway, so that triangles facing
+		/// outward are drawn first and occlude the rest.
+		/// </summary>
+		void OptimizeOverdraw( uint32_t * indices, size_t indexCount, size_t vertexCount, const float * positions, size_t positionStride ) const;
+
+		/// <summary>
+		/// Renumber vertices in the order the indices first use them, moving each stream's vertices to match.
+		/// Unreferenced vertices are kept, after all referenced ones.
+		/// </summary>
+		void OptimizeVertexFetch( uint32_t * indices, size_t indexCount, size_t vertexCount, std::vector< Stream > streams ) const;
+
+		CacheStats Analyze( const uint32_t * indices, size_t indexCount, size_t vertexCount ) const;
+
+	private:
+		size_t m_cacheSize;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,94 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#include <medx11/MeshPack.h>
+#include <me/exception/FailedToCreate.h>
+#include <algorithm>
+#include <cstring>
+
+using namespace medx11;
+using namespace me;
+
+MeshPack::MeshPack( size_t stride )
+	: m_stride{ stride }
+{
+}
+
+size_t MeshPack::Add( const void * vertices, size_t vertexCount, const uint32_t * indices, size_t indexCount )
+{
+	if ( vertexCount == 0 || indexCount == 0 )
+	{
+		throw exception::FailedToCreate( "Mesh pack meshes need vertices and indices!" );
+	}
+
+	Mesh mesh{ (uint32_t)m_indices.size(), (uint32_t)indexCount, (uint32_t)GetVertexCount(), (uint32_t)vertexCount };
+
+	const unsigned char * bytes = (const unsigned char *)vertices;
+	m_vertices.insert( m_vertices.end(), bytes, bytes + vertexCount * m_stride );
+
+	m_indices.reserve( m_indices.size() + indexCount );
+	for ( size_t i = 0; i < indexCount; i++ )
+	{
+		if ( indices[ i ] >= vertexCount )
+		{
+			throw exception::FailedToCreate( "Mesh pack index out of range!" );
+		}
+		m_indices.push_back( mesh.firstVertex + indices[ i ] );
+	}
+
+	m_meshes.push_back( mesh );
+	return m_meshes.size() - 1;
+}
+
+MeshPack::Batch MeshPack::Build( const Draw * draws, size_t count ) const
+{
+	Batch batch{};
+
+	// Stable, so draws of one mesh keep their order within its group.
+	std::vector< Draw > sorted( draws, draws + count );
+	std::stable_sort( sorted.begin(), sorted.end(), []( const Draw & a, const Draw & b ) { return a.mesh < b.mesh; } );
+
+	batch.entries.reserve( count );
+	for ( auto && draw : sorted )
+	{
+		if ( draw.mesh >= m_meshes.size() )
+		{
+			throw exception::FailedToCreate( "Mesh pack draw of an unknown mesh!" );
+		}
+
+		const Mesh & mesh = m_meshes[ draw.mesh ];
+		if ( batch.args.empty() || batch.entries.back().mesh != draw.mesh )
+		{
+			batch.args.push_back( DrawArgs{ mesh.indexCount, 0, mesh.firstIndex, 0, (uint32_t)batch.entries.size() } );
+		}
+		batch.args.back().instanceCount++;
+		batch.entries.push_back( Entry{ mesh.firstIndex, mesh.indexCount, draw.transform, draw.mesh } );
+		batch.maxIndexCount = (std::max)( batch.maxIndexCount, mesh.indexCount );
+	}
+	return batch;
+}
+
+size_t MeshPack::GetStride() const
+{
+	return m_stride;
+}
+
+size_t MeshPack::GetVertexCount() const
+{
+	return m_stride ? m_vertices.size() / m_stride : 0;
+}
+
+const std::vector< unsigned char > & MeshPack::GetVertices() const
+{
+	return m_vertices;
+}
+
+const std::vector< uint32_t > & MeshPack::GetIndices() const
+{
+	return m_indices;
+}
+
+const std::vector< MeshPack::Mesh > & MeshPack::GetMeshes() const
+{
+	return m_meshes;
+}
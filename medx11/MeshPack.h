@@ -0,0 +1,90 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace medx11
+{
+	/// <summary>
+	/// Packs many meshes of one vertex stride into a single vertex array and a single 32 bit index array, for vertex
+	/// pulling (see VertexPuller), and turns lists of draws into the per-instance indirection table and indirect draw
+	/// arguments that draw them. CPU only, so it can be used and tested without a device.
+	/// </summary>
+	class MeshPack
+	{
+	public:
+		struct Mesh
+		{
+			uint32_t firstIndex;
+			uint32_t indexCount;
+			uint32_t firstVertex;
+			uint32_t vertexCount;
+		};
+
+		/// <summary>
+		/// What a shader reads for each instance, by SV_InstanceID (plus the first entry of the draw).
+		/// </summary>
+		struct Entry
+		{
+			uint32_t firstIndex;
+			uint32_t indexCount;
+			uint32_t transform;
+			uint32_t mesh;
+		};
+
+		/// <summary>
+		/// Laid out as D3D11_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS.
+		/// </summary>
+		struct DrawArgs
+		{
+			uint32_t indexCountPerInstance;
+			uint32_t instanceCount;
+			uint32_t startIndexLocation;
+			int32_t baseVertexLocation;
+			uint32_t startInstanceLocation; // The group's first entry.
+		};
+
+		struct Draw
+		{
+			uint32_t mesh;
+			uint32_t transform;
+		};
+
+		/// <summary>
+		/// Entries grouped by mesh, one set of draw arguments per group, and the most indices of any mesh drawn (the
+		/// vertex count of a single instanced draw covering them all).
+		/// </summary>
+		struct Batch
+		{
+			std::vector< Entry > entries;
+			std::vector< DrawArgs > args;
+			uint32_t maxIndexCount;
+		};
+
+		MeshPack( size_t stride );
+
+		/// <summary>
+		/// Append a mesh, returning its index. Indices are relative to its own vertices, and are stored rebased so every
+		/// index addresses the packed vertices directly.
+		/// </summary>
+		size_t Add( const void * vertices, size_t vertexCount, const uint32_t * indices, size_t indexCount );
+
+		Batch Build( const Draw * draws, size_t count ) const;
+
+		size_t GetStride() const;
+		size_t GetVertexCount() const;
+		const std::vector< unsigned char > & GetVertices() const;
+		const std::vector< uint32_t > & GetIndices() const;
+		const std::vector< Mesh > & GetMeshes() const;
+
+	private:
+		size_t m_stride;
+		std::vector< unsigned char > m_vertices;
+		std::vector< uint32_t > m_indices;
+		std::vector< Mesh > m_meshes;
+	};
+}
\ No newline at end of file
@@ -28,6 +28,7 @@ void PixelShader::Destroy()
 {
 	m_pixelShader = nullptr;
 	m_pixelShaderBuffer = nullptr;
+	m_constantLayout = ConstantLayout();
 }
 
 void PixelShader::Create( PixelShaderParameters parameters )
@@ -82,6 +83,12 @@ void PixelShader::Create( PixelShaderParameters parameters )
 		throw exception::FailedToCreate( "Failed to create shader!" );
 	}
 
+	m_constantLayout = ConstantLayout::Reflect( m_pixelShaderBuffer->GetBufferPointer(), m_pixelShaderBuffer->GetBufferSize() );
+	for ( auto && mismatch : m_constantLayout.Compare( m_parameters.constantTable, Renderer::RendererConstantSlots ) )
+	{
+		OutputDebugStringA( ( "Pixel shader \"" + m_parameters.path.ToString() + "\": " + mismatch + "\n" ).c_str() );
+	}
+
 	using namespace DirectX;
 			  
 	// Create blend state...
@@ -112,7 +119,7 @@ me::render::BlendDesc PixelShader::GetBlendDesc() const
 
 me::render::IConstantBuffer::ptr PixelShader::CreateConstantBuffer( BufferUsage::TYPE usage ) const
 {
-	ConstantBuffer::ptr constantBuffer{ new ConstantBuffer( m_renderer, ConstantBufferParameters{ me::render::ResourceType::PixelShader, usage, m_parameters.constantTable } ) };
+	ConstantBuffer::ptr constantBuffer{ new ConstantBuffer( m_renderer, ConstantBufferParameters{ me::render::ResourceType::PixelShader, usage, m_parameters.constantTable }, m_constantLayout.GetUsedSizes( m_parameters.constantTable ), m_constantLayout.GetBindSizes( m_parameters.constantTable ) ) };
 	return constantBuffer;
 }
 
@@ -128,6 +135,11 @@ const IConstantBuffer * PixelShader::GetConstantBuffer() const
 }
 */
 
+const ConstantLayout & PixelShader::GetConstantLayout() const
+{
+	return m_constantLayout;
+}
+
 const void * PixelShader::GetBytecode() const
 {
 	return m_pixelShaderBuffer->GetBufferPointer();
@@ -5,6 +5,7 @@
 
 #include <medx11/Renderer.h>
 #include <medx11/ConstantBuffer.h>
+#include <medx11/ConstantLayout.h>
 #include <atlbase.h>
 
 namespace medx11
@@ -23,6 +24,11 @@ namespace medx11
 	public: // me::render::IPixelShader
 		me::render::BlendDesc GetBlendDesc() const override;
 
+		/// <summary>
+		/// The constant buffers the compiled shader declares, reflected from its bytecode.
+		/// </summary>
+		const ConstantLayout & GetConstantLayout() const;
+
 	public: // me::render::IShader
 		me::render::IConstantBuffer::ptr CreateConstantBuffer( me::render::BufferUsage::TYPE usage ) const override;
 		const void * GetBytecode() const override;
@@ -39,6 +45,7 @@ namespace medx11
 		me::render::PixelShaderParameters m_parameters;
 		CComPtr< ID3D11PixelShader > m_pixelShader;
 		CComPtr< ID3D10Blob > m_pixelShaderBuffer;
+		ConstantLayout m_constantLayout;
 		CComPtr< ID3D11BlendState > m_blendState;
 		D3D11_BLEND_DESC m_blendDesc;
 	};
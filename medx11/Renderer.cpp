@@ -10,21 +10,65 @@
 #include <medx11/PixelShader.h>
 #include <medx11/VertexConstruct.h>
 #include <medx11/Texture.h>
+#include <medx11/TextureResidency.h>
+#include <medx11/TextureArrayPool.h>
+#include <medx11/GeometryHeap.h>
+#include <medx11/VertexQuantizer.h>
+#include <medx11/ConstantIntern.h>
+#include <medx11/DataBuffer.h>
+#include <medx11/SkinningPalette.h>
 #include <me/render/RenderMethod.h>
 #include <me/render/MatrixFeed.h>
 #include <me/exception/FailedToCreate.h>
+#include <me/exception/FailedToLock.h>
 #include <me/exception/NotImplemented.h>
 #include <cassert>
+#include <algorithm>
+#include <cstring>
 
 using namespace medx11;
 using namespace me;
 using namespace render;
 
+namespace
+{
+	D3D11_PRIMITIVE_TOPOLOGY ToTopology( PrimitiveType::TYPE primitiveType )
+	{
+		switch( primitiveType )
+		{
+		case PrimitiveType::PointList: 
+			return D3D11_PRIMITIVE_TOPOLOGY_POINTLIST; 
+		case PrimitiveType::LineList: 
+			return D3D11_PRIMITIVE_TOPOLOGY_LINELIST; 
+		case PrimitiveType::LineStrip: 
+			return D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP; 
+		case PrimitiveType::TriangleList: 
+			return D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;	
+		case PrimitiveType::TriangleStrip: 
+			return D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP;  
+		}
+		return D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
+	}
+}
+
 Renderer::Renderer( mewos::IWindowsOS * os, Display display, size_t index )
 	: m_display( display )
 	, m_swapChainDesc{}
+	, m_frameStats{}
+	, m_lastFrameStats{}
 	, m_index{ index }
 	, m_totalInstances{ 5000 }
+	, m_textureResidency{ new TextureResidency }
+	, m_textureArrayPool{ new TextureArrayPool( this ) }
+	, m_geometryHeap{ new GeometryHeap( this ) }
+	, m_vertexQuantizer{ new VertexQuantizer }
+	, m_retainShadows{ false }
+	, m_baseVertex{ 0 }
+	, m_frameConstants{}
+	, m_frameConstantsCurrent{ false }
+	, m_instanceConstants{}
+	, m_startTime{ std::chrono::steady_clock::now() }
+	, m_frameTime{ m_startTime }
 {
 	bool debug =
 #if defined( DEBUG ) || defined( _DEBUG )
@@ -58,6 +102,12 @@ Renderer::Renderer( mewos::IWindowsOS * os, Display display, size_t index )
 		throw me::exception::FailedToCreate( "Failed to create Direct-X 11!" );
 	}
 
+	// Optional, for binding constant buffers by offset.
+	m_dxContext->QueryInterface( __uuidof( ID3D11DeviceContext1 ), (void**)&m_dxContext1 );
+	m_constantRing.reset( new ConstantRing( this ) );
+	m_constantIntern.reset( new ConstantIntern( this ) );
+	m_skinningPalette.reset( new SkinningPalette( this ) );
+
 	{
 		// Create the back buffer...
 
@@ -184,12 +234,57 @@ Renderer::Renderer( mewos::IWindowsOS * os, Display display, size_t index )
 		desc.BackFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
 		m_dxDevice->CreateDepthStencilState( &desc, &m_depthStencilState_Trans );
 	}
+
+	if ( ! m_constantRing->Available() )
+	{
+		D3D11_BUFFER_DESC desc{};
+		desc.ByteWidth = 16;
+		desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		desc.Usage = D3D11_USAGE_DYNAMIC;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		HRESULT result = m_dxDevice->CreateBuffer( &desc, nullptr, &m_instanceConstantsBuffer );
+		if ( WIN_FAILED( result ) )
+		{
+			throw exception::FailedToCreate( "Failed to create instance constant buffer!" );
+		}
+	}
+
+	{
+		D3D11_BUFFER_DESC desc{};
+		desc.ByteWidth = sizeof( FrameConstants );
+		desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		desc.Usage = D3D11_USAGE_DYNAMIC;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		HRESULT result = m_dxDevice->CreateBuffer( &desc, nullptr, &m_frameConstantsBuffer );
+		if ( WIN_FAILED( result ) )
+		{
+			throw exception::FailedToCreate( "Failed to create frame constant buffer!" );
+		}
+	}
 }
 
 Renderer::~Renderer()
 {
+	// Textures and constant buffers may be released after us, as engine resource caches often are, so detach them
+	// rather than leave them calling back into us.
+	for ( auto && texture : m_textureResidency->GetTextures() )
+	{
+		texture->Detach();
+	}
+	for ( auto && constantBuffer : m_constantIntern->GetConstantBuffers() )
+	{
+		constantBuffer->Detach();
+	}
+
+	m_textureArrayPool.reset();
+	m_geometryHeap.reset();
+	m_constantRing.reset();
+	m_constantIntern.reset();
+	m_instanceData.clear();
+	m_skinningPalette.reset();
 	m_instanceBufferM[ 0 ] = nullptr;
 	m_instanceBufferM[ 1 ] = nullptr;
+	m_dxContext1 = nullptr;
 	m_dxContext = nullptr;
 	m_dxDevice = nullptr;
 }
@@ -204,6 +299,253 @@ ID3D11DeviceContext * Renderer::GetDxContext() const
 	return m_dxContext;
 }
 
+ID3D11DeviceContext1 * Renderer::GetDxContext1() const
+{
+	return m_dxContext1;
+}
+
+TextureResidency * Renderer::GetTextureResidency() const
+{
+	return m_textureResidency.get();
+}
+
+TextureArrayPool * Renderer::GetTextureArrayPool() const
+{
+	return m_textureArrayPool.get();
+}
+
+ConstantRing * Renderer::GetConstantRing() const
+{
+	return m_constantRing.get();
+}
+
+ConstantIntern * Renderer::GetConstantIntern() const
+{
+	return m_constantIntern.get();
+}
+
+SkinningPalette * Renderer::GetSkinningPalette() const
+{
+	return m_skinningPalette.get();
+}
+
+GeometryHeap * Renderer::GetGeometryHeap() const
+{
+	return m_geometryHeap.get();
+}
+
+VertexQuantizer * Renderer::GetVertexQuantizer() const
+{
+	return m_vertexQuantizer.get();
+}
+
+void Renderer::SetRetainShadows( bool retain )
+{
+	m_retainShadows = retain;
+}
+
+bool Renderer::GetRetainShadows() const
+{
+	return m_retainShadows;
+}
+
+void Renderer::UseVertexBuffers( const std::vector< ID3D11Buffer * > & buffers, const std::vector< UINT > & strides, const std::vector< UINT > & offsets, size_t baseVertex ) const
+{
+	m_baseVertex = baseVertex;
+
+	if ( m_boundVertexBuffers.size() < buffers.size() )
+	{
+		m_boundVertexBuffers.resize( buffers.size(), BoundVertexBuffer{ nullptr, 0, 0 } );
+	}
+
+	// Bind the smallest range of slots covering every change; consecutive draws from one heap page bind nothing.
+	size_t first = buffers.size();
+	size_t last = 0;
+	for ( size_t slot = 0; slot < buffers.size(); slot++ )
+	{
+		const BoundVertexBuffer & bound = m_boundVertexBuffers[ slot ];
+		if ( bound.buffer != buffers[ slot ] || bound.stride != strides[ slot ] || bound.offset != offsets[ slot ] )
+		{
+			first = (std::min)( first, slot );
+			last = slot + 1;
+		}
+	}
+
+	if ( first == buffers.size() )
+	{
+		m_frameStats.vertexBufferBindsSkipped++;
+		return;
+	}
+
+	m_dxContext->IASetVertexBuffers( (UINT)first, (UINT)( last - first ), &buffers[ first ], &strides[ first ], &offsets[ first ] );
+	m_frameStats.vertexBufferBinds++;
+
+	for ( size_t slot = first; slot < last; slot++ )
+	{
+		m_boundVertexBuffers[ slot ] = BoundVertexBuffer{ buffers[ slot ], strides[ slot ], offsets[ slot ] };
+	}
+}
+
+void Renderer::UseConstantBuffers( ResourceType::TYPE type, size_t startSlot, const std::vector< ID3D11Buffer * > & buffers, const std::vector< UINT > & firstConstants, const std::vector< UINT > & numConstants ) const
+{
+	bool offsets = ! firstConstants.empty();
+
+	std::vector< BoundConstantBuffer > & bound = m_boundConstantBuffers[ type ];
+	if ( bound.size() < startSlot + buffers.size() )
+	{
+		bound.resize( startSlot + buffers.size(), BoundConstantBuffer{ nullptr, 0, 0 } );
+	}
+
+	// As with vertex buffers, bind the smallest range of slots covering every change. Shared (interned) buffers and
+	// unchanged ring ranges bind nothing.
+	size_t first = buffers.size();
+	size_t last = 0;
+	for ( size_t index = 0; index < buffers.size(); index++ )
+	{
+		const BoundConstantBuffer & current = bound[ startSlot + index ];
+		BoundConstantBuffer wanted{ buffers[ index ], offsets ? firstConstants[ index ] : 0, offsets ? numConstants[ index ] : 0 };
+		if ( current.buffer != wanted.buffer || current.firstConstant != wanted.firstConstant || current.numConstants != wanted.numConstants )
+		{
+			first = (std::min)( first, index );
+			last = index + 1;
+		}
+	}
+
+	if ( first == buffers.size() )
+	{
+		m_frameStats.constantBufferBindsSkipped++;
+		return;
+	}
+
+	UINT slot = (UINT)( startSlot + first );
+	UINT count = (UINT)( last - first );
+	ID3D11Buffer * const * pBuffers = &buffers[ first ];
+	if ( offsets )
+	{
+		const UINT * pFirst = &firstConstants[ first ];
+		const UINT * pNum = &numConstants[ first ];
+		switch( type )
+		{
+		case ResourceType::PixelShader: m_dxContext1->PSSetConstantBuffers1( slot, count, pBuffers, pFirst, pNum ); break;
+		case ResourceType::VertexShader: m_dxContext1->VSSetConstantBuffers1( slot, count, pBuffers, pFirst, pNum ); break;
+		case ResourceType::ComputeShader: m_dxContext1->CSSetConstantBuffers1( slot, count, pBuffers, pFirst, pNum ); break;
+		case ResourceType::DomainShader: m_dxContext1->DSSetConstantBuffers1( slot, count, pBuffers, pFirst, pNum ); break;
+		case ResourceType::GeometryShader: m_dxContext1->GSSetConstantBuffers1( slot, count, pBuffers, pFirst, pNum ); break;
+		default:
+			throw unify::Exception( "ResourceType::ToString: Not a valid usage type!" );
+		}
+	}
+	else
+	{
+		switch( type )
+		{
+		case ResourceType::PixelShader: m_dxContext->PSSetConstantBuffers( slot, count, pBuffers ); break;
+		case ResourceType::VertexShader: m_dxContext->VSSetConstantBuffers( slot, count, pBuffers ); break;
+		case ResourceType::ComputeShader: m_dxContext->CSSetConstantBuffers( slot, count, pBuffers ); break;
+		case ResourceType::DomainShader: m_dxContext->DSSetConstantBuffers( slot, count, pBuffers ); break;
+		case ResourceType::GeometryShader: m_dxContext->GSSetConstantBuffers( slot, count, pBuffers ); break;
+		default:
+			throw unify::Exception( "ResourceType::ToString: Not a valid usage type!" );
+		}
+	}
+	m_frameStats.constantBufferBinds++;
+
+	for ( size_t index = first; index < last; index++ )
+	{
+		bound[ startSlot + index ] = BoundConstantBuffer{ buffers[ index ], offsets ? firstConstants[ index ] : 0, offsets ? numConstants[ index ] : 0 };
+	}
+}
+
+void Renderer::UseInstanceConstants( size_t first, size_t count )
+{
+	UINT instanceConstants[ 4 ] = { (UINT)first, (UINT)count, 0, 0 };
+	if ( m_constantRing->Available() )
+	{
+		UploadConstants( m_instanceConstants, instanceConstants, sizeof( instanceConstants ), true );
+		UseConstantBuffers( ResourceType::VertexShader, InstanceConstantsSlot, { m_instanceConstants.buffer }, { m_instanceConstants.firstConstant }, { m_instanceConstants.numConstants } );
+	}
+	else
+	{
+		UploadConstants( m_instanceConstantsBuffer, instanceConstants, sizeof( instanceConstants ), true );
+		UseConstantBuffers( ResourceType::VertexShader, InstanceConstantsSlot, { m_instanceConstantsBuffer }, {}, {} );
+	}
+}
+
+void Renderer::UploadConstants( ID3D11Buffer * buffer, const void * data, size_t sizeInBytes, bool changed ) const
+{
+	if ( ! changed )
+	{
+		m_frameStats.constantBufferUploadsSkipped++;
+		return;
+	}
+
+	D3D11_MAPPED_SUBRESOURCE subresource{};
+	HRESULT result = m_dxContext->Map( buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &subresource );
+	if ( WIN_FAILED( result ) )
+	{
+		throw exception::FailedToLock( "Failed to upload constant buffer!" );
+	}
+	memcpy( subresource.pData, data, sizeInBytes );
+	m_dxContext->Unmap( buffer, 0 );
+	m_frameStats.constantBufferUploads++;
+}
+
+void Renderer::UploadConstants( ConstantRing::Allocation & allocation, const void * data, size_t sizeInBytes, bool changed, size_t bindSizeInBytes ) const
+{
+	if ( ! changed && m_constantRing->Current( allocation ) )
+	{
+		m_frameStats.constantBufferUploadsSkipped++;
+		return;
+	}
+
+	allocation = m_constantRing->Write( data, sizeInBytes, bindSizeInBytes );
+	m_frameStats.constantBufferUploads++;
+}
+
+void Renderer::UpdateFrameConstants( const RenderInfo & renderInfo )
+{
+	unify::Matrix view = renderInfo.GetViewMatrix();
+	unify::Matrix projection = renderInfo.GetProjectionMatrix();
+	if ( m_frameConstantsCurrent && memcmp( &view, &m_frameConstants.view, sizeof( unify::Matrix ) ) == 0 && memcmp( &projection, &m_frameConstants.projection, sizeof( unify::Matrix ) ) == 0 )
+	{
+		return;
+	}
+
+	using namespace DirectX;
+	XMMATRIX v = XMLoadFloat4x4( (const XMFLOAT4X4 *)&view );
+	XMMATRIX p = XMLoadFloat4x4( (const XMFLOAT4X4 *)&projection );
+	XMMATRIX vp = XMMatrixMultiply( v, p );
+
+	// Stored as our other constants are, matching what shaders already expect of view and projection.
+	m_frameConstants.view = view;
+	m_frameConstants.projection = projection;
+	XMStoreFloat4x4( (XMFLOAT4X4 *)&m_frameConstants.viewProjection, vp );
+	XMStoreFloat4x4( (XMFLOAT4X4 *)&m_frameConstants.inverseView, XMMatrixInverse( nullptr, v ) );
+	XMStoreFloat4x4( (XMFLOAT4X4 *)&m_frameConstants.inverseProjection, XMMatrixInverse( nullptr, p ) );
+	XMStoreFloat4x4( (XMFLOAT4X4 *)&m_frameConstants.inverseViewProjection, XMMatrixInverse( nullptr, vp ) );
+
+	D3D11_VIEWPORT viewport{};
+	UINT viewportCount = 1;
+	m_dxContext->RSGetViewports( &viewportCount, &viewport );
+	m_frameConstants.viewport[ 0 ] = viewport.TopLeftX;
+	m_frameConstants.viewport[ 1 ] = viewport.TopLeftY;
+	m_frameConstants.viewport[ 2 ] = viewport.Width;
+	m_frameConstants.viewport[ 3 ] = viewport.Height;
+
+	UploadConstants( m_frameConstantsBuffer, &m_frameConstants, sizeof( FrameConstants ), true );
+	m_frameConstantsCurrent = true;
+}
+
+const Renderer::FrameConstants & Renderer::GetFrameConstants() const
+{
+	return m_frameConstants;
+}
+
+const Renderer::FrameStats & Renderer::GetFrameStats() const
+{
+	return m_lastFrameStats;
+}
+
 const Display & Renderer::GetDisplay() const
 {
 	return m_display;
@@ -216,6 +558,31 @@ Viewport Renderer::GetViewport() const
 
 void Renderer::BeforeRender()
 {
+	m_textureResidency->BeginFrame();
+	m_constantRing->BeginFrame();
+	m_skinningPalette->BeginFrame();
+
+	// Anything may have been bound between frames, so forget what we think is bound.
+	m_boundSampler = nullptr;
+	m_boundViews.clear();
+	m_boundVertexBuffers.clear();
+	m_boundConstantBuffers.clear();
+	m_baseVertex = 0;
+
+	auto now = std::chrono::steady_clock::now();
+	m_frameConstants.time = std::chrono::duration< float >( now - m_startTime ).count();
+	m_frameConstants.deltaTime = std::chrono::duration< float >( now - m_frameTime ).count();
+	m_frameTime = now;
+	m_frameConstantsCurrent = false;
+
+	ID3D11Buffer * frameConstants = m_frameConstantsBuffer;
+	m_dxContext->VSSetConstantBuffers( FrameConstantsSlot, 1, &frameConstants );
+	m_dxContext->HSSetConstantBuffers( FrameConstantsSlot, 1, &frameConstants );
+	m_dxContext->DSSetConstantBuffers( FrameConstantsSlot, 1, &frameConstants );
+	m_dxContext->GSSetConstantBuffers( FrameConstantsSlot, 1, &frameConstants );
+	m_dxContext->PSSetConstantBuffers( FrameConstantsSlot, 1, &frameConstants );
+	m_dxContext->CSSetConstantBuffers( FrameConstantsSlot, 1, &frameConstants );
+
 	float clearColor[] = { 0.5f, 0.0f, 0.3f, 1.0f };
 	m_dxContext->ClearRenderTargetView( m_renderTargetView, clearColor );
 	m_dxContext->ClearDepthStencilView( m_depthStencilView, D3D11_CLEAR_DEPTH, 1.0f, 0 );
@@ -234,6 +601,9 @@ void Renderer::BeforeRenderTrans()
 void Renderer::AfterRender()
 {
 	m_swapChain->Present( 0, 0 );
+
+	m_lastFrameStats = m_frameStats;
+	m_frameStats = FrameStats{};
 }
 
 bool Renderer::IsFullscreen() const
@@ -255,26 +625,9 @@ void Renderer::Render( const me::render::RenderInfo & renderInfo, const me::rend
 		instancing = effect->GetVertexShader()->GetVertexDeclaration()->GetInstancing( instancingSlot );
 	}
 
-	D3D11_PRIMITIVE_TOPOLOGY topology{};
-	switch( method.primitiveType )
-	{
-	case PrimitiveType::PointList: 
-		topology = D3D11_PRIMITIVE_TOPOLOGY_POINTLIST; 
-		break;
-	case PrimitiveType::LineList: 
-		topology = D3D11_PRIMITIVE_TOPOLOGY_LINELIST; 
-		break;
-	case PrimitiveType::LineStrip: 
-		topology = D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP; 
-		break;
-	case PrimitiveType::TriangleList: 
-		topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;	
-		break;
-	case PrimitiveType::TriangleStrip: 
-		topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP;  
-		break;
-	}
-	m_dxContext->IASetPrimitiveTopology( topology );
+	m_dxContext->IASetPrimitiveTopology( ToTopology( method.primitiveType ) );
+
+	UpdateFrameConstants( renderInfo );
 
 	auto && vertexShader = effect->GetVertexShader();
 	auto && constantTable = vertexCB->GetTable();
@@ -323,7 +676,6 @@ void Renderer::Render( const me::render::RenderInfo & renderInfo, const me::rend
 					}
 
 					vertexCB->UnlockConstants( bufferIndex, lock );
-					bufferIndex++;
 				}
 				vertexCB->Use( 0, 0 );
 
@@ -352,6 +704,11 @@ void Renderer::Render( const me::render::RenderInfo & renderInfo, const me::rend
 				m_dxContext->Unmap( m_instanceBufferM[0], 0 );
 
 				m_dxContext->IASetVertexBuffers( 1, 1, &m_instanceBufferM[0].p, &bufferStride, &offset );
+				if ( m_boundVertexBuffers.size() < 2 )
+				{
+					m_boundVertexBuffers.resize( 2, BoundVertexBuffer{ nullptr, 0, 0 } );
+				}
+				m_boundVertexBuffers[ 1 ] = BoundVertexBuffer{ m_instanceBufferM[0], bufferStride, offset };
 				vertexCB->Use( 0, 0 );
 			}
 			break;
@@ -362,13 +719,15 @@ void Renderer::Render( const me::render::RenderInfo & renderInfo, const me::rend
 
 		pixelCB->Use( 0, 0 );
 
+		m_constantRing->Flush();
+
 		if( method.useIB == false )
 		{
-			m_dxContext->DrawInstanced( method.vertexCount, (UINT)write, method.startVertex, 0 );
+			m_dxContext->DrawInstanced( method.vertexCount, (UINT)write, (UINT)( method.startVertex + m_baseVertex ), 0 );
 		}
 		else
 		{
-			m_dxContext->DrawIndexedInstanced( method.indexCount, (UINT)write, method.startIndex, method.baseVertexIndex, 0 );
+			m_dxContext->DrawIndexedInstanced( method.indexCount, (UINT)write, method.startIndex, (INT)( method.baseVertexIndex + m_baseVertex ), 0 );
 		}
 		write = 0;
 	}
@@ -379,6 +738,95 @@ void Renderer::Render( const me::render::RenderInfo & renderInfo, const me::rend
 	Render( renderInfo, method, bufferSet->GetEffect(), bufferSet->GetVertexCB(), bufferSet->GetPixelCB(), matrixFeed );
 }
 
+void Renderer::RenderStructured( const me::render::RenderInfo & renderInfo, const me::render::RenderMethod & method, me::render::Effect::ptr effect, me::render::IConstantBuffer * vertexCB, me::render::IConstantBuffer * pixelCB, const void * instances, size_t stride, size_t count )
+{
+	if ( count == 0 )
+	{
+		return;
+	}
+
+	// One streamed buffer per stride, grown to the largest draw seen.
+	auto & instanceData = m_instanceData[ stride ];
+	if ( ! instanceData || instanceData->GetLength( 0 ) < count )
+	{
+		size_t capacity = instanceData ? instanceData->GetLength( 0 ) : 4096;
+		while ( capacity < count )
+		{
+			capacity *= 2;
+		}
+		instanceData.reset( new DataBuffer( this ) );
+		instanceData->Add( stride, capacity, nullptr, BufferUsage::Dynamic );
+	}
+	UINT first = (UINT)instanceData->Append( 0, instances, count );
+
+	m_dxContext->IASetPrimitiveTopology( ToTopology( method.primitiveType ) );
+
+	UpdateFrameConstants( renderInfo );
+
+	effect->Use( this, renderInfo );
+
+	vertexCB->Update( renderInfo, nullptr, 0 );
+	vertexCB->Use( 0, 0 );
+	pixelCB->Use( 0, 0 );
+
+	UseInstanceConstants( first, count );
+
+	instanceData->Use( ResourceType::VertexShader, InstanceDataSlot );
+
+	m_constantRing->Flush();
+
+	if( method.useIB == false )
+	{
+		m_dxContext->DrawInstanced( method.vertexCount, (UINT)count, (UINT)( method.startVertex + m_baseVertex ), 0 );
+	}
+	else
+	{
+		m_dxContext->DrawIndexedInstanced( method.indexCount, (UINT)count, method.startIndex, (INT)( method.baseVertexIndex + m_baseVertex ), 0 );
+	}
+}
+
+
+void Renderer::RenderSkinned( const me::render::RenderInfo & renderInfo, const me::render::RenderMethod & method, me::render::Effect::ptr effect, me::render::IConstantBuffer * vertexCB, me::render::IConstantBuffer * pixelCB, const SkinnedInstance * instances, size_t count )
+{
+	m_skinningPalette->Use();
+	RenderStructured( renderInfo, method, effect, vertexCB, pixelCB, instances, sizeof( SkinnedInstance ), count );
+}
+
+void Renderer::RenderPooled( const me::render::RenderInfo & renderInfo, const me::render::RenderMethod & method, me::render::Effect::ptr effect, me::render::IConstantBuffer * vertexCB, me::render::IConstantBuffer * pixelCB, const unify::Matrix * worlds, const me::render::ITexture::ptr * textures, size_t count )
+{
+	std::vector< PooledInstance > run;
+	ITexture::ptr runArray;
+	const Texture * runTexture = nullptr;
+
+	auto draw = [&]()
+	{
+		if ( run.empty() ) return;
+		m_textureArrayPool->Use( runTexture );
+		RenderStructured( renderInfo, method, effect, vertexCB, pixelCB, &run[0], sizeof( PooledInstance ), run.size() );
+		run.clear();
+	};
+
+	for ( size_t i = 0; i < count; i++ )
+	{
+		auto texture = reinterpret_cast< medx11::Texture * >( textures[i].get() );
+		uint32_t slice = (uint32_t)m_textureArrayPool->Add( texture );
+
+		// Growing an array replaces it, so a run ends whenever the array changes, even for the same size and format.
+		ITexture::ptr array = m_textureArrayPool->GetArray( texture );
+		if ( array != runArray )
+		{
+			draw();
+			runArray = array;
+		}
+		runTexture = texture;
+
+		PooledInstance instance{};
+		instance.world = worlds[i];
+		instance.slice = slice;
+		run.push_back( instance );
+	}
+	draw();
+}
 
 IVertexBuffer::ptr Renderer::ProduceVB( VertexBufferParameters parameters ) 
 {
@@ -421,7 +869,7 @@ void Renderer::UseTextures( std::vector< ITexture::ptr > textures )
 	
 	bool usesTextures = false;
 
-	ID3D11ShaderResourceView** views = new ID3D11ShaderResourceView*[ textures.size() ];
+	std::vector< ID3D11ShaderResourceView * > views( textures.size() );
 
 	for( size_t i = 0; i < textures.size(); i++ )
 	{
@@ -433,6 +881,7 @@ void Renderer::UseTextures( std::vector< ITexture::ptr > textures )
 		{
 			usesTextures = true;
 			auto texture = reinterpret_cast<medx11::Texture*>( textures[i].get() );
+			m_textureResidency->Touch( texture );
 			views[i] = texture->m_colorMap;
 		}
 	}
@@ -440,7 +889,25 @@ void Renderer::UseTextures( std::vector< ITexture::ptr > textures )
 	if( usesTextures )
 	{
 		auto texture = reinterpret_cast<medx11::Texture*>( textures[0].get() );
+
+		// Skip the bind if these exact views are already bound, as happens when consecutive draws share an atlas page.
+		bool bound = m_boundSampler == texture->m_colorMapSampler && m_boundViews.size() == views.size();
+		for( size_t i = 0; bound && i < views.size(); i++ )
+		{
+			bound = m_boundViews[i] == views[i];
+		}
+
+		if( bound )
+		{
+			m_frameStats.textureBindsSkipped++;
+			return;
+		}
+
 		dxContext->PSSetSamplers( 0, 1, &texture->m_colorMapSampler.p );
-		dxContext->PSSetShaderResources( 0, (UINT)textures.size(), views );
+		dxContext->PSSetShaderResources( 0, (UINT)textures.size(), &views[0] );
+		m_frameStats.textureBinds++;
+
+		m_boundSampler = texture->m_colorMapSampler;
+		m_boundViews.assign( views.begin(), views.end() );
 	}
 }
\ No newline at end of file
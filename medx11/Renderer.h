@@ -4,23 +4,173 @@
 #pragma once
 
 #include <medx11/DirectX.h>
+#include <medx11/ConstantRing.h>
 #include <mewos/IWindowsOS.h>
 #include <me/render/IRenderer.h>
 #include <me/render/Display.h>
+#include <me/render/ResourceType.h>
 #include <atlbase.h>
+#include <unify/Matrix.h>
 #include <memory>
+#include <map>
+#include <chrono>
+#include <vector>
 
 namespace medx11
 {
+	class TextureResidency;
+	class TextureArrayPool;
+	class GeometryHeap;
+	class VertexQuantizer;
+	class ConstantIntern;
+	class DataBuffer;
+	class SkinningPalette;
+	struct SkinnedInstance;
+
 	class Renderer : public me::render::IRenderer
 	{
 	public:
+		/// <summary>
+		/// Counters gathered over a frame.
+		/// </summary>
+		struct FrameStats
+		{
+			size_t textureBinds;
+			size_t textureBindsSkipped;
+			size_t vertexBufferBinds;
+			size_t vertexBufferBindsSkipped;
+			size_t constantBufferUploads;
+			size_t constantBufferUploadsSkipped;
+			size_t constantBufferBinds;
+			size_t constantBufferBindsSkipped;
+		};
+
+		/// <summary>
+		/// Constants shared by every draw of a view, kept by the renderer and bound to FrameConstantsSlot of every stage.
+		/// Shaders opt in by declaring a matching cbuffer at that register, in place of their own view and projection.
+		/// </summary>
+		struct FrameConstants
+		{
+			unify::Matrix view;
+			unify::Matrix projection;
+			unify::Matrix viewProjection;
+			unify::Matrix inverseView;
+			unify::Matrix inverseProjection;
+			unify::Matrix inverseViewProjection;
+			float viewport[ 4 ]; // Left, top, width and height, in pixels.
+			float time; // Seconds since the renderer was created.
+			float deltaTime; // Seconds since the previous frame.
+			float padding[ 2 ];
+		};
+
+		static const UINT FrameConstantsSlot = D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT - 1;
+
+		/// <summary>
+		/// Where RenderStructured puts per-instance data, a StructuredBuffer, and the first instance's index into it, the
+		/// first uint of a cbuffer.
+		/// </summary>
+		static const UINT InstanceDataSlot = D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT - 1;
+		static const UINT InstanceConstantsSlot = FrameConstantsSlot - 1;
+
+		/// <summary>
+		/// Mask of the constant buffer slots the renderer binds itself, bit n for slot n.
+		/// </summary>
+		static const UINT RendererConstantSlots = ( 1 << FrameConstantsSlot ) | ( 1 << InstanceConstantsSlot );
+
 		Renderer( mewos::IWindowsOS * os, me::render::Display display, size_t index );
 		virtual ~Renderer();				
 
 		ID3D11Device * GetDxDevice() const;
 		ID3D11DeviceContext * GetDxContext() const;
 
+		/// <summary>
+		/// The 11.1 interface of our context, or null when the runtime predates 11.1.
+		/// </summary>
+		ID3D11DeviceContext1 * GetDxContext1() const;
+
+		/// <summary>
+		/// Manages which textures are resident in video memory, under a configurable budget.
+		/// </summary>
+		TextureResidency * GetTextureResidency() const;
+
+		/// <summary>
+		/// Shares texture arrays between textures of matching size and format, for instanced draws.
+		/// </summary>
+		TextureArrayPool * GetTextureArrayPool() const;
+
+		/// <summary>
+		/// Shared vertex buffers that vertex buffers suballocate from.
+		/// </summary>
+		GeometryHeap * GetGeometryHeap() const;
+
+		/// <summary>
+		/// Packs vertex elements into compact formats as they are uploaded. Disabled by default.
+		/// </summary>
+		VertexQuantizer * GetVertexQuantizer() const;
+
+		/// <summary>
+		/// Per frame suballocator for constant buffers, bound by offset. Unavailable without 11.1.
+		/// </summary>
+		ConstantRing * GetConstantRing() const;
+
+		/// <summary>
+		/// Shares immutable constant buffers with identical contents.
+		/// </summary>
+		ConstantIntern * GetConstantIntern() const;
+
+		/// <summary>
+		/// This frame's bone palettes, for skinned draws.
+		/// </summary>
+		SkinningPalette * GetSkinningPalette() const;
+
+		/// <summary>
+		/// Keep CPU copies of static vertex positions and indices as buffers are created, for picking (see MeshBVH).
+		/// Off by default, as it costs memory.
+		/// </summary>
+		void SetRetainShadows( bool retain );
+		bool GetRetainShadows() const;
+
+		/// <summary>
+		/// Bind vertex buffers from slot 0, skipping slots already bound to the same buffer, stride and offset.
+		/// The base vertex is added to the vertex offsets of subsequent draws.
+		/// </summary>
+		void UseVertexBuffers( const std::vector< ID3D11Buffer * > & buffers, const std::vector< UINT > & strides, const std::vector< UINT > & offsets, size_t baseVertex ) const;
+
+		/// <summary>
+		/// Bind constant buffers to a stage from startSlot, skipping slots already bound to the same buffer and range.
+		/// Without first constants the buffers are bound whole, else by offset, which needs 11.1.
+		/// </summary>
+		void UseConstantBuffers( me::render::ResourceType::TYPE type, size_t startSlot, const std::vector< ID3D11Buffer * > & buffers, const std::vector< UINT > & firstConstants, const std::vector< UINT > & numConstants ) const;
+
+		/// <summary>
+		/// Set the cbuffer at InstanceConstantsSlot of the vertex shader to the first instance (entry) and instance count of
+		/// the next draw.
+		/// </summary>
+		void UseInstanceConstants( size_t first, size_t count );
+
+		/// <summary>
+		/// Upload the contents of a dynamic constant buffer, or count the upload as skipped if they are unchanged.
+		/// </summary>
+		void UploadConstants( ID3D11Buffer * buffer, const void * data, size_t sizeInBytes, bool changed ) const;
+
+		/// <summary>
+		/// Write constants to the constant ring, unless they are unchanged and their allocation is still current. The
+		/// allocation spans at least bindSizeInBytes (see ConstantRing::Write).
+		/// </summary>
+		void UploadConstants( ConstantRing::Allocation & allocation, const void * data, size_t sizeInBytes, bool changed, size_t bindSizeInBytes = 0 ) const;
+
+		/// <summary>
+		/// Fill the frame constants from a view, uploading them only when the view changed since the last upload of
+		/// this frame.
+		/// </summary>
+		void UpdateFrameConstants( const me::render::RenderInfo & renderInfo );
+		const FrameConstants & GetFrameConstants() const;
+
+		/// <summary>
+		/// Counters for the last completed frame.
+		/// </summary>
+		const FrameStats & GetFrameStats() const;
+
 	public: // me::render::IRenderer...
 		//me::game::IGame* GetGame() override;
 
@@ -40,6 +190,26 @@ namespace medx11
 		void Render( const me::render::RenderInfo & renderInfo, const me::render::RenderMethod & method, me::render::Effect::ptr effect, me::render::IConstantBuffer * vertexCB, me::render::IConstantBuffer * pixelCB, me::render::MatrixFeed & matrixFeed ) override;
 		void Render( const me::render::RenderInfo & renderInfo, const me::render::RenderMethod & method, me::render::BufferSet * bufferSet, me::render::MatrixFeed & matrixFeed ) override;
 
+		/// <summary>
+		/// Draw count instances whose data, stride bytes each (transforms, colors, texture slice, ...), the vertex shader
+		/// fetches by SV_InstanceID instead of through an instance vertex stream. Instance i is element first + i of the
+		/// StructuredBuffer at InstanceDataSlot, where first is the first uint of the cbuffer at InstanceConstantsSlot.
+		/// There is no instance limit, nor any instance elements in the input layout.
+		/// </summary>
+		void RenderStructured( const me::render::RenderInfo & renderInfo, const me::render::RenderMethod & method, me::render::Effect::ptr effect, me::render::IConstantBuffer * vertexCB, me::render::IConstantBuffer * pixelCB, const void * instances, size_t stride, size_t count );
+
+		/// <summary>
+		/// Draw skinned instances, sharing a mesh and skeleton, with their palettes bound from the skinning palette.
+		/// </summary>
+		void RenderSkinned( const me::render::RenderInfo & renderInfo, const me::render::RenderMethod & method, me::render::Effect::ptr effect, me::render::IConstantBuffer * vertexCB, me::render::IConstantBuffer * pixelCB, const SkinnedInstance * instances, size_t count );
+
+		/// <summary>
+		/// Draw instances that differ by texture, through the texture array pool. Each texture is pooled if it is not
+		/// already, and its slice is written to its instance's PooledInstance, with the array bound at
+		/// TextureArrayPool::Slot. Instances are drawn in runs sharing an array, so pass them grouped by size and format.
+		/// </summary>
+		void RenderPooled( const me::render::RenderInfo & renderInfo, const me::render::RenderMethod & method, me::render::Effect::ptr effect, me::render::IConstantBuffer * vertexCB, me::render::IConstantBuffer * pixelCB, const unify::Matrix * worlds, const me::render::ITexture::ptr * textures, size_t count );
+
 		me::render::IVertexBuffer::ptr ProduceVB( me::render::VertexBufferParameters parameters ) override;
 		me::render::IIndexBuffer::ptr ProduceIB( me::render::IndexBufferParameters parameters ) override;
 		me::render::IVertexShader::ptr ProduceVS( me::render::VertexShaderParameters parameters ) override;
@@ -55,6 +225,7 @@ namespace medx11
 
 		CComPtr< ID3D11Device > m_dxDevice;
 		CComPtr< ID3D11DeviceContext > m_dxContext;
+		CComPtr< ID3D11DeviceContext1 > m_dxContext1;
 		DXGI_SWAP_CHAIN_DESC m_swapChainDesc;
 		CComPtr< IDXGISwapChain > m_swapChain;
 		CComPtr< ID3D11RenderTargetView > m_renderTargetView;
@@ -67,5 +238,47 @@ namespace medx11
 
 		size_t m_totalInstances;
 		CComPtr< ID3D11Buffer > m_instanceBufferM[ 2 ];
+		std::map< size_t, std::unique_ptr< DataBuffer > > m_instanceData; // By stride.
+		CComPtr< ID3D11Buffer > m_instanceConstantsBuffer; // Without the constant ring.
+		ConstantRing::Allocation m_instanceConstants;
+
+		std::unique_ptr< TextureResidency > m_textureResidency;
+		std::unique_ptr< TextureArrayPool > m_textureArrayPool;
+		std::unique_ptr< GeometryHeap > m_geometryHeap;
+		std::unique_ptr< VertexQuantizer > m_vertexQuantizer;
+		std::unique_ptr< ConstantRing > m_constantRing;
+		std::unique_ptr< ConstantIntern > m_constantIntern;
+		std::unique_ptr< SkinningPalette > m_skinningPalette;
+		bool m_retainShadows;
+
+		CComPtr< ID3D11SamplerState > m_boundSampler;
+		std::vector< CComPtr< ID3D11ShaderResourceView > > m_boundViews;
+
+		// Vertex buffers bind through a const renderer.
+		struct BoundVertexBuffer
+		{
+			ID3D11Buffer * buffer;
+			UINT stride;
+			UINT offset;
+		};
+		mutable std::vector< BoundVertexBuffer > m_boundVertexBuffers;
+		mutable size_t m_baseVertex;
+
+		struct BoundConstantBuffer
+		{
+			ID3D11Buffer * buffer;
+			UINT firstConstant;
+			UINT numConstants;
+		};
+		mutable std::map< me::render::ResourceType::TYPE, std::vector< BoundConstantBuffer > > m_boundConstantBuffers;
+
+		FrameConstants m_frameConstants;
+		CComPtr< ID3D11Buffer > m_frameConstantsBuffer;
+		bool m_frameConstantsCurrent; // Uploaded for this frame, with the view in m_frameConstants.
+		std::chrono::steady_clock::time_point m_startTime;
+		std::chrono::steady_clock::time_point m_frameTime;
+
+		mutable FrameStats m_frameStats;
+		FrameStats m_lastFrameStats;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,164 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#include <medx11/SkinningPalette.h>
+#include <me/exception/FailedToCreate.h>
+#include <xmmintrin.h>
+
+using namespace medx11;
+using namespace me;
+using namespace render;
+
+SkinningPalette::SkinningPalette( Renderer * renderer, Format::TYPE format )
+	: m_renderer{ renderer }
+	, m_format{ format }
+	, m_uploaded{ 0 }
+{
+}
+
+SkinningPalette::~SkinningPalette()
+{
+}
+
+void SkinningPalette::SetFormat( Format::TYPE format )
+{
+	if ( m_format == format )
+	{
+		return;
+	}
+
+	m_format = format;
+	m_packed.clear();
+	m_buffer.reset();
+	m_uploaded = 0;
+}
+
+SkinningPalette::Format::TYPE SkinningPalette::GetFormat() const
+{
+	return m_format;
+}
+
+size_t SkinningPalette::GetStride() const
+{
+	return m_format == Format::Matrix3x4 ? 12 * sizeof( float ) : 8 * sizeof( float );
+}
+
+void SkinningPalette::BeginFrame()
+{
+	m_packed.clear();
+	m_uploaded = 0;
+	if ( m_buffer )
+	{
+		m_buffer->Rewind( 0 );
+	}
+}
+
+uint32_t SkinningPalette::Add( const unify::Matrix * bones, size_t boneCount )
+{
+	size_t floatsPerBone = GetStride() / sizeof( float );
+	size_t first = m_packed.size() / floatsPerBone;
+	m_packed.resize( m_packed.size() + boneCount * floatsPerBone );
+
+	float * out = &m_packed[ first * floatsPerBone ];
+	if ( m_format == Format::Matrix3x4 )
+	{
+		PackMatrix3x4( bones, boneCount, out );
+	}
+	else
+	{
+		PackDualQuaternion( bones, boneCount, out );
+	}
+
+	return (uint32_t)first;
+}
+
+void SkinningPalette::Use()
+{
+	size_t floatsPerBone = GetStride() / sizeof( float );
+	size_t boneCount = m_packed.size() / floatsPerBone;
+	if ( m_uploaded < boneCount )
+	{
+		// One buffer for every palette of the frame, grown to the most bones seen. A new buffer starts empty, so
+		// everything is uploaded again.
+		if ( ! m_buffer || m_buffer->GetLength( 0 ) < boneCount )
+		{
+			size_t capacity = m_buffer ? m_buffer->GetLength( 0 ) : 1024;
+			while ( capacity < boneCount )
+			{
+				capacity *= 2;
+			}
+			m_buffer.reset( new DataBuffer( m_renderer ) );
+			m_buffer->Add( GetStride(), capacity, nullptr, BufferUsage::Dynamic );
+			m_uploaded = 0;
+		}
+
+		// Bone indices from Add are positions in the buffer, so an append that had to discard (every append, without
+		// NO_OVERWRITE on shader resource buffers) uploads the whole frame again from 0.
+		size_t offset = m_buffer->Append( 0, &m_packed[ m_uploaded * floatsPerBone ], boneCount - m_uploaded );
+		if ( offset != m_uploaded )
+		{
+			m_buffer->Append( 0, &m_packed[0], boneCount );
+		}
+		m_uploaded = boneCount;
+	}
+
+	if ( m_buffer )
+	{
+		m_buffer->Use( ResourceType::VertexShader, Slot );
+	}
+}
+
+const std::vector< float > & SkinningPalette::GetPacked() const
+{
+	return m_packed;
+}
+
+void SkinningPalette::PackMatrix3x4( const unify::Matrix * bones, size_t boneCount, float * out )
+{
+	for ( size_t bone = 0; bone < boneCount; bone++ )
+	{
+		// The transposed matrix's last row is (0, 0, 0, 1) for an affine bone, so it is left out.
+		const float * m = (const float *)&bones[ bone ];
+		__m128 row0 = _mm_loadu_ps( m + 0 );
+		__m128 row1 = _mm_loadu_ps( m + 4 );
+		__m128 row2 = _mm_loadu_ps( m + 8 );
+		__m128 row3 = _mm_loadu_ps( m + 12 );
+		_MM_TRANSPOSE4_PS( row0, row1, row2, row3 );
+		_mm_storeu_ps( out + 0, row0 );
+		_mm_storeu_ps( out + 4, row1 );
+		_mm_storeu_ps( out + 8, row2 );
+		out += 12;
+	}
+}
+
+void SkinningPalette::PackDualQuaternion( const unify::Matrix * bones, size_t boneCount, float * out )
+{
+	using namespace DirectX;
+
+	const XMVECTOR half = XMVectorReplicate( 0.5f );
+	XMVECTOR reference = XMQuaternionIdentity();
+	for ( size_t bone = 0; bone < boneCount; bone++ )
+	{
+		XMMATRIX m = XMLoadFloat4x4( (const XMFLOAT4X4 *)&bones[ bone ] );
+		XMVECTOR rotation = XMQuaternionNormalize( XMQuaternionRotationMatrix( m ) );
+
+		// q and -q are the same rotation. Keep every rotation on the side of the first bone's, so that blending bones
+		// doesn't take the long way round.
+		if ( bone == 0 )
+		{
+			reference = rotation;
+		}
+		else if ( XMVectorGetX( XMQuaternionDot( rotation, reference ) ) < 0.0f )
+		{
+			rotation = XMVectorNegate( rotation );
+		}
+
+		// Dual part is half the translation (as a pure quaternion) times the rotation.
+		XMVECTOR translation = XMVectorSelect( g_XMZero, m.r[ 3 ], g_XMSelect1110 );
+		XMVECTOR dual = XMVectorMultiply( XMQuaternionMultiply( rotation, translation ), half );
+
+		XMStoreFloat4( (XMFLOAT4 *)( out + 0 ), rotation );
+		XMStoreFloat4( (XMFLOAT4 *)( out + 4 ), dual );
+		out += 8;
+	}
+}
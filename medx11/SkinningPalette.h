@@ -0,0 +1,99 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#pragma once
+
+#include <medx11/Renderer.h>
+#include <medx11/DataBuffer.h>
+#include <unify/Matrix.h>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+namespace medx11
+{
+	/// <summary>
+	/// Per-instance data of a skinned draw (see Renderer::RenderSkinned), read by SV_InstanceID as with RenderStructured.
+	/// </summary>
+	struct SkinnedInstance
+	{
+		unify::Matrix world;
+		uint32_t palette; // First bone of the instance's palette, from SkinningPalette::Add.
+		uint32_t boneCount;
+		uint32_t padding[ 2 ];
+	};
+
+	/// <summary>
+	/// Bone palettes of every skinned character for the frame, packed compactly into one structured buffer the vertex
+	/// shader reads at Slot. Characters add their bone matrices each frame, and draw with the returned offset (see
+	/// Renderer::RenderSkinned), so characters sharing a skeleton and mesh can be drawn instanced.
+	/// </summary>
+	class SkinningPalette
+	{
+	public:
+		/// <summary>
+		/// Below the slots VertexPuller uses.
+		/// </summary>
+		static const UINT Slot = Renderer::InstanceDataSlot - 4;
+
+		struct Format
+		{
+			enum TYPE
+			{
+				Matrix3x4, // 48 bytes a bone: the transposed matrix's first three rows, for mul( float3x4, float4 ).
+				DualQuaternion // 32 bytes a bone: rotation quaternion, then dual part. Rigid transforms only, no scale.
+			};
+		};
+
+		SkinningPalette( Renderer * renderer, Format::TYPE format = Format::Matrix3x4 );
+		~SkinningPalette();
+
+		/// <summary>
+		/// Change format, dropping this frame's palettes.
+		/// </summary>
+		void SetFormat( Format::TYPE format );
+		Format::TYPE GetFormat() const;
+
+		/// <summary>
+		/// Bytes each bone takes in the buffer.
+		/// </summary>
+		size_t GetStride() const;
+
+		/// <summary>
+		/// Forget last frame's palettes. The frame's first upload discards the buffer.
+		/// </summary>
+		void BeginFrame();
+
+		/// <summary>
+		/// Pack a palette of bone matrices (row vector convention, translation in the last row), returning the index of
+		/// its first bone in the buffer. Valid for this frame.
+		/// </summary>
+		uint32_t Add( const unify::Matrix * bones, size_t boneCount );
+
+		/// <summary>
+		/// Append palettes added since the last upload behind those already uploaded (NO_OVERWRITE), leaving earlier
+		/// draws of the frame their palettes, then bind the buffer to Slot of the vertex shader.
+		/// </summary>
+		void Use();
+
+		/// <summary>
+		/// The packed bones of this frame, as they will be uploaded.
+		/// </summary>
+		const std::vector< float > & GetPacked() const;
+
+		static void PackMatrix3x4( const unify::Matrix * bones, size_t boneCount, float * out );
+
+		/// <summary>
+		/// Each rotation is put in the hemisphere of the palette's first bone, so that bones blended on a vertex agree
+		/// in sign. Shaders blending bones far apart should still correct signs against the vertex's first bone.
+		/// </summary>
+		static void PackDualQuaternion( const unify::Matrix * bones, size_t boneCount, float * out );
+
+	private:
+		Renderer * m_renderer;
+		Format::TYPE m_format;
+		std::vector< float > m_packed;
+		size_t m_uploaded; // Bones of packed already in the buffer.
+		std::unique_ptr< DataBuffer > m_buffer;
+	};
+}
\ No newline at end of file
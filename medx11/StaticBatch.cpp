@@ -0,0 +1,298 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#include <medx11/StaticBatch.h>
+#include <medx11/VertexQuantizer.h>
+#include <me/exception/FailedToCreate.h>
+#include <algorithm>
+#include <future>
+#include <thread>
+#include <cstring>
+#include <cfloat>
+
+using namespace medx11;
+using namespace me;
+using namespace render;
+
+namespace
+{
+	/// <summary>
+	/// Spread the low 10 bits of a value three bits apart, for a 30 bit Morton code.
+	/// </summary>
+	uint32_t Spread( uint32_t value )
+	{
+		value &= 0x3FF;
+		value = ( value | ( value << 16 ) ) & 0x030000FF;
+		value = ( value | ( value << 8 ) ) & 0x0300F00F;
+		value = ( value | ( value << 4 ) ) & 0x030C30C3;
+		value = ( value | ( value << 2 ) ) & 0x09249249;
+		return value;
+	}
+}
+
+StaticBatch::StaticBatch( Renderer * renderer, VertexDeclaration::ptr vertexDeclaration )
+	: m_renderer{ renderer }
+	, m_vertexDeclaration{ vertexDeclaration }
+	, m_stride{ vertexDeclaration->GetSizeInBytes( 0 ) }
+	, m_vertexCount{ 0 }
+{
+	if ( m_vertexDeclaration->NumberOfSlots() != 1 || m_vertexDeclaration->GetInstancing( 0 ) != Instancing::None )
+	{
+		throw exception::FailedToCreate( "Static batch requires a vertex declaration with a single per-vertex slot!" );
+	}
+}
+
+size_t StaticBatch::Add( const void * vertices, size_t vertexCount, const uint32_t * indices, size_t indexCount, const unify::Matrix & world )
+{
+	for ( size_t i = 0; i < indexCount; i++ )
+	{
+		if ( indices[ i ] >= vertexCount )
+		{
+			throw unify::Exception( "Static batch mesh has indices out of range of its vertices!" );
+		}
+	}
+
+	Mesh mesh{};
+	mesh.vertices.assign( (const unsigned char *)vertices, (const unsigned char *)vertices + vertexCount * m_stride );
+	mesh.indices.assign( indices, indices + indexCount );
+	mesh.world = world;
+	m_meshes.push_back( mesh );
+	return m_meshes.size() - 1;
+}
+
+void StaticBatch::Transform( Mesh & mesh ) const
+{
+	for ( size_t axis = 0; axis < 3; axis++ )
+	{
+		mesh.min[ axis ] = FLT_MAX;
+		mesh.max[ axis ] = -FLT_MAX;
+	}
+
+	size_t vertexCount = mesh.vertices.size() / m_stride;
+	if ( vertexCount == 0 )
+	{
+		return;
+	}
+
+	// The layout is only used for where elements are in the declared vertex.
+	VertexQuantizer::Layout layout = m_renderer->GetVertexQuantizer()->GetLayout( *m_vertexDeclaration, 0 );
+
+	// Normals go through the inverse transpose, so non-uniform scale leaves them perpendicular to the surface.
+	// Tangents and binormals lie in the surface, so they go through the world matrix itself.
+	XMMATRIX world = XMLoadFloat4x4( (const XMFLOAT4X4 *)&mesh.world );
+	unify::Matrix normalMatrix;
+	XMStoreFloat4x4( (XMFLOAT4X4 *)&normalMatrix, XMMatrixTranspose( XMMatrixInverse( nullptr, world ) ) );
+
+	// A mirroring world matrix turns front faces into back faces, so restore the winding of each triangle.
+	if ( XMVectorGetX( XMMatrixDeterminant( world ) ) < 0.0f )
+	{
+		for ( size_t i = 0; i + 2 < mesh.indices.size(); i += 3 )
+		{
+			std::swap( mesh.indices[ i + 1 ], mesh.indices[ i + 2 ] );
+		}
+	}
+
+	size_t element = 0;
+	for ( auto & e : m_vertexDeclaration->Elements() )
+	{
+		const VertexQuantizer::Element & described = layout.elements[ element++ ];
+		if ( e.SemanticIndex != 0 || described.components < 3 ) continue;
+
+		bool position = _stricmp( e.SemanticName.c_str(), "POSITION" ) == 0;
+		bool normal = _stricmp( e.SemanticName.c_str(), "NORMAL" ) == 0;
+		bool tangent = _stricmp( e.SemanticName.c_str(), "TANGENT" ) == 0 || _stricmp( e.SemanticName.c_str(), "BINORMAL" ) == 0;
+		if ( ! position && ! normal && ! tangent ) continue;
+
+		unsigned char * vertex = mesh.vertices.data() + described.sourceOffset;
+		for ( size_t i = 0; i < vertexCount; i++, vertex += m_stride )
+		{
+			float * data = (float *)vertex;
+			unify::V3< float > v( data[ 0 ], data[ 1 ], data[ 2 ] );
+			if ( position )
+			{
+				mesh.world.TransformCoord( v );
+				mesh.min[ 0 ] = (std::min)( mesh.min[ 0 ], v.x );
+				mesh.min[ 1 ] = (std::min)( mesh.min[ 1 ], v.y );
+				mesh.min[ 2 ] = (std::min)( mesh.min[ 2 ], v.z );
+				mesh.max[ 0 ] = (std::max)( mesh.max[ 0 ], v.x );
+				mesh.max[ 1 ] = (std::max)( mesh.max[ 1 ], v.y );
+				mesh.max[ 2 ] = (std::max)( mesh.max[ 2 ], v.z );
+			}
+			else
+			{
+				( normal ? normalMatrix : mesh.world ).TransformNormal( v );
+				v.Normalize();
+			}
+			data[ 0 ] = v.x;
+			data[ 1 ] = v.y;
+			data[ 2 ] = v.z;
+		}
+	}
+}
+
+void StaticBatch::Build()
+{
+	if ( m_meshes.empty() )
+	{
+		throw exception::FailedToCreate( "Static batch has no meshes to build!" );
+	}
+
+	// Meshes are transformed in place, each worker taking every nth mesh so large and small meshes even out.
+	size_t parts = (std::max)( (size_t)1, (std::min)( (size_t)std::thread::hardware_concurrency(), m_meshes.size() ) );
+	std::vector< std::future< void > > jobs;
+	for ( size_t part = 0; part < parts; part++ )
+	{
+		jobs.push_back( std::async( std::launch::async, [this, part, parts]()
+		{
+			for ( size_t i = part; i < m_meshes.size(); i += parts )
+			{
+				Transform( m_meshes[ i ] );
+			}
+		} ) );
+	}
+	for ( auto && job : jobs )
+	{
+		job.get();
+	}
+
+	float min[ 3 ] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float max[ 3 ] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for ( auto && mesh : m_meshes )
+	{
+		for ( size_t axis = 0; axis < 3; axis++ )
+		{
+			min[ axis ] = (std::min)( min[ axis ], mesh.min[ axis ] );
+			max[ axis ] = (std::max)( max[ axis ], mesh.max[ axis ] );
+		}
+	}
+
+	// Order meshes by the Morton code of their centers within the batch.
+	std::vector< uint32_t > codes( m_meshes.size() );
+	for ( size_t i = 0; i < m_meshes.size(); i++ )
+	{
+		uint32_t code = 0;
+		for ( size_t axis = 0; axis < 3; axis++ )
+		{
+			float extent = max[ axis ] - min[ axis ];
+			float center = ( m_meshes[ i ].min[ axis ] + m_meshes[ i ].max[ axis ] ) * 0.5f;
+			float unit = extent > 0.0f ? ( center - min[ axis ] ) / extent : 0.0f;
+			code |= Spread( (uint32_t)( (std::min)( (std::max)( unit, 0.0f ), 1.0f ) * 1023.0f ) ) << axis;
+		}
+		codes[ i ] = code;
+	}
+
+	std::vector< size_t > order( m_meshes.size() );
+	for ( size_t i = 0; i < order.size(); i++ )
+	{
+		order[ i ] = i;
+	}
+	std::stable_sort( order.begin(), order.end(), [&]( size_t a, size_t b ) { return codes[ a ] < codes[ b ]; } );
+
+	size_t vertexCount = 0;
+	size_t indexCount = 0;
+	for ( auto && mesh : m_meshes )
+	{
+		vertexCount += mesh.vertices.size() / m_stride;
+		indexCount += mesh.indices.size();
+	}
+
+	if ( vertexCount == 0 || indexCount == 0 )
+	{
+		throw exception::FailedToCreate( "Static batch meshes have nothing to draw!" );
+	}
+
+	std::vector< unsigned char > vertices( vertexCount * m_stride );
+	std::vector< uint32_t > indices( indexCount );
+	m_submeshes.clear();
+	size_t vertexOffset = 0;
+	size_t indexOffset = 0;
+	for ( auto && meshIndex : order )
+	{
+		const Mesh & mesh = m_meshes[ meshIndex ];
+		if ( ! mesh.vertices.empty() )
+		{
+			memcpy( vertices.data() + vertexOffset * m_stride, mesh.vertices.data(), mesh.vertices.size() );
+		}
+
+		for ( size_t i = 0; i < mesh.indices.size(); i++ )
+		{
+			indices[ indexOffset + i ] = mesh.indices[ i ] + (uint32_t)vertexOffset;
+		}
+
+		Submesh submesh{};
+		submesh.mesh = meshIndex;
+		submesh.startIndex = (unsigned int)indexOffset;
+		submesh.indexCount = (unsigned int)mesh.indices.size();
+		submesh.bbox = unify::BBox< float >( unify::V3< float >( mesh.min[ 0 ], mesh.min[ 1 ], mesh.min[ 2 ] ), unify::V3< float >( mesh.max[ 0 ], mesh.max[ 1 ], mesh.max[ 2 ] ) );
+		m_submeshes.push_back( submesh );
+
+		vertexOffset += mesh.vertices.size() / m_stride;
+		indexOffset += mesh.indices.size();
+	}
+
+	m_vertexCount = vertexCount;
+	m_bbox = unify::BBox< float >( unify::V3< float >( min[ 0 ], min[ 1 ], min[ 2 ] ), unify::V3< float >( max[ 0 ], max[ 1 ], max[ 2 ] ) );
+
+	VertexBufferParameters vertexParameters;
+	vertexParameters.vertexDeclaration = m_vertexDeclaration;
+	vertexParameters.countAndSource.push_back( { vertexCount, vertices.data() } );
+	vertexParameters.usage = BufferUsage::Immutable;
+	vertexParameters.bbox = m_bbox;
+	m_vertexBuffer = m_renderer->ProduceVB( vertexParameters );
+
+	IndexBufferParameters indexParameters;
+	indexParameters.countAndSource.push_back( { indexCount, indices.data() } );
+	indexParameters.usage = BufferUsage::Immutable;
+	m_indexBuffer = m_renderer->ProduceIB( indexParameters );
+
+	// The source data now lives in the buffers.
+	m_meshes.clear();
+	m_meshes.shrink_to_fit();
+}
+
+IVertexBuffer::ptr StaticBatch::GetVertexBuffer() const
+{
+	return m_vertexBuffer;
+}
+
+IIndexBuffer::ptr StaticBatch::GetIndexBuffer() const
+{
+	return m_indexBuffer;
+}
+
+const std::vector< StaticBatch::Submesh > & StaticBatch::GetSubmeshes() const
+{
+	return m_submeshes;
+}
+
+const unify::BBox< float > & StaticBatch::GetBBox() const
+{
+	return m_bbox;
+}
+
+std::vector< RenderMethod > StaticBatch::GetRenderMethods( const std::vector< bool > & visible ) const
+{
+	std::vector< RenderMethod > methods;
+	for ( size_t i = 0; i < m_submeshes.size(); i++ )
+	{
+		if ( i >= visible.size() || ! visible[ i ] ) continue;
+
+		const Submesh & submesh = m_submeshes[ i ];
+		if ( ! methods.empty() && methods.back().startIndex + methods.back().indexCount == submesh.startIndex )
+		{
+			methods.back().indexCount += submesh.indexCount;
+			continue;
+		}
+
+		RenderMethod method{};
+		method.primitiveType = PrimitiveType::TriangleList;
+		method.useIB = true;
+		method.startVertex = 0;
+		method.vertexCount = (unsigned int)m_vertexCount;
+		method.baseVertexIndex = 0;
+		method.startIndex = submesh.startIndex;
+		method.indexCount = submesh.indexCount;
+		methods.push_back( method );
+	}
+	return methods;
+}
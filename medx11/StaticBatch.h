@@ -0,0 +1,89 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#pragma once
+
+#include <medx11/Renderer.h>
+#include <me/render/VertexDeclaration.h>
+#include <me/render/IVertexBuffer.h>
+#include <me/render/IIndexBuffer.h>
+#include <me/render/RenderMethod.h>
+#include <unify/BBox.h>
+#include <unify/Matrix.h>
+#include <vector>
+#include <cstdint>
+
+namespace medx11
+{
+	/// <summary>
+	/// Merges static meshes that share a vertex declaration (and are drawn with the same effect) into one vertex and
+	/// index buffer, their vertices transformed into world space on worker threads as the batch is built. Each mesh
+	/// stays a range of indices with its own bounds, so culled meshes can be skipped while visible neighbours are drawn
+	/// together.
+	/// </summary>
+	class StaticBatch
+	{
+	public:
+		struct Submesh
+		{
+			size_t mesh; // As numbered by Add.
+			unsigned int startIndex;
+			unsigned int indexCount;
+			unify::BBox< float > bbox; // In world space.
+		};
+
+		/// <summary>
+		/// The declaration must have a single, per-vertex, slot.
+		/// </summary>
+		StaticBatch( Renderer * renderer, me::render::VertexDeclaration::ptr vertexDeclaration );
+
+		/// <summary>
+		/// Add a mesh, as a triangle list, returning its number. Vertices are in the declared layout; both they and the
+		/// indices are copied. Positions are transformed by world, and normals, tangents and binormals by its rotation.
+		/// </summary>
+		size_t Add( const void * vertices, size_t vertexCount, const uint32_t * indices, size_t indexCount, const unify::Matrix & world );
+
+		/// <summary>
+		/// Transform the meshes and create the buffers. Meshes are ordered along a space filling curve, so meshes that
+		/// are visible together tend to be neighbours, and draw together.
+		/// </summary>
+		void Build();
+
+		me::render::IVertexBuffer::ptr GetVertexBuffer() const;
+		me::render::IIndexBuffer::ptr GetIndexBuffer() const;
+
+		/// <summary>
+		/// Submeshes in the order they are stored, once built.
+		/// </summary>
+		const std::vector< Submesh > & GetSubmeshes() const;
+		const unify::BBox< float > & GetBBox() const;
+
+		/// <summary>
+		/// Draws for the visible submeshes (flagged in submesh order), with neighbouring submeshes merged into one draw.
+		/// </summary>
+		std::vector< me::render::RenderMethod > GetRenderMethods( const std::vector< bool > & visible ) const;
+
+	private:
+		struct Mesh
+		{
+			std::vector< unsigned char > vertices;
+			std::vector< uint32_t > indices;
+			unify::Matrix world;
+			float min[ 3 ];
+			float max[ 3 ];
+		};
+
+		void Transform( Mesh & mesh ) const;
+
+		Renderer * m_renderer;
+		me::render::VertexDeclaration::ptr m_vertexDeclaration;
+		size_t m_stride;
+
+		std::vector< Mesh > m_meshes;
+		std::vector< Submesh > m_submeshes;
+		size_t m_vertexCount;
+		unify::BBox< float > m_bbox;
+		me::render::IVertexBuffer::ptr m_vertexBuffer;
+		me::render::IIndexBuffer::ptr m_indexBuffer;
+	};
+}
\ No newline at end of file
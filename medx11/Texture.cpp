@@ -3,12 +3,22 @@
 //
 
 #include <medx11/Texture.h>
+#include <medx11/TextureResidency.h>
+#include <medx11/TextureArrayPool.h>
+#include <medx11/TextureAtlas.h>
+#include <medx11/Conversion.h>
 
 #include <DDS.h>
 #pragma comment( lib, "DirectXTex" )
 #include <me/exception/NotImplemented.h>
 #include <me/exception/FailedToLock.h>
 #include <qxml/Document.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+#include <functional>
 
 // MS agressive macros.
 #ifdef LoadImage
@@ -19,17 +29,150 @@ using namespace medx11;
 using namespace me;
 using namespace render;
 
+namespace
+{
+	bool HasCPUAccess( unify::DataLockAccess::TYPE access )
+	{
+		using namespace unify;
+		return access == DataLockAccess::Readonly || access == DataLockAccess::Writeonly || access == DataLockAccess::ReadWrite;
+	}
+
+	/// <summary>
+	/// Format has no BC1 sRGB value, so such textures report Unknown rather than the linear BC1, and are described by
+	/// the DXGI format we keep alongside.
+	/// </summary>
+	Format::TYPE ToFormat( DXGI_FORMAT format )
+	{
+		if ( format == DXGI_FORMAT_BC1_UNORM_SRGB )
+		{
+			return Format::Unknown;
+		}
+		return unify::Cast< Format::TYPE >( format );
+	}
+
+	/// <summary>
+	/// Run work for each index across worker threads, rethrowing the first failure once all have finished.
+	/// </summary>
+	void ParallelFor( size_t count, const std::function< void( size_t ) > & work )
+	{
+		std::atomic< size_t > next{ 0 };
+		std::exception_ptr failure;
+		std::mutex failureLock;
+
+		auto worker = [&]()
+		{
+			// WIC requires COM on every thread that uses it.
+			HRESULT comResult = CoInitializeEx( nullptr, COINIT_MULTITHREADED );
+
+			for ( size_t i = next++; i < count; i = next++ )
+			{
+				try
+				{
+					work( i );
+				}
+				catch( ... )
+				{
+					std::lock_guard< std::mutex > guard( failureLock );
+					if ( ! failure )
+					{
+						failure = std::current_exception();
+					}
+				}
+			}
+
+			if ( SUCCEEDED( comResult ) )
+			{
+				CoUninitialize();
+			}
+		};
+
+		size_t threadCount = (std::min)( (std::max)( (size_t)std::thread::hardware_concurrency(), (size_t)1 ), count );
+		std::vector< std::thread > threads;
+		for ( size_t i = 0; i < threadCount; i++ )
+		{
+			threads.push_back( std::thread( worker ) );
+		}
+
+		for ( auto && thread : threads )
+		{
+			thread.join();
+		}
+
+		if ( failure )
+		{
+			std::rethrow_exception( failure );
+		}
+	}
+}
+
 Texture::Texture( IRenderer * renderer, TextureParameters parameters )
 	: m_renderer( dynamic_cast< const Renderer *>(renderer) )
 	, m_useColorKey( false )
 	, m_created( false )
+	, m_fileMipLevels( 0 )
+	, m_arraySlice( -1 )
 	, m_parameters( parameters )
+	, m_format( DXGI_FORMAT_UNKNOWN )
 {
-	Create();
+	// Created on first use (see TextureResidency::Touch), so that loading a texture doesn't decode and upload it. A
+	// file is still probed here, so that a missing or corrupt file fails at load rather than mid-draw.
+	if ( m_parameters.source.Empty() )
+	{
+		m_imageSize.width = (unsigned int)m_parameters.size.width;
+		m_imageSize.height = (unsigned int)m_parameters.size.height;
+	}
+	else
+	{
+		Preload();
+	}
+	m_renderer->GetTextureResidency()->Add( this );
+}
+
+Texture::Texture( IRenderer * renderer, ID3D11Texture2D * texture, TextureParameters parameters )
+	: m_renderer( dynamic_cast< const Renderer *>(renderer) )
+	, m_useColorKey( false )
+	, m_created( false )
+	, m_fileMipLevels( 0 )
+	, m_arraySlice( -1 )
+	, m_parameters( parameters )
+	, m_format( DXGI_FORMAT_UNKNOWN )
+{
+	D3D11_TEXTURE2D_DESC textureDesc{};
+	texture->GetDesc( &textureDesc );
+
+	m_texture = texture;
+	m_format = textureDesc.Format;
+	m_parameters.format = ToFormat( textureDesc.Format );
+	m_parameters.size = unify::Size< size_t >( textureDesc.Width, textureDesc.Height );
+
+	CreateSamplerAndView( textureDesc.Format );
+
+	m_imageSize.width = textureDesc.Width;
+	m_imageSize.height = textureDesc.Height;
+	m_created = true;
+
+	m_renderer->GetTextureResidency()->Add( this );
 }
 
 Texture::~Texture()
 {
+	// Without a renderer (see Detach) there is nothing left to remove ourselves from. The pool is gone while
+	// the renderer tears it down, along with its own array textures.
+	if ( m_renderer )
+	{
+		if ( m_renderer->GetTextureArrayPool() )
+		{
+			m_renderer->GetTextureArrayPool()->Remove( this );
+		}
+		m_renderer->GetTextureResidency()->Remove( this );
+	}
+
+	// Removing us from an atlas also removes the atlas from m_atlases.
+	std::vector< TextureAtlas * > atlases = m_atlases;
+	for ( auto && atlas : atlases )
+	{
+		atlas->Remove( this );
+	}
 	Destroy();
 }
 
@@ -51,9 +194,42 @@ void Texture::Create()
 // Destroyes data, keeps header intact - thus no graphical footprint, yet we can still use it's statistics/dimensions in calculations.
 void Texture::Destroy()
 {
+	m_colorMap = nullptr; // The view holds a reference to the texture.
 	m_texture = nullptr;
 	m_created = false; // TODO: Can solve this from m_texture.
 	m_scratch.Release();
+	m_dirtyRects.clear();
+}
+
+void Texture::Detach()
+{
+	Destroy();
+	m_arraySlice = -1;
+	m_renderer = nullptr;
+}
+
+bool Texture::IsCreated() const
+{
+	return m_created;
+}
+
+bool Texture::IsEvictable() const
+{
+	// Without a source we have no way to restore the image, and written data would be lost.
+	return ! m_parameters.source.Empty() && ! unify::DataLockAccess::WriteAccess( m_parameters.lockAccess.cpu );
+}
+
+size_t Texture::GetSizeInBytes() const
+{
+	size_t rowPitch = 0;
+	size_t slicePitch = 0;
+	DirectX::ComputePitch( m_format, m_imageSize.width, m_imageSize.height, rowPitch, slicePitch );
+	return slicePitch;
+}
+
+int Texture::GetArraySlice() const
+{
+	return m_arraySlice;
 }
 
 const unsigned int Texture::FileWidth() const
@@ -66,8 +242,18 @@ const unsigned int Texture::FileHeight() const
 	return m_fileSize.height;
 }
 
+const unsigned int Texture::FileMipLevels() const
+{
+	return m_fileMipLevels;
+}
+
 const unify::Size< unsigned int > & Texture::ImageSize() const
 {
+	// Until created, a file's size comes from its header.
+	if ( ! m_created && m_imageSize.width == 0 && ! m_parameters.source.Empty() )
+	{
+		const_cast< Texture * >( this )->LoadMetadata();
+	}
 	return m_imageSize;
 }
 
@@ -83,85 +269,175 @@ void Texture::LockRect( unsigned int level, TextureLock & lock, const unify::Rec
 		throw exception::FailedToLock( "Attempted to lock texture with access " + unify::DataLockAccess::ToString( m_parameters.lockAccess.cpu ) + " for unsupported access " + unify::DataLockAccess::ToString( access ) + "!" );
 	}
 
+	if ( ! m_created )
+	{
+		Create();
+	}
+
 	if ( ! m_scratch.GetImageCount() )
-	{	
-		D3D11_MAP mapType;
-		{
-			using namespace unify;
+	{
+		throw exception::FailedToLock( "Attempted to lock texture \"" + GetSource() + "\" that has no CPU copy!" );
+	}
 
-			switch( access )
-			{
-			case DataLockAccess::Readonly:
-				mapType = D3D11_MAP_READ;
-				break;
-			case DataLockAccess::Writeonly:
-				mapType = D3D11_MAP_WRITE_DISCARD;
-				break;
-			case DataLockAccess::ReadWrite:
-				mapType = D3D11_MAP_READ_WRITE;
-				break;
-
-			default:
-				throw me::exception::FailedToLock( "Attempted to lock texture with access " + unify::DataLockAccess::ToString( m_parameters.lockAccess.cpu ) + " for unsupported access " + unify::DataLockAccess::ToString( access ) +"!" );
-			}
+	if ( level >= m_dirtyRects.size() )
+	{
+		throw exception::FailedToLock( "Attempted to lock level " + unify::Cast< std::string >( level ) + " of a texture with " + unify::Cast< std::string >( m_dirtyRects.size() ) + " levels!" );
+	}
+
+	const DirectX::Image * image = m_scratch.GetImage( level, 0, 0 );
+	FormatElement element = GetFormatElement( image->format );
+
+	D3D11_BOX box{ 0, 0, 0, (UINT)image->width, (UINT)image->height, 1 };
+	if ( rect )
+	{
+		box.left = (UINT)(std::max)( rect->left, 0L );
+		box.top = (UINT)(std::max)( rect->top, 0L );
+		box.right = (std::min)( (UINT)(std::max)( rect->right, 0L ), box.right );
+		box.bottom = (std::min)( (UINT)(std::max)( rect->bottom, 0L ), box.bottom );
+		if ( box.left >= box.right || box.top >= box.bottom )
+		{
+			throw exception::FailedToLock( "Attempted to lock an empty rect of texture \"" + GetSource() + "\"!" );
 		}
-		
-		auto dxContext = m_renderer->GetDxContext();
-		D3D11_MAPPED_SUBRESOURCE mappedResource{};
-		auto result = dxContext->Map( m_texture, 0, mapType, 0, &mappedResource );
-		if (WIN_FAILED( result ) )
+	}
+
+	// Snap out to whole elements, as the last block of a block compressed image may extend past the image.
+	box.left -= box.left % element.width;
+	box.top -= box.top % element.height;
+	box.right += ( element.width - box.right % element.width ) % element.width;
+	box.bottom += ( element.height - box.bottom % element.height ) % element.height;
+
+	lock.pBits = image->pixels + ( box.top / element.height ) * image->rowPitch + ( box.left / element.width ) * element.bytes;
+	lock.uStride = (UINT)image->rowPitch;
+	lock.bpp = (UINT)element.bytes;
+	lock.uWidth = box.right - box.left;
+	lock.uHeight = box.bottom - box.top;
+	lock.totalBytes = ( lock.uHeight / element.height ) * lock.uStride;
+
+	if ( unify::DataLockAccess::WriteAccess( access ) )
+	{
+		D3D11_TEXTURE2D_DESC textureDesc{};
+		m_texture->GetDesc( &textureDesc );
+		if ( textureDesc.Usage == D3D11_USAGE_IMMUTABLE )
 		{
-			throw me::exception::FailedToLock( "Failed to lock texture with access " + unify::DataLockAccess::ToString( m_parameters.lockAccess.cpu ) + " for unsupported access " + unify::DataLockAccess::ToString( access ) + "!" );
+			throw exception::FailedToLock( "Attempted to write to immutable texture \"" + GetSource() + "\"!" );
 		}
 
-		lock.pBits = (unsigned char*)mappedResource.pData;
-		lock.uWidth = m_imageSize.width;
-		lock.uHeight = m_imageSize.height;
-		lock.uStride = mappedResource.RowPitch;
-	
-		lock.bpp = 4;
-		if ( rect )
+		AddDirtyRect( level, box );
+	}
+}
+
+void Texture::UnlockRect( unsigned int level )
+{
+	if ( level < m_dirtyRects.size() )
+	{
+		FlushDirtyRects( level );
+	}
+}
+
+void Texture::AddDirtyRect( unsigned int level, D3D11_BOX box )
+{
+	auto & rects = m_dirtyRects[ level ];
+
+	// A merged rect can reach rects the original didn't, so start over after each merge.
+	for ( size_t i = 0; i < rects.size(); )
+	{
+		const D3D11_BOX & other = rects[i];
+		if ( box.left <= other.right && other.left <= box.right && box.top <= other.bottom && other.top <= box.bottom )
 		{
-			lock.uWidth = rect->right - rect->left;
-			lock.uHeight = rect->bottom - rect->top;
+			box.left = (std::min)( box.left, other.left );
+			box.top = (std::min)( box.top, other.top );
+			box.right = (std::max)( box.right, other.right );
+			box.bottom = (std::max)( box.bottom, other.bottom );
+			rects.erase( rects.begin() + i );
+			i = 0;
 		}
 		else
 		{
-			lock.uWidth = m_imageSize.width;
-			lock.uHeight = m_imageSize.height;
+			i++;
 		}
-		lock.totalBytes = lock.uHeight * lock.uStride;
 	}
-	else
+	rects.push_back( box );
+
+	// Past a handful of rects, the per update overhead outweighs the bytes saved over a single bounding rect.
+	const size_t maxDirtyRects = 8;
+	if ( rects.size() > maxDirtyRects )
 	{
-		lock.pBits = m_scratch.GetImage( level, 0, 0 )->pixels;
-		lock.uStride = (UINT)m_scratch.GetImage( level, 0, 0 )->rowPitch;
-		lock.bpp = 4;
-		if( rect )
+		D3D11_BOX bounds = rects[0];
+		for ( auto && other : rects )
 		{
-			lock.uWidth = rect->right - rect->left;
-			lock.uHeight = rect->bottom - rect->top;
+			bounds.left = (std::min)( bounds.left, other.left );
+			bounds.top = (std::min)( bounds.top, other.top );
+			bounds.right = (std::max)( bounds.right, other.right );
+			bounds.bottom = (std::max)( bounds.bottom, other.bottom );
 		}
-		else
-		{
-			lock.uWidth = m_imageSize.width;
-			lock.uHeight = m_imageSize.height;
-		}
-		lock.totalBytes = lock.uHeight * lock.uStride;
+		rects.assign( 1, bounds );
 	}
 }
 
-void Texture::UnlockRect( unsigned int level )
+void Texture::FlushDirtyRects( unsigned int level )
 {
+	auto & rects = m_dirtyRects[ level ];
+	if ( rects.empty() )
+	{
+		return;
+	}
+
 	auto dxContext = m_renderer->GetDxContext();
-	if ( ! m_scratch.GetImageCount() )
+	const DirectX::Image * image = m_scratch.GetImage( level, 0, 0 );
+
+	D3D11_TEXTURE2D_DESC textureDesc{};
+	m_texture->GetDesc( &textureDesc );
+
+	if ( textureDesc.Usage == D3D11_USAGE_DEFAULT )
 	{
-		dxContext->Unmap( m_texture, 0 );
+		FormatElement element = GetFormatElement( image->format );
+		for ( auto && box : rects )
+		{
+			const uint8_t * source = image->pixels + ( box.top / element.height ) * image->rowPitch + ( box.left / element.width ) * element.bytes;
+			dxContext->UpdateSubresource( m_texture, level, &box, source, (UINT)image->rowPitch, 0 );
+		}
 	}
 	else
 	{
-		// Nothing to do.
+		// Dynamic textures can only be written through a discarding Map, so the whole level is uploaded from our copy.
+		D3D11_MAP mapType = textureDesc.Usage == D3D11_USAGE_DYNAMIC ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE;
+		D3D11_MAPPED_SUBRESOURCE mappedResource{};
+		HRESULT result = dxContext->Map( m_texture, level, mapType, 0, &mappedResource );
+		if ( WIN_FAILED( result ) )
+		{
+			throw exception::FailedToLock( "Failed to map texture \"" + GetSource() + "\" for upload!" );
+		}
+
+		size_t rows = DirectX::ComputeScanlines( image->format, image->height );
+		size_t rowBytes = (std::min)( (size_t)mappedResource.RowPitch, image->rowPitch );
+		for ( size_t row = 0; row < rows; row++ )
+		{
+			memcpy( (uint8_t*)mappedResource.pData + row * mappedResource.RowPitch, image->pixels + row * image->rowPitch, rowBytes );
+		}
+
+		dxContext->Unmap( m_texture, level );
+
+		rects.assign( 1, D3D11_BOX{ 0, 0, 0, (UINT)image->width, (UINT)image->height, 1 } );
 	}
+
+	// Pooled and atlased copies of our top level were taken once, so the written regions are copied over to them.
+	if ( level == 0 )
+	{
+		for ( auto && box : rects )
+		{
+			if ( m_arraySlice != -1 )
+			{
+				m_renderer->GetTextureArrayPool()->Update( this, box );
+			}
+
+			for ( auto && atlas : m_atlases )
+			{
+				atlas->Update( this, box );
+			}
+		}
+	}
+
+	rects.clear();
 }
 
 // Load all possible info (short of bits) about the texture
@@ -170,11 +446,31 @@ void Texture::Preload()
 	// Load any new image header file if there
 	LoadHeader();
 
-	// Attempt to load the image for information
-	Create();
+	// Read the image file's header for information, without decoding the image.
+	LoadMetadata();
+}
 
-	// Destroy our texture.
-	Destroy();
+void Texture::PreloadBatch( const std::vector< Texture * > & textures )
+{
+	// Only headers are read, so browsing many textures costs no decoding.
+	ParallelFor( textures.size(), [&]( size_t i )
+	{
+		textures[i]->Preload();
+	} );
+}
+
+void Texture::DecodeBatch( const std::vector< Texture * > & textures )
+{
+	// Decoding is the expensive part of loading, so it is done here on worker threads. Only the upload is left for
+	// the texture's first use.
+	ParallelFor( textures.size(), [&]( size_t i )
+	{
+		Texture * texture = textures[i];
+		if ( ! texture->m_created && ! texture->m_parameters.source.Empty() && ! texture->m_decoded.GetImageCount() )
+		{
+			texture->DecodeImage( texture->m_parameters.source );
+		}
+	} );
 }
 
 void Texture::CreateFromSize()
@@ -195,65 +491,99 @@ void Texture::CreateFromSize()
 
 	unsigned int width = m_parameters.size.width;
 	unsigned int height = m_parameters.size.height;
+	DXGI_FORMAT format = unify::Cast< DXGI_FORMAT >( m_parameters.format );
+	m_format = format;
+
+	// Lockable textures keep a CPU copy to lock, so that unlocking uploads only the rects written.
+	D3D11_SUBRESOURCE_DATA data{};
+	D3D11_SUBRESOURCE_DATA * initialData = nullptr;
+	if ( HasCPUAccess( m_parameters.lockAccess.cpu ) )
+	{
+		result = m_scratch.Initialize2D( format, width, height, 1, 1 );
+		if ( WIN_FAILED( result ) )
+		{
+			throw unify::Exception( "Failed to create CPU copy of texture of size " + unify::Cast< std::string >( width ) + "x" + unify::Cast< std::string >( height ) + "!" );
+		}
+		memset( m_scratch.GetPixels(), 0, m_scratch.GetPixelsSize() );
+
+		data.pSysMem = m_scratch.GetImage( 0, 0, 0 )->pixels;
+		data.SysMemPitch = (UINT)m_scratch.GetImage( 0, 0, 0 )->rowPitch;
+		data.SysMemSlicePitch = (UINT)m_scratch.GetImage( 0, 0, 0 )->slicePitch;
+		initialData = &data;
+	}
 
 	D3D11_TEXTURE2D_DESC textureDesc{};
 	textureDesc.Width = width;
 	textureDesc.Height = height;
 	textureDesc.MipLevels = 1;
 	textureDesc.ArraySize = 1;
-	textureDesc.Format = unify::Cast< DXGI_FORMAT >( m_parameters.format );
+	textureDesc.Format = format;
 	textureDesc.SampleDesc.Count = 1;
 	textureDesc.SampleDesc.Quality = 0;
-	textureDesc.Usage = D3D11_USAGE_DYNAMIC;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
 	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-	textureDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	textureDesc.CPUAccessFlags = 0;
 	textureDesc.MiscFlags = 0;
-	result = dxDevice->CreateTexture2D( &textureDesc, nullptr, &m_texture );
+	result = dxDevice->CreateTexture2D( &textureDesc, initialData, &m_texture );
 	if (WIN_FAILED( result ))
 	{
 		Destroy();
 		throw unify::Exception( "Failed to create texture of size " + unify::Cast< std::string >( width ) + "x" + unify::Cast< std::string >( height ) + "!" );
 	}
 
+	m_dirtyRects.resize( textureDesc.MipLevels );
+
+	CreateSamplerAndView( textureDesc.Format );
+
+	m_imageSize.width = width;
+	m_imageSize.height = height;
+}
+
+void Texture::CreateSamplerAndView( DXGI_FORMAT format )
+{
+	auto dxDevice = m_renderer->GetDxDevice();
+
+	HRESULT result = S_OK;
+
 	D3D11_SAMPLER_DESC colorMapDesc{};
 	colorMapDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
 	colorMapDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
 	colorMapDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
 	colorMapDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
 
-	if (m_parameters.min == Filtering::Point && m_parameters.mag == Filtering::Point && m_parameters.mip == Filtering::Point)
+	if ( m_parameters.min == Filtering::Point && m_parameters.mag == Filtering::Point && m_parameters.mip == Filtering::Point )
 	{
 		colorMapDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_POINT;
 	}
-	else if (m_parameters.min == Filtering::Point && m_parameters.mag == Filtering::Point && m_parameters.mip == Filtering::Linear)
+	else if ( m_parameters.min == Filtering::Point && m_parameters.mag == Filtering::Point && m_parameters.mip == Filtering::Linear )
 	{
 		colorMapDesc.Filter = D3D11_FILTER_MIN_MAG_POINT_MIP_LINEAR;
 	}
-	else if (m_parameters.min == Filtering::Point && m_parameters.mag == Filtering::Linear && m_parameters.mip == Filtering::Point)
+	else if ( m_parameters.min == Filtering::Point && m_parameters.mag == Filtering::Linear && m_parameters.mip == Filtering::Point )
 	{
 		colorMapDesc.Filter = D3D11_FILTER_MIN_POINT_MAG_LINEAR_MIP_POINT;
 	}
-	else if (m_parameters.min == Filtering::Point && m_parameters.mag == Filtering::Linear && m_parameters.mip == Filtering::Linear)
+	else if ( m_parameters.min == Filtering::Point && m_parameters.mag == Filtering::Linear && m_parameters.mip == Filtering::Linear )
 	{
 		colorMapDesc.Filter = D3D11_FILTER_MIN_POINT_MAG_MIP_LINEAR;
 	}
-	else if (m_parameters.min == Filtering::Linear && m_parameters.mag == Filtering::Point && m_parameters.mip == Filtering::Point)
+	else if ( m_parameters.min == Filtering::Linear && m_parameters.mag == Filtering::Point && m_parameters.mip == Filtering::Point )
 	{
 		colorMapDesc.Filter = D3D11_FILTER_MIN_LINEAR_MAG_MIP_POINT;
 	}
-	else if (m_parameters.min == Filtering::Linear && m_parameters.mag == Filtering::Point && m_parameters.mip == Filtering::Linear)
+	else if ( m_parameters.min == Filtering::Linear && m_parameters.mag == Filtering::Point && m_parameters.mip == Filtering::Linear )
 	{
 		colorMapDesc.Filter = D3D11_FILTER_MIN_LINEAR_MAG_POINT_MIP_LINEAR;
 	}
-	else if (m_parameters.min == Filtering::Linear && m_parameters.mag == Filtering::Linear && m_parameters.mip == Filtering::Point)
+	else if ( m_parameters.min == Filtering::Linear && m_parameters.mag == Filtering::Linear && m_parameters.mip == Filtering::Point )
 	{
 		colorMapDesc.Filter = D3D11_FILTER_MIN_MAG_LINEAR_MIP_POINT;
 	}
-	else if (m_parameters.min == Filtering::Linear && m_parameters.mag == Filtering::Linear && m_parameters.mip == Filtering::Linear)
+	else if ( m_parameters.min == Filtering::Linear && m_parameters.mag == Filtering::Linear && m_parameters.mip == Filtering::Linear )
 	{
 		colorMapDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
 	}
-	else if (m_parameters.min == Filtering::Anisotropic && m_parameters.mag == Filtering::Anisotropic && m_parameters.mip == Filtering::Anisotropic)
+	else if ( m_parameters.min == Filtering::Anisotropic && m_parameters.mag == Filtering::Anisotropic && m_parameters.mip == Filtering::Anisotropic )
 	{
 		colorMapDesc.Filter = D3D11_FILTER_ANISOTROPIC;
 	}
@@ -272,17 +602,28 @@ void Texture::CreateFromSize()
 	result = dxDevice->CreateSamplerState( &colorMapDesc, &m_colorMapSampler );
 	assert( !WIN_FAILED( result ) );
 
+	D3D11_TEXTURE2D_DESC textureDesc{};
+	m_texture->GetDesc( &textureDesc );
+
 	D3D11_SHADER_RESOURCE_VIEW_DESC textureResourceDesc{};
-	textureResourceDesc.Format = textureDesc.Format;
-	textureResourceDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-	textureResourceDesc.Texture2D.MipLevels = 1;
-	textureResourceDesc.Texture2D.MostDetailedMip = 0;
+	textureResourceDesc.Format = format;
+	if ( textureDesc.ArraySize > 1 )
+	{
+		textureResourceDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+		textureResourceDesc.Texture2DArray.MipLevels = 1;
+		textureResourceDesc.Texture2DArray.MostDetailedMip = 0;
+		textureResourceDesc.Texture2DArray.FirstArraySlice = 0;
+		textureResourceDesc.Texture2DArray.ArraySize = textureDesc.ArraySize;
+	}
+	else
+	{
+		textureResourceDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+		textureResourceDesc.Texture2D.MipLevels = 1;
+		textureResourceDesc.Texture2D.MostDetailedMip = 0;
+	}
 
 	result = dxDevice->CreateShaderResourceView( m_texture, &textureResourceDesc, &m_colorMap );
 	assert( !WIN_FAILED( result ) );
-
-	m_imageSize.width = width;
-	m_imageSize.height = height;
 }
 
 void Texture::LoadHeader()
@@ -298,18 +639,17 @@ void Texture::LoadHeader()
 	m_spriteDictionary.LoadDictionary( imageHeaderFilepath );
 }
 
-// Load the actual image file...
-void Texture::LoadImage( unify::Path filePath )
+void Texture::LoadMetadata()
 {
-	auto dxDevice = m_renderer->GetDxDevice();
-
-	// Release any previous texture
-	Destroy();
+	if ( m_parameters.source.Empty() )
+	{
+		return;
+	}
 
 	// Verify file exists
-	if ( !filePath.Exists() )
+	if ( !m_parameters.source.Exists() )
 	{
-		throw unify::Exception( "Failed to load image, file not found! (" + filePath.ToString() + ")" );
+		throw unify::Exception( "Failed to load image metadata, file not found! (" + m_parameters.source.ToString() + ")" );
 	}
 
 	HRESULT result = S_OK;
@@ -318,15 +658,15 @@ void Texture::LoadImage( unify::Path filePath )
 
 	if ( m_parameters.source.IsExtension( "DDS" ) )
 	{
-		result = DirectX::LoadFromDDSFile( unify::Cast< std::wstring >( m_parameters.source.ToString() ).c_str(), DirectX::DDS_FLAGS::DDS_FLAGS_NONE, &texMetadata, m_scratch );
+		result = DirectX::GetMetadataFromDDSFile( unify::Cast< std::wstring >( m_parameters.source.ToString() ).c_str(), DirectX::DDS_FLAGS::DDS_FLAGS_NONE, texMetadata );
 	}
 	else if ( m_parameters.source.IsExtension( "BMP" ) || m_parameters.source.IsExtension( "JPG" ) || m_parameters.source.IsExtension( "JPEG" ) || m_parameters.source.IsExtension( "TIFF" ) || m_parameters.source.IsExtension( "TIF" ) || m_parameters.source.IsExtension( "HDP" ) || m_parameters.source.IsExtension( "PNG" ) )
 	{
-		result = DirectX::LoadFromWICFile( unify::Cast< std::wstring >( m_parameters.source.ToString() ).c_str(), DirectX::WIC_FLAGS::WIC_FLAGS_NONE, &texMetadata, m_scratch );
+		result = DirectX::GetMetadataFromWICFile( unify::Cast< std::wstring >( m_parameters.source.ToString() ).c_str(), DirectX::WIC_FLAGS::WIC_FLAGS_NONE, texMetadata );
 	}
 	else if ( m_parameters.source.IsExtension( "TGA" ) )
 	{
-		result = DirectX::LoadFromTGAFile( unify::Cast< std::wstring >( m_parameters.source.ToString() ).c_str(), &texMetadata, m_scratch );
+		result = DirectX::GetMetadataFromTGAFile( unify::Cast< std::wstring >( m_parameters.source.ToString() ).c_str(), texMetadata );
 	}
 	else
 	{
@@ -335,13 +675,87 @@ void Texture::LoadImage( unify::Path filePath )
 
 	if (WIN_FAILED( result ) )
 	{
-		throw unify::Exception( "Failed to load image \"" + m_parameters.source.ToString() + "\"!" );
+		throw unify::Exception( "Failed to load image metadata \"" + m_parameters.source.ToString() + "\"!" );
+	}
+
+	m_fileSize.width = (unsigned int)texMetadata.width;
+	m_fileSize.height = (unsigned int)texMetadata.height;
+	m_fileMipLevels = (unsigned int)texMetadata.mipLevels;
+
+	// Once created, these describe the texture as created, which may differ from the file.
+	if ( ! m_created )
+	{
+		m_format = texMetadata.format;
+		m_parameters.format = ToFormat( texMetadata.format );
+		m_parameters.size = unify::Size< size_t >( texMetadata.width, texMetadata.height );
+
+		m_imageSize.width = m_fileSize.width;
+		m_imageSize.height = m_fileSize.height;
+	}
+}
+
+void Texture::DecodeImage( unify::Path filePath )
+{
+	// Verify file exists
+	if ( !filePath.Exists() )
+	{
+		throw unify::Exception( "Failed to load image, file not found! (" + filePath.ToString() + ")" );
 	}
 
+	HRESULT result = S_OK;
+
+	DirectX::TexMetadata texMetadata{};
+
+	if ( filePath.IsExtension( "DDS" ) )
+	{
+		result = DirectX::LoadFromDDSFile( unify::Cast< std::wstring >( filePath.ToString() ).c_str(), DirectX::DDS_FLAGS::DDS_FLAGS_NONE, &texMetadata, m_decoded );
+	}
+	else if ( filePath.IsExtension( "BMP" ) || filePath.IsExtension( "JPG" ) || filePath.IsExtension( "JPEG" ) || filePath.IsExtension( "TIFF" ) || filePath.IsExtension( "TIF" ) || filePath.IsExtension( "HDP" ) || filePath.IsExtension( "PNG" ) )
+	{
+		result = DirectX::LoadFromWICFile( unify::Cast< std::wstring >( filePath.ToString() ).c_str(), DirectX::WIC_FLAGS::WIC_FLAGS_NONE, &texMetadata, m_decoded );
+	}
+	else if ( filePath.IsExtension( "TGA" ) )
+	{
+		result = DirectX::LoadFromTGAFile( unify::Cast< std::wstring >( filePath.ToString() ).c_str(), &texMetadata, m_decoded );
+	}
+	else
+	{
+		throw unify::Exception( "File format for \"" + filePath.ToString() + "\" not supported!" );
+	}
+
+	if (WIN_FAILED( result ) )
+	{
+		m_decoded.Release();
+		throw unify::Exception( "Failed to load image \"" + filePath.ToString() + "\"!" );
+	}
+
+	m_fileSize.width = (unsigned int)texMetadata.width;
+	m_fileSize.height = (unsigned int)texMetadata.height;
+	m_fileMipLevels = (unsigned int)texMetadata.mipLevels;
+}
+
+// Load the actual image file...
+void Texture::LoadImage( unify::Path filePath )
+{
+	auto dxDevice = m_renderer->GetDxDevice();
+
+	// Release any previous texture
+	Destroy();
+
+	// Use the image DecodeBatch decoded, if any, else decode it now.
+	if ( ! m_decoded.GetImageCount() )
+	{
+		DecodeImage( filePath );
+	}
+	m_scratch = std::move( m_decoded );
+
+	HRESULT result = S_OK;
+
 	UINT width = (UINT)m_scratch.GetImage( 0, 0, 0 )->width;
 	UINT height = (UINT)m_scratch.GetImage( 0, 0, 0 )->height;
 
-	m_parameters.format = unify::Cast< me::render::Format::TYPE >( m_scratch.GetImage( 0, 0, 0 )->format );
+	m_format = m_scratch.GetImage( 0, 0, 0 )->format;
+	m_parameters.format = ToFormat( m_format );
 
 	D3D11_SUBRESOURCE_DATA data{};
 	data.pSysMem = m_scratch.GetImage( 0, 0, 0 )->pixels;
@@ -371,6 +785,17 @@ void Texture::LoadImage( unify::Path filePath )
 		}
 	}
 
+	// Locks are served from our CPU copy, only dynamic and staging textures are written to directly.
+	D3D11_USAGE usage = unify::Cast< D3D11_USAGE >( m_parameters.usage );
+	if ( usage == D3D11_USAGE_DEFAULT || usage == D3D11_USAGE_IMMUTABLE )
+	{
+		cpuAccess = 0;
+	}
+	else if ( usage == D3D11_USAGE_DYNAMIC )
+	{
+		cpuAccess = D3D11_CPU_ACCESS_WRITE;
+	}
+
 	UINT bindFlags {};
 	bindFlags = D3D11_BIND_SHADER_RESOURCE;
 
@@ -384,7 +809,7 @@ void Texture::LoadImage( unify::Path filePath )
 	textureDesc.Format = m_scratch.GetImage( 0, 0, 0 )->format;
 	textureDesc.SampleDesc.Count = 1;
 	textureDesc.SampleDesc.Quality = 0;
-	textureDesc.Usage = unify::Cast< D3D11_USAGE >( m_parameters.usage );
+	textureDesc.Usage = usage;
 	textureDesc.BindFlags = bindFlags;
 	textureDesc.CPUAccessFlags = cpuAccess;
 	textureDesc.MiscFlags = 0;
@@ -395,71 +820,17 @@ void Texture::LoadImage( unify::Path filePath )
 		throw unify::Exception( "Failed to create from file image\"" + filePath.ToString() + "\"!" );
 	}
 
-	D3D11_SAMPLER_DESC colorMapDesc{};
-	colorMapDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
-	colorMapDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
-	colorMapDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
-	colorMapDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
-
-	if ( m_parameters.min == Filtering::Point && m_parameters.mag == Filtering::Point && m_parameters.mip == Filtering::Point )
-	{
-		colorMapDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_POINT;
-	}
-	else if ( m_parameters.min == Filtering::Point && m_parameters.mag == Filtering::Point && m_parameters.mip == Filtering::Linear )
-	{
-		colorMapDesc.Filter = D3D11_FILTER_MIN_MAG_POINT_MIP_LINEAR;
-	}
-	else if ( m_parameters.min == Filtering::Point && m_parameters.mag == Filtering::Linear && m_parameters.mip == Filtering::Point )
-	{
-		colorMapDesc.Filter = D3D11_FILTER_MIN_POINT_MAG_LINEAR_MIP_POINT;
-	}
-	else if ( m_parameters.min == Filtering::Point && m_parameters.mag == Filtering::Linear && m_parameters.mip == Filtering::Linear )
-	{
-		colorMapDesc.Filter = D3D11_FILTER_MIN_POINT_MAG_MIP_LINEAR;
-	}
-	else if ( m_parameters.min == Filtering::Linear && m_parameters.mag == Filtering::Point && m_parameters.mip == Filtering::Point )
-	{
-		colorMapDesc.Filter = D3D11_FILTER_MIN_LINEAR_MAG_MIP_POINT;
-	}
-	else if ( m_parameters.min == Filtering::Linear && m_parameters.mag == Filtering::Point && m_parameters.mip == Filtering::Linear )
-	{
-		colorMapDesc.Filter = D3D11_FILTER_MIN_LINEAR_MAG_POINT_MIP_LINEAR;
-	}
-	else if ( m_parameters.min == Filtering::Linear && m_parameters.mag == Filtering::Linear && m_parameters.mip == Filtering::Point )
+	if ( HasCPUAccess( m_parameters.lockAccess.cpu ) )
 	{
-		colorMapDesc.Filter = D3D11_FILTER_MIN_MAG_LINEAR_MIP_POINT;
-	}
-	else if ( m_parameters.min == Filtering::Linear && m_parameters.mag == Filtering::Linear && m_parameters.mip == Filtering::Linear )
-	{
-		colorMapDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+		m_dirtyRects.resize( textureDesc.MipLevels );
 	}
-	else if ( m_parameters.min == Filtering::Anisotropic && m_parameters.mag == Filtering::Anisotropic && m_parameters.mip == Filtering::Anisotropic )
-	{
-		colorMapDesc.Filter = D3D11_FILTER_ANISOTROPIC;
-	}									
 	else
 	{
-		throw unify::Exception( "Bad filtering combination!" );
+		// Nothing can lock us, so there is no reason to hold onto a second copy of the image.
+		m_scratch.Release();
 	}
 
-	colorMapDesc.MipLODBias = 0.0f;
-	colorMapDesc.BorderColor[0] = 0;
-	colorMapDesc.BorderColor[1] = 0;
-	colorMapDesc.BorderColor[2] = 0;
-	colorMapDesc.BorderColor[3] = 0;
-	colorMapDesc.MinLOD = 0;
-	colorMapDesc.MaxLOD = D3D11_FLOAT32_MAX;
-	result = dxDevice->CreateSamplerState( &colorMapDesc, &m_colorMapSampler );
-	assert( !WIN_FAILED( result ) );
-
-	D3D11_SHADER_RESOURCE_VIEW_DESC textureResourceDesc{};
-	textureResourceDesc.Format = textureDesc.Format;
-	textureResourceDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-	textureResourceDesc.Texture2D.MipLevels = 1;
-	textureResourceDesc.Texture2D.MostDetailedMip = 0;
-
-	result = dxDevice->CreateShaderResourceView( m_texture, &textureResourceDesc, &m_colorMap );
-	assert( !WIN_FAILED( result ) );
+	CreateSamplerAndView( textureDesc.Format );
 
 	m_imageSize.width = width;
 	m_imageSize.height = height;
@@ -482,8 +853,22 @@ const TextureParameters * Texture::GetParameters() const
 
 bool Texture::Reload()
 {
+	// The reloaded image may differ in size or format, and so belong in another array.
+	auto pool = m_renderer->GetTextureArrayPool();
+	bool pooled = m_arraySlice != -1;
+	if ( pooled )
+	{
+		pool->Remove( this );
+	}
+
+	m_decoded.Release(); // The file may have changed since it was decoded.
 	Destroy();
 	Create();
+
+	if ( pooled )
+	{
+		pool->Add( this );
+	}
 	return true;
 }
 
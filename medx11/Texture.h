@@ -15,6 +15,7 @@
 
 #include <string>
 #include <memory>
+#include <vector>
 
 #include <atlbase.h>
 #include <cstdint>
@@ -50,33 +51,88 @@ namespace medx11
 #define SPRITEANIMLOOP_REPEAT		1	// 1 loop period
 #define SPRITEANIMLOOP_FORWARDBACK	2	// 2 loop periods
 
+	class TextureAtlas;
+
 	class Texture : public me::render::ITexture
 	{
 		friend class Renderer;
+		friend class TextureAtlas;
+		friend class TextureArrayPool;
 
 	public:
 		static bool s_allowTextureUses;
 
+		/// <summary>
+		/// Record the parameters and probe the file's header. The texture is created on first use, or by Create.
+		/// </summary>
 		Texture( me::render::IRenderer * renderer, me::render::TextureParameters parameters = me::render::TextureParameters() );
+
+		/// <summary>
+		/// Adopt an existing Direct-X texture, such as an atlas page. Having no source, it cannot be reloaded.
+		/// </summary>
+		Texture( me::render::IRenderer * renderer, ID3D11Texture2D * texture, me::render::TextureParameters parameters = me::render::TextureParameters() );
 		virtual ~Texture();
 
+		/// <summary>
+		/// Preload a batch of textures, probing their file headers in parallel. No pixels are decoded.
+		/// </summary>
+		static void PreloadBatch( const std::vector< Texture * > & textures );
+
+		/// <summary>
+		/// Decode a batch of textures' files in parallel, ahead of their first use, which then only uploads them. The
+		/// decoded images are held in memory until then, so only decode what is about to be drawn.
+		/// </summary>
+		static void DecodeBatch( const std::vector< Texture * > & textures );
+
 		// ::Resource...
 		void Preload();
 		void Create();
 		void Destroy();
 
+		/// <summary>
+		/// Returns true if the texture has a graphical footprint (it has not been destroyed).
+		/// </summary>
+		bool IsCreated() const;
+
+		/// <summary>
+		/// Returns true if the texture can be destroyed and later re-created from its source without losing data.
+		/// </summary>
+		bool IsEvictable() const;
+
+		/// <summary>
+		/// Size of the texture's image data, in bytes, on the GPU.
+		/// </summary>
+		size_t GetSizeInBytes() const;
+
+		/// <summary>
+		/// Our slice within a shared texture array (see TextureArrayPool), or -1 if we are not pooled.
+		/// The slice is passed as per-instance data (see Renderer::RenderPooled), to select the texture within the array.
+		/// Reloading re-adds us to the pool, possibly at another slice.
+		/// </summary>
+		int GetArraySlice() const;
+
 		const unsigned int FileWidth() const;
 	
 		const unsigned int FileHeight() const;
 
+		const unsigned int FileMipLevels() const;
+
 	public: // me::render::ITexture
 		
 		const unify::Size< unsigned int > & ImageSize() const override;
 
 		me::render::TextureLockAccess GetLockAccess() const override;
 
+		/// <summary>
+		/// Lock a region of a level, served from our CPU copy of the image. Rects written through write locks are
+		/// tracked, and only they are uploaded on UnlockRect. For block compressed formats the rect is widened to
+		/// whole blocks, with pBits pointing at the first block, and bpp holding the bytes per block.
+		/// </summary>
 		void LockRect( unsigned int level, me::render::TextureLock & lock, const unify::Rect< long > * rect, unify::DataLockAccess::TYPE access );
 		
+		/// <summary>
+		/// Upload the rects written to a level since its last unlock.
+		/// </summary>
 		void UnlockRect( unsigned int level );
 
 		me::render::SpriteDictionary & GetSpriteDictionary() override;
@@ -98,7 +154,17 @@ namespace medx11
 		void CreateFromSize();
 
 		/// <summary>
-		/// Load an image from a path.
+		/// Create the sampler and shader resource view for our texture.
+		/// </summary>
+		void CreateSamplerAndView( DXGI_FORMAT format );
+
+		/// <summary>
+		/// Decode an image file into m_decoded, without touching the device, so it can run on any thread.
+		/// </summary>
+		void DecodeImage( unify::Path filePath );
+
+		/// <summary>
+		/// Load an image from a path, using the image already decoded by DecodeBatch if there is one.
 		/// </summary>
 		void LoadImage( unify::Path filePath );
 
@@ -107,17 +173,45 @@ namespace medx11
 		/// </summar>
 		void LoadHeader();
 
+		/// <summary>
+		/// Read the image's dimensions, format and mip count from the file's header, without decoding pixels. The format
+		/// and size parameters are left alone once created.
+		/// </summary>
+		void LoadMetadata();
+
+		/// <summary>
+		/// Record a written region of a level, merging it with any region it overlaps or touches.
+		/// </summary>
+		void AddDirtyRect( unsigned int level, D3D11_BOX box );
+
+		/// <summary>
+		/// Upload a level's dirty regions from our CPU copy, and carry them over to any pooled or atlased copy of us.
+		/// </summary>
+		void FlushDirtyRects( unsigned int level );
+
+		/// <summary>
+		/// Called by the renderer as it is destroyed before us. Releases our graphical footprint and forgets the
+		/// renderer, so that releasing us later doesn't call back into it.
+		/// </summary>
+		void Detach();
+
 		const Renderer * m_renderer;						   
 		CComPtr< ID3D11Texture2D > m_texture;
 		CComPtr< ID3D11SamplerState > m_colorMapSampler;
 		CComPtr< ID3D11ShaderResourceView > m_colorMap;
 		bool m_created;
 		unify::Size< unsigned int > m_fileSize;
+		unsigned int m_fileMipLevels;
+		int m_arraySlice;
 		unify::Size< unsigned int > m_imageSize;
 		bool m_useColorKey;
 		unify::Color m_colorKey;
 		me::render::TextureParameters m_parameters;
-		DirectX::ScratchImage m_scratch;	
+		DXGI_FORMAT m_format; // Exact format, as m_parameters.format can't express every one (such as BC1 sRGB).
+		DirectX::ScratchImage m_scratch; // CPU copy of the image, only kept for lockable textures.
+		DirectX::ScratchImage m_decoded; // Decoded by DecodeBatch, waiting to be uploaded.
+		std::vector< std::vector< D3D11_BOX > > m_dirtyRects; // Per level.
+		std::vector< TextureAtlas * > m_atlases; // Atlases with a copy of us, maintained by TextureAtlas.
 		me::render::SpriteDictionary m_spriteDictionary;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,175 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#include <medx11/TextureArrayPool.h>
+#include <medx11/Texture.h>
+#include <me/exception/FailedToCreate.h>
+#include <algorithm>
+
+using namespace medx11;
+using namespace me;
+using namespace render;
+
+bool TextureArrayPool::Key::operator<( const Key & key ) const
+{
+	if ( width != key.width ) return width < key.width;
+	if ( height != key.height ) return height < key.height;
+	return format < key.format;
+}
+
+TextureArrayPool::TextureArrayPool( Renderer * renderer, size_t initialCapacity )
+	: m_renderer{ renderer }
+	, m_initialCapacity{ initialCapacity }
+{
+}
+
+TextureArrayPool::~TextureArrayPool()
+{
+	// Our array textures call back into Remove as they are destroyed.
+	m_pooled.clear();
+	m_arrays.clear();
+}
+
+size_t TextureArrayPool::Add( Texture * texture )
+{
+	if ( m_pooled.find( texture ) != m_pooled.end() )
+	{
+		return (size_t)texture->GetArraySlice();
+	}
+
+	if ( ! texture->IsCreated() )
+	{
+		texture->Create();
+	}
+
+	D3D11_TEXTURE2D_DESC textureDesc{};
+	texture->m_texture->GetDesc( &textureDesc );
+
+	Key key{ textureDesc.Width, textureDesc.Height, textureDesc.Format };
+	Array & array = m_arrays[ key ];
+
+	auto freeSlice = std::find( array.slices.begin(), array.slices.end(), nullptr );
+	if ( freeSlice == array.slices.end() )
+	{
+		Grow( key, array );
+		freeSlice = std::find( array.slices.begin(), array.slices.end(), nullptr );
+	}
+
+	size_t slice = freeSlice - array.slices.begin();
+	array.slices[ slice ] = texture;
+
+	auto dxContext = m_renderer->GetDxContext();
+	dxContext->CopySubresourceRegion( array.texture, D3D11CalcSubresource( 0, (UINT)slice, 1 ), 0, 0, 0, texture->m_texture, 0, nullptr );
+
+	texture->m_arraySlice = (int)slice;
+	m_pooled[ texture ] = key;
+	return slice;
+}
+
+void TextureArrayPool::Remove( Texture * texture )
+{
+	auto itr = m_pooled.find( texture );
+	if ( itr == m_pooled.end() )
+	{
+		return;
+	}
+
+	Array & array = m_arrays[ itr->second ];
+	array.slices[ texture->GetArraySlice() ] = nullptr;
+	texture->m_arraySlice = -1;
+	m_pooled.erase( itr );
+}
+
+void TextureArrayPool::Update( Texture * texture, const D3D11_BOX & box )
+{
+	auto itr = m_pooled.find( texture );
+	if ( itr == m_pooled.end() )
+	{
+		return;
+	}
+
+	Array & array = m_arrays[ itr->second ];
+	UINT subresource = D3D11CalcSubresource( 0, (UINT)texture->GetArraySlice(), 1 );
+	m_renderer->GetDxContext()->CopySubresourceRegion( array.texture, subresource, box.left, box.top, 0, texture->m_texture, 0, &box );
+}
+
+ITexture::ptr TextureArrayPool::GetArray( const Texture * texture ) const
+{
+	auto itr = m_pooled.find( texture );
+	if ( itr == m_pooled.end() )
+	{
+		return ITexture::ptr();
+	}
+
+	return m_arrays.find( itr->second )->second.view;
+}
+
+void TextureArrayPool::Use( const Texture * texture ) const
+{
+	ITexture::ptr array = GetArray( texture );
+	if ( ! array )
+	{
+		return;
+	}
+
+	ID3D11ShaderResourceView * view = static_cast< Texture * >( array.get() )->m_colorMap;
+	m_renderer->GetDxContext()->PSSetShaderResources( Slot, 1, &view );
+}
+
+TextureArrayPool::Stats TextureArrayPool::GetStats() const
+{
+	Stats stats{};
+	stats.arrays = m_arrays.size();
+	stats.slices = m_pooled.size();
+	for ( auto && array : m_arrays )
+	{
+		stats.capacity += array.second.slices.size();
+	}
+	return stats;
+}
+
+void TextureArrayPool::Grow( const Key & key, Array & array )
+{
+	size_t capacity = array.slices.empty() ? m_initialCapacity : array.slices.size() * 2;
+	capacity = (std::min)( capacity, (size_t)D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION );
+	if ( capacity <= array.slices.size() )
+	{
+		throw exception::FailedToCreate( "Texture array is full, can not grow beyond " + unify::Cast< std::string >( array.slices.size() ) + " slices!" );
+	}
+
+	auto dxDevice = m_renderer->GetDxDevice();
+	auto dxContext = m_renderer->GetDxContext();
+
+	D3D11_TEXTURE2D_DESC textureDesc{};
+	textureDesc.Width = key.width;
+	textureDesc.Height = key.height;
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = (UINT)capacity;
+	textureDesc.Format = key.format;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.SampleDesc.Quality = 0;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	textureDesc.CPUAccessFlags = 0;
+	textureDesc.MiscFlags = 0;
+
+	CComPtr< ID3D11Texture2D > texture;
+	HRESULT result = dxDevice->CreateTexture2D( &textureDesc, nullptr, &texture );
+	if ( WIN_FAILED( result ) )
+	{
+		throw exception::FailedToCreate( "Failed to create texture array of " + unify::Cast< std::string >( capacity ) + " slices!" );
+	}
+
+	// Carry existing slices over GPU-side, their source textures may have since been evicted.
+	for ( size_t slice = 0; slice < array.slices.size(); slice++ )
+	{
+		if ( ! array.slices[ slice ] ) continue;
+
+		UINT subresource = D3D11CalcSubresource( 0, (UINT)slice, 1 );
+		dxContext->CopySubresourceRegion( texture, subresource, 0, 0, 0, array.texture, subresource, nullptr );
+	}
+
+	array.texture = texture;
+	array.view = ITexture::ptr( new Texture( m_renderer, texture ) );
+	array.slices.resize( capacity, nullptr );
+}
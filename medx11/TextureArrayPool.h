@@ -0,0 +1,106 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#pragma once
+
+#include <medx11/Renderer.h>
+#include <me/render/ITexture.h>
+#include <unify/Matrix.h>
+#include <atlbase.h>
+#include <vector>
+#include <map>
+#include <memory>
+#include <cstdint>
+
+namespace medx11
+{
+	class Texture;
+
+	/// <summary>
+	/// Per-instance data of a pooled draw (see Renderer::RenderPooled), read by SV_InstanceID as with RenderStructured.
+	/// </summary>
+	struct PooledInstance
+	{
+		unify::Matrix world;
+		uint32_t slice; // Slice of the texture array bound at TextureArrayPool::Slot, from Texture::GetArraySlice.
+		uint32_t padding[ 3 ];
+	};
+
+	/// <summary>
+	/// Shares Texture2DArrays between textures of matching size and format, each texture being copied into a slice.
+	/// Draws that differ only by texture can then bind the array once, and select the slice per instance.
+	/// Once pooled, a texture is only drawn through its array, so the texture residency manager is free to evict the
+	/// original.
+	/// </summary>
+	class TextureArrayPool
+	{
+	public:
+		/// <summary>
+		/// Where Use binds an array for the pixel shader, below the slots SkinningPalette and VertexPuller use.
+		/// </summary>
+		static const UINT Slot = Renderer::InstanceDataSlot - 5;
+
+		struct Stats
+		{
+			size_t arrays;
+			size_t slices;
+			size_t capacity;
+		};
+
+		TextureArrayPool( Renderer * renderer, size_t initialCapacity = 16 );
+		~TextureArrayPool();
+
+		/// <summary>
+		/// Copy a texture into a slice of the array matching its size and format, growing the array if needed.
+		/// Returns the slice index, also available from Texture::GetArraySlice.
+		/// </summary>
+		size_t Add( Texture * texture );
+
+		/// <summary>
+		/// Release a texture's slice for reuse. Does nothing if the texture is not pooled.
+		/// </summary>
+		void Remove( Texture * texture );
+
+		/// <summary>
+		/// Copy a region of a pooled texture's top level, written since it was added, into its slice.
+		/// </summary>
+		void Update( Texture * texture, const D3D11_BOX & box );
+
+		/// <summary>
+		/// Returns the array texture holding a pooled texture, or null if the texture is not pooled.
+		/// Growing an array replaces its texture, so fetch it after adding textures.
+		/// </summary>
+		me::render::ITexture::ptr GetArray( const Texture * texture ) const;
+
+		/// <summary>
+		/// Bind the array holding a pooled texture to Slot of the pixel shader.
+		/// </summary>
+		void Use( const Texture * texture ) const;
+
+		Stats GetStats() const;
+
+	private:
+		struct Key
+		{
+			unsigned int width;
+			unsigned int height;
+			DXGI_FORMAT format;
+
+			bool operator<( const Key & key ) const;
+		};
+
+		struct Array
+		{
+			CComPtr< ID3D11Texture2D > texture;
+			me::render::ITexture::ptr view;
+			std::vector< const Texture * > slices; // Null for free slices.
+		};
+
+		void Grow( const Key & key, Array & array );
+
+		Renderer * m_renderer;
+		size_t m_initialCapacity;
+		std::map< Key, Array > m_arrays;
+		std::map< const Texture *, Key > m_pooled;
+	};
+}
\ No newline at end of file
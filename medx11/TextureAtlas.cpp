@@ -0,0 +1,389 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#include <medx11/TextureAtlas.h>
+#include <me/exception/FailedToCreate.h>
+#include <algorithm>
+#include <climits>
+
+using namespace medx11;
+using namespace me;
+using namespace render;
+
+namespace
+{
+	/// <summary>
+	/// Bottom-left skyline packer, the skyline being a list of horizontal segments covering the page's width.
+	/// </summary>
+	class Skyline
+	{
+	public:
+		Skyline( unsigned int size )
+			: m_size{ size }
+			, m_nodes{ Node{ 0, 0, size } }
+		{
+		}
+
+		bool Insert( unsigned int width, unsigned int height, unsigned int & x, unsigned int & y )
+		{
+			size_t bestIndex = m_nodes.size();
+			unsigned int bestBottom = UINT_MAX;
+			unsigned int bestWidth = UINT_MAX;
+			unsigned int bestTop = 0;
+
+			for ( size_t i = 0; i < m_nodes.size(); i++ )
+			{
+				unsigned int top = 0;
+				if ( ! Fits( i, width, height, top ) ) continue;
+
+				// Prefer the lowest placement, then the tightest segment.
+				if ( top + height < bestBottom || ( top + height == bestBottom && m_nodes[i].width < bestWidth ) )
+				{
+					bestIndex = i;
+					bestBottom = top + height;
+					bestWidth = m_nodes[i].width;
+					bestTop = top;
+				}
+			}
+
+			if ( bestIndex == m_nodes.size() )
+			{
+				return false;
+			}
+
+			x = m_nodes[bestIndex].x;
+			y = bestTop;
+			m_nodes.insert( m_nodes.begin() + bestIndex, Node{ x, y + height, width } );
+
+			// Shrink or remove the segments now under the new one.
+			for ( size_t i = bestIndex + 1; i < m_nodes.size(); )
+			{
+				unsigned int previousEnd = m_nodes[i - 1].x + m_nodes[i - 1].width;
+				if ( m_nodes[i].x >= previousEnd ) break;
+
+				unsigned int shrink = previousEnd - m_nodes[i].x;
+				if ( m_nodes[i].width <= shrink )
+				{
+					m_nodes.erase( m_nodes.begin() + i );
+					continue;
+				}
+
+				m_nodes[i].x += shrink;
+				m_nodes[i].width -= shrink;
+				break;
+			}
+
+			// Merge neighboring segments at the same height.
+			for ( size_t i = 0; i + 1 < m_nodes.size(); )
+			{
+				if ( m_nodes[i].y == m_nodes[i + 1].y )
+				{
+					m_nodes[i].width += m_nodes[i + 1].width;
+					m_nodes.erase( m_nodes.begin() + i + 1 );
+				}
+				else
+				{
+					i++;
+				}
+			}
+
+			return true;
+		}
+
+	private:
+		struct Node
+		{
+			unsigned int x;
+			unsigned int y;
+			unsigned int width;
+		};
+
+		bool Fits( size_t index, unsigned int width, unsigned int height, unsigned int & top ) const
+		{
+			if ( m_nodes[index].x + width > m_size )
+			{
+				return false;
+			}
+
+			top = 0;
+			unsigned int remaining = width;
+			for ( size_t i = index; remaining > 0 && i < m_nodes.size(); i++ )
+			{
+				top = (std::max)( top, m_nodes[i].y );
+				if ( top + height > m_size )
+				{
+					return false;
+				}
+				remaining -= (std::min)( remaining, m_nodes[i].width );
+			}
+			return true;
+		}
+
+		unsigned int m_size;
+		std::vector< Node > m_nodes;
+	};
+}
+
+TextureAtlas::TextureAtlas( Renderer * renderer, unsigned int pageSize, unsigned int padding )
+	: m_renderer{ renderer }
+	, m_pageSize{ pageSize }
+	, m_padding{ padding }
+	, m_skipped{ 0 }
+	, m_usedPixels{ 0 }
+{
+}
+
+TextureAtlas::~TextureAtlas()
+{
+	Detach();
+}
+
+void TextureAtlas::Add( Texture * texture )
+{
+	m_textures.push_back( texture );
+}
+
+void TextureAtlas::Remove( Texture * texture )
+{
+	m_textures.erase( std::remove( m_textures.begin(), m_textures.end(), texture ), m_textures.end() );
+	m_placements.erase( texture );
+	texture->m_atlases.erase( std::remove( texture->m_atlases.begin(), texture->m_atlases.end(), this ), texture->m_atlases.end() );
+}
+
+void TextureAtlas::Update( Texture * texture, const D3D11_BOX & box )
+{
+	const Placement * placement = Find( texture );
+	if ( ! placement )
+	{
+		return;
+	}
+
+	ID3D11Texture2D * page = static_cast< Texture * >( m_pages[ placement->page ].get() )->m_texture;
+	UINT width = (UINT)( placement->rect.right - placement->rect.left );
+	UINT height = (UINT)( placement->rect.bottom - placement->rect.top );
+
+	// Edge pixels are replicated into the padding, so a region touching an edge copies the whole placement again.
+	if ( box.left == 0 || box.top == 0 || box.right >= width || box.bottom >= height )
+	{
+		CopyIntoPage( page, texture, *placement );
+		return;
+	}
+
+	m_renderer->GetDxContext()->CopySubresourceRegion( page, 0, (UINT)placement->rect.left + box.left, (UINT)placement->rect.top + box.top, 0, texture->m_texture, 0, &box );
+}
+
+void TextureAtlas::Detach()
+{
+	for ( auto && placed : m_placements )
+	{
+		Texture * texture = const_cast< Texture * >( placed.first );
+		texture->m_atlases.erase( std::remove( texture->m_atlases.begin(), texture->m_atlases.end(), this ), texture->m_atlases.end() );
+	}
+}
+
+void TextureAtlas::Build()
+{
+	Detach();
+	m_pages.clear();
+	m_placements.clear();
+	m_skipped = 0;
+	m_usedPixels = 0;
+
+	auto dxDevice = m_renderer->GetDxDevice();
+
+	// Pages hold a single format, so group textures by format.
+	std::map< DXGI_FORMAT, std::vector< Texture * > > byFormat;
+	for ( auto && texture : m_textures )
+	{
+		if ( ! texture->IsCreated() )
+		{
+			texture->Create();
+		}
+
+		D3D11_TEXTURE2D_DESC textureDesc{};
+		texture->m_texture->GetDesc( &textureDesc );
+
+		// Block compressed formats can't have single pixel padding replicated, and oversized textures gain nothing.
+		if ( DirectX::IsCompressed( textureDesc.Format ) || textureDesc.Width + m_padding * 2 > m_pageSize || textureDesc.Height + m_padding * 2 > m_pageSize )
+		{
+			m_skipped++;
+			continue;
+		}
+
+		byFormat[ textureDesc.Format ].push_back( texture );
+	}
+
+	for ( auto && group : byFormat )
+	{
+		auto & textures = group.second;
+
+		// Tallest first packs tighter with a skyline.
+		std::sort( textures.begin(), textures.end(), []( const Texture * a, const Texture * b )
+		{
+			if ( a->ImageSize().height != b->ImageSize().height ) return a->ImageSize().height > b->ImageSize().height;
+			return a->ImageSize().width > b->ImageSize().width;
+		} );
+
+		std::vector< Skyline > skylines;
+		size_t firstPage = m_pages.size();
+		for ( auto && texture : textures )
+		{
+			unsigned int width = texture->ImageSize().width + m_padding * 2;
+			unsigned int height = texture->ImageSize().height + m_padding * 2;
+			unsigned int x = 0;
+			unsigned int y = 0;
+
+			size_t page = 0;
+			for ( ; page < skylines.size(); page++ )
+			{
+				if ( skylines[page].Insert( width, height, x, y ) ) break;
+			}
+
+			if ( page == skylines.size() )
+			{
+				skylines.push_back( Skyline( m_pageSize ) );
+				skylines.back().Insert( width, height, x, y );
+			}
+
+			Placement placement{};
+			placement.page = firstPage + page;
+			placement.rect.left = (long)( x + m_padding );
+			placement.rect.top = (long)( y + m_padding );
+			placement.rect.right = placement.rect.left + (long)texture->ImageSize().width;
+			placement.rect.bottom = placement.rect.top + (long)texture->ImageSize().height;
+			placement.uOffset = (float)placement.rect.left / m_pageSize;
+			placement.vOffset = (float)placement.rect.top / m_pageSize;
+			placement.uScale = (float)texture->ImageSize().width / m_pageSize;
+			placement.vScale = (float)texture->ImageSize().height / m_pageSize;
+			m_placements[ texture ] = placement;
+			texture->m_atlases.push_back( this );
+			m_usedPixels += (size_t)width * height;
+		}
+
+		for ( size_t page = 0; page < skylines.size(); page++ )
+		{
+			D3D11_TEXTURE2D_DESC pageDesc{};
+			pageDesc.Width = m_pageSize;
+			pageDesc.Height = m_pageSize;
+			pageDesc.MipLevels = 1;
+			pageDesc.ArraySize = 1;
+			pageDesc.Format = group.first;
+			pageDesc.SampleDesc.Count = 1;
+			pageDesc.SampleDesc.Quality = 0;
+			pageDesc.Usage = D3D11_USAGE_DEFAULT;
+			pageDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+			pageDesc.CPUAccessFlags = 0;
+			pageDesc.MiscFlags = 0;
+
+			CComPtr< ID3D11Texture2D > pageTexture;
+			HRESULT result = dxDevice->CreateTexture2D( &pageDesc, nullptr, &pageTexture );
+			if ( WIN_FAILED( result ) )
+			{
+				throw exception::FailedToCreate( "Failed to create texture atlas page of size " + unify::Cast< std::string >( m_pageSize ) + "x" + unify::Cast< std::string >( m_pageSize ) + "!" );
+			}
+
+			for ( auto && texture : textures )
+			{
+				const Placement & placement = m_placements[ texture ];
+				if ( placement.page == firstPage + page )
+				{
+					CopyIntoPage( pageTexture, texture, placement );
+				}
+			}
+
+			m_pages.push_back( ITexture::ptr( new Texture( m_renderer, pageTexture ) ) );
+		}
+	}
+}
+
+void TextureAtlas::CopyIntoPage( ID3D11Texture2D * page, Texture * texture, const Placement & placement )
+{
+	auto dxContext = m_renderer->GetDxContext();
+	ID3D11Texture2D * source = texture->m_texture;
+
+	UINT x = (UINT)placement.rect.left;
+	UINT y = (UINT)placement.rect.top;
+	UINT width = (UINT)( placement.rect.right - placement.rect.left );
+	UINT height = (UINT)( placement.rect.bottom - placement.rect.top );
+
+	D3D11_BOX box{ 0, 0, 0, width, height, 1 };
+	dxContext->CopySubresourceRegion( page, 0, x, y, 0, source, 0, &box );
+
+	// Replicate the edges into the padding, so filtering at the border samples the texture's own pixels.
+	for ( UINT p = 1; p <= m_padding; p++ )
+	{
+		D3D11_BOX left{ 0, 0, 0, 1, height, 1 };
+		dxContext->CopySubresourceRegion( page, 0, x - p, y, 0, source, 0, &left );
+
+		D3D11_BOX right{ width - 1, 0, 0, width, height, 1 };
+		dxContext->CopySubresourceRegion( page, 0, x + width - 1 + p, y, 0, source, 0, &right );
+
+		D3D11_BOX top{ 0, 0, 0, width, 1, 1 };
+		dxContext->CopySubresourceRegion( page, 0, x, y - p, 0, source, 0, &top );
+
+		D3D11_BOX bottom{ 0, height - 1, 0, width, height, 1 };
+		dxContext->CopySubresourceRegion( page, 0, x, y + height - 1 + p, 0, source, 0, &bottom );
+
+		for ( UINT q = 1; q <= m_padding; q++ )
+		{
+			D3D11_BOX topLeft{ 0, 0, 0, 1, 1, 1 };
+			dxContext->CopySubresourceRegion( page, 0, x - p, y - q, 0, source, 0, &topLeft );
+
+			D3D11_BOX topRight{ width - 1, 0, 0, width, 1, 1 };
+			dxContext->CopySubresourceRegion( page, 0, x + width - 1 + p, y - q, 0, source, 0, &topRight );
+
+			D3D11_BOX bottomLeft{ 0, height - 1, 0, 1, height, 1 };
+			dxContext->CopySubresourceRegion( page, 0, x - p, y + height - 1 + q, 0, source, 0, &bottomLeft );
+
+			D3D11_BOX bottomRight{ width - 1, height - 1, 0, width, height, 1 };
+			dxContext->CopySubresourceRegion( page, 0, x + width - 1 + p, y + height - 1 + q, 0, source, 0, &bottomRight );
+		}
+	}
+}
+
+size_t TextureAtlas::GetPageCount() const
+{
+	return m_pages.size();
+}
+
+ITexture::ptr TextureAtlas::GetPage( size_t page ) const
+{
+	return m_pages[ page ];
+}
+
+const TextureAtlas::Placement * TextureAtlas::Find( const Texture * texture ) const
+{
+	auto itr = m_placements.find( texture );
+	if ( itr == m_placements.end() )
+	{
+		return nullptr;
+	}
+	return &itr->second;
+}
+
+bool TextureAtlas::RemapUV( const Texture * texture, float & u, float & v ) const
+{
+	const Placement * placement = Find( texture );
+	if ( ! placement )
+	{
+		return false;
+	}
+
+	u = placement->uOffset + u * placement->uScale;
+	v = placement->vOffset + v * placement->vScale;
+	return true;
+}
+
+TextureAtlas::Stats TextureAtlas::GetStats() const
+{
+	Stats stats{};
+	stats.pages = m_pages.size();
+	stats.textures = m_placements.size();
+	stats.skipped = m_skipped;
+	if ( ! m_pages.empty() )
+	{
+		stats.occupancy = (float)m_usedPixels / ( (float)m_pageSize * m_pageSize * m_pages.size() );
+	}
+	stats.bindsSaved = m_placements.size() - m_pages.size();
+	return stats;
+}
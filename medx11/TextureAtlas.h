@@ -0,0 +1,101 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#pragma once
+
+#include <medx11/Renderer.h>
+#include <medx11/Texture.h>
+#include <unify/Rect.h>
+#include <vector>
+#include <map>
+
+namespace medx11
+{
+	/// <summary>
+	/// Packs many small textures into a few large pages, so that sprites and UI elements drawn from different textures
+	/// can share a single bind. Pages are packed with a skyline packer, with edge pixels replicated into padding to
+	/// keep filtering from bleeding between neighbors.
+	/// </summary>
+	class TextureAtlas
+	{
+	public:
+		/// <summary>
+		/// Where a texture ended up within the atlas.
+		/// </summary>
+		struct Placement
+		{
+			size_t page;
+			unify::Rect< long > rect; // In pixels, excluding padding.
+			float uOffset;
+			float vOffset;
+			float uScale;
+			float vScale;
+		};
+
+		struct Stats
+		{
+			size_t pages;
+			size_t textures;
+			size_t skipped; // Textures that could not be placed (compressed, or larger than a page).
+			float occupancy; // Ratio of page pixels covered by textures, including padding.
+			size_t bindsSaved; // Texture binds saved when drawing each placed texture once.
+		};
+
+		TextureAtlas( Renderer * renderer, unsigned int pageSize = 2048, unsigned int padding = 2 );
+		~TextureAtlas();
+
+		/// <summary>
+		/// Add a texture to be packed on the next Build.
+		/// </summary>
+		void Add( Texture * texture );
+
+		/// <summary>
+		/// Remove a texture from the atlas. Its pixels stay in its page until the next Build, but it is no longer found.
+		/// </summary>
+		void Remove( Texture * texture );
+
+		/// <summary>
+		/// Copy a region of a placed texture's image, written since the atlas was built, into its page.
+		/// </summary>
+		void Update( Texture * texture, const D3D11_BOX & box );
+
+		/// <summary>
+		/// Pack all added textures into pages, and copy their images into them.
+		/// </summary>
+		void Build();
+
+		size_t GetPageCount() const;
+
+		me::render::ITexture::ptr GetPage( size_t page ) const;
+
+		/// <summary>
+		/// Returns the placement for a texture, or null if it is not in the atlas.
+		/// </summary>
+		const Placement * Find( const Texture * texture ) const;
+
+		/// <summary>
+		/// Remap a texture coordinate, for example a sprite's corner from the texture's SpriteDictionary, into its page.
+		/// Returns false if the texture is not in the atlas, leaving the coordinate untouched.
+		/// </summary>
+		bool RemapUV( const Texture * texture, float & u, float & v ) const;
+
+		Stats GetStats() const;
+
+	private:
+		/// <summary>
+		/// Stop our placed textures from updating us.
+		/// </summary>
+		void Detach();
+
+		void CopyIntoPage( ID3D11Texture2D * page, Texture * texture, const Placement & placement );
+
+		Renderer * m_renderer;
+		unsigned int m_pageSize;
+		unsigned int m_padding;
+		std::vector< Texture * > m_textures;
+		std::vector< me::render::ITexture::ptr > m_pages;
+		std::map< const Texture *, Placement > m_placements;
+		size_t m_skipped;
+		size_t m_usedPixels;
+	};
+}
\ No newline at end of file
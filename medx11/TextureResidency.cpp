@@ -0,0 +1,138 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#include <medx11/TextureResidency.h>
+#include <medx11/Texture.h>
+#include <algorithm>
+#include <vector>
+
+using namespace medx11;
+
+TextureResidency::TextureResidency()
+	: m_budget{ 0 }
+	, m_frame{ 0 }
+	, m_evictions{ 0 }
+	, m_reloads{ 0 }
+{
+}
+
+TextureResidency::~TextureResidency()
+{
+}
+
+void TextureResidency::SetBudget( size_t budgetInBytes )
+{
+	m_budget = budgetInBytes;
+}
+
+size_t TextureResidency::GetBudget() const
+{
+	return m_budget;
+}
+
+void TextureResidency::Add( Texture * texture )
+{
+	m_entries[ texture ] = Entry{ texture->GetSizeInBytes(), m_frame };
+}
+
+void TextureResidency::Remove( Texture * texture )
+{
+	m_entries.erase( texture );
+}
+
+std::vector< Texture * > TextureResidency::GetTextures() const
+{
+	std::vector< Texture * > textures;
+	textures.reserve( m_entries.size() );
+	for ( auto && entry : m_entries )
+	{
+		textures.push_back( entry.first );
+	}
+	return textures;
+}
+
+void TextureResidency::Touch( Texture * texture )
+{
+	auto itr = m_entries.find( texture );
+	if ( itr == m_entries.end() )
+	{
+		return;
+	}
+
+	if ( ! texture->IsCreated() )
+	{
+		texture->Create();
+		m_reloads++;
+	}
+
+	itr->second.bytes = texture->GetSizeInBytes();
+	itr->second.lastUsedFrame = m_frame;
+}
+
+void TextureResidency::BeginFrame()
+{
+	m_frame++;
+	Trim();
+}
+
+void TextureResidency::Trim()
+{
+	if ( m_budget == 0 )
+	{
+		return;
+	}
+
+	size_t residentBytes = 0;
+	std::vector< std::pair< Texture *, Entry > > candidates;
+	for ( auto && entry : m_entries )
+	{
+		if ( ! entry.first->IsCreated() ) continue;
+
+		residentBytes += entry.second.bytes;
+
+		// Textures used during the last frame are likely to be used again, evicting them would only thrash.
+		if ( entry.second.lastUsedFrame + 1 >= m_frame ) continue;
+		if ( ! entry.first->IsEvictable() ) continue;
+
+		candidates.push_back( entry );
+	}
+
+	if ( residentBytes <= m_budget )
+	{
+		return;
+	}
+
+	std::sort( candidates.begin(), candidates.end(), []( const std::pair< Texture *, Entry > & a, const std::pair< Texture *, Entry > & b )
+	{
+		return a.second.lastUsedFrame < b.second.lastUsedFrame;
+	} );
+
+	for ( auto && candidate : candidates )
+	{
+		if ( residentBytes <= m_budget ) break;
+
+		candidate.first->Destroy();
+		residentBytes -= candidate.second.bytes;
+		m_evictions++;
+	}
+}
+
+size_t TextureResidency::GetFrame() const
+{
+	return m_frame;
+}
+
+TextureResidency::Stats TextureResidency::GetStats() const
+{
+	Stats stats{};
+	stats.budget = m_budget;
+	stats.evictions = m_evictions;
+	stats.reloads = m_reloads;
+	for ( auto && entry : m_entries )
+	{
+		if ( ! entry.first->IsCreated() ) continue;
+		stats.residentBytes += entry.second.bytes;
+		stats.residentCount++;
+	}
+	return stats;
+}
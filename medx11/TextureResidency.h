@@ -0,0 +1,79 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+
+namespace medx11
+{
+	class Texture;
+
+	/// <summary>
+	/// Tracks the video memory used by textures, and evicts the least recently used ones when a budget is exceeded.
+	/// Evicted textures keep their header (see Texture::Destroy), and are transparently re-created on their next use.
+	/// </summary>
+	class TextureResidency
+	{
+	public:
+		struct Stats
+		{
+			size_t budget;
+			size_t residentBytes;
+			size_t residentCount;
+			size_t evictions;
+			size_t reloads;
+		};
+
+		TextureResidency();
+		~TextureResidency();
+
+		/// <summary>
+		/// Set the budget, in bytes, for resident textures. A budget of 0 means unlimited.
+		/// </summary>
+		void SetBudget( size_t budgetInBytes );
+		size_t GetBudget() const;
+
+		void Add( Texture * texture );
+		void Remove( Texture * texture );
+
+		/// <summary>
+		/// Every texture added and not yet removed.
+		/// </summary>
+		std::vector< Texture * > GetTextures() const;
+
+		/// <summary>
+		/// Mark a texture as used this frame, re-creating it if it was evicted.
+		/// </summary>
+		void Touch( Texture * texture );
+
+		/// <summary>
+		/// Advance the frame counter, then evict textures until we are within budget.
+		/// </summary>
+		void BeginFrame();
+
+		/// <summary>
+		/// Evict least recently used textures, not used during the last frame, until we are within budget.
+		/// </summary>
+		void Trim();
+
+		size_t GetFrame() const;
+
+		Stats GetStats() const;
+
+	private:
+		struct Entry
+		{
+			size_t bytes;
+			size_t lastUsedFrame;
+		};
+
+		std::unordered_map< Texture *, Entry > m_entries;
+		size_t m_budget;
+		size_t m_frame;
+		size_t m_evictions;
+		size_t m_reloads;
+	};
+}
\ No newline at end of file
@@ -2,17 +2,121 @@
 // All Rights Reserved
 
 #include <medx11/VertexBuffer.h>
+#include <medx11/GeometryHeap.h>
 #include <me/exception/FailedToCreate.h>
 #include <me/exception/FailedToLock.h>
 #include <me/exception/NotImplemented.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <thread>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
 
 using namespace medx11;
 using namespace me;
 using namespace render;
 
+namespace
+{
+	// Below this many vertices a buffer is bounded on one thread.
+	const size_t ParallelThreshold = 1 << 16;
+
+	/// <summary>
+	/// Load x, y and z of a position, without reading past it, with w zero.
+	/// </summary>
+	inline __m128 LoadPosition( const unsigned char * position )
+	{
+		__m128 xy = _mm_castpd_ps( _mm_load_sd( (const double *)position ) );
+		__m128 z = _mm_load_ss( (const float *)position + 2 );
+		return _mm_movelh_ps( xy, z );
+	}
+
+	/// <summary>
+	/// Bounds of count positions, stride bytes apart, four at a time.
+	/// </summary>
+	void MinMax( const unsigned char * positions, size_t stride, size_t count, __m128 & min, __m128 & max )
+	{
+		min = _mm_set1_ps( FLT_MAX );
+		max = _mm_set1_ps( -FLT_MAX );
+		__m128 min2 = min;
+		__m128 max2 = max;
+		size_t i = 0;
+		for ( ; i + 4 <= count; i += 4, positions += stride * 4 )
+		{
+			__m128 a = LoadPosition( positions );
+			__m128 b = LoadPosition( positions + stride );
+			__m128 c = LoadPosition( positions + stride * 2 );
+			__m128 d = LoadPosition( positions + stride * 3 );
+			min = _mm_min_ps( min, _mm_min_ps( a, b ) );
+			max = _mm_max_ps( max, _mm_max_ps( a, b ) );
+			min2 = _mm_min_ps( min2, _mm_min_ps( c, d ) );
+			max2 = _mm_max_ps( max2, _mm_max_ps( c, d ) );
+		}
+
+		for ( ; i < count; i++, positions += stride )
+		{
+			__m128 a = LoadPosition( positions );
+			min = _mm_min_ps( min, a );
+			max = _mm_max_ps( max, a );
+		}
+
+		min = _mm_min_ps( min, min2 );
+		max = _mm_max_ps( max, max2 );
+	}
+
+	/// <summary>
+	/// The largest squared distance from center to count positions, stride bytes apart. Positions are transposed four
+	/// at a time, so the distances are summed across lanes rather than within them.
+	/// </summary>
+	float MaxDistanceSquared( const unsigned char * positions, size_t stride, size_t count, __m128 center )
+	{
+		alignas( 16 ) float c[ 4 ];
+		_mm_store_ps( c, center );
+		const __m128 cx = _mm_set1_ps( c[ 0 ] );
+		const __m128 cy = _mm_set1_ps( c[ 1 ] );
+		const __m128 cz = _mm_set1_ps( c[ 2 ] );
+
+		__m128 farthest = _mm_setzero_ps();
+		size_t i = 0;
+		for ( ; i + 4 <= count; i += 4, positions += stride * 4 )
+		{
+			__m128 x = LoadPosition( positions );
+			__m128 y = LoadPosition( positions + stride );
+			__m128 z = LoadPosition( positions + stride * 2 );
+			__m128 w = LoadPosition( positions + stride * 3 );
+			_MM_TRANSPOSE4_PS( x, y, z, w );
+			x = _mm_sub_ps( x, cx );
+			y = _mm_sub_ps( y, cy );
+			z = _mm_sub_ps( z, cz );
+			farthest = _mm_max_ps( farthest, _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, x ), _mm_mul_ps( y, y ) ), _mm_mul_ps( z, z ) ) );
+		}
+
+		alignas( 16 ) float lanes[ 4 ];
+		_mm_store_ps( lanes, farthest );
+		float result = (std::max)( (std::max)( lanes[ 0 ], lanes[ 1 ] ), (std::max)( lanes[ 2 ], lanes[ 3 ] ) );
+		for ( ; i < count; i++, positions += stride )
+		{
+			const float * position = (const float *)positions;
+			float x = position[ 0 ] - c[ 0 ];
+			float y = position[ 1 ] - c[ 1 ];
+			float z = position[ 2 ] - c[ 2 ];
+			result = (std::max)( result, x * x + y * y + z * z );
+		}
+		return result;
+	}
+}
+
 VertexBuffer::VertexBuffer( IRenderer * renderer )
 	: m_renderer( dynamic_cast< Renderer * >(renderer) )
+	, m_bboxSupplied( false )
+	, m_boundingSphere{}
 	, m_usage( BufferUsage::Default )
+	, m_positionSlot( GeometryHeap::None )
 {
 }
 
@@ -33,6 +137,9 @@ void VertexBuffer::Create( VertexBufferParameters parameters )
 	Destroy();
 
 	m_bbox = parameters.bbox;
+	m_bboxSupplied = ! ( parameters.bbox.inf == unify::BBox< float >().inf && parameters.bbox.sup == unify::BBox< float >().sup );
+	m_boundingSphere = BoundingSphere{};
+	bool bounded = false;
 
 	auto vd = parameters.vertexDeclaration;
 
@@ -70,10 +177,18 @@ void VertexBuffer::Create( VertexBufferParameters parameters )
 			usage = BufferUsage::Dynamic;
 		}
 
+		VertexQuantizer::Layout layout = m_renderer->GetVertexQuantizer()->GetLayout( *vd, slot );
+
 		m_usage.push_back( usage );
 		m_vertexDeclaration = vd;
-		m_strides.push_back( m_vertexDeclaration->GetSizeInBytes( slot ) );
+		m_strides.push_back( layout.stride );
+		m_layouts.push_back( layout );
+		m_shadows.push_back( std::vector< unsigned char >() );
 		m_lengths.push_back( count );
+		m_capacities.push_back( count );
+		m_lockedRanges.push_back( LockedRange{ 0, 0, LockIntent::Discard } );
+		m_streamCursors.push_back( count ); // Full, so the first append discards.
+		m_readBacks.push_back( nullptr );
 
 		// Ensure we have some sort of idea what we need to be...
 		if ( m_strides[slot] * m_lengths[slot] == 0 )
@@ -89,6 +204,41 @@ void VertexBuffer::Create( VertexBufferParameters parameters )
 			throw exception::FailedToCreate( "Vertex buffer is immutable, yet source is null!" );
 		}
 
+		m_locked.push_back( false );
+
+		if ( m_renderer->GetRetainShadows() && source != nullptr && vd->GetInstancing( slot ) == Instancing::None )
+		{
+			RetainPositions( slot, layout, source, count );
+		}
+
+		if ( ! bounded && source != nullptr && vd->GetInstancing( slot ) == Instancing::None )
+		{
+			bounded = ComputeBounds( slot, layout, source, count );
+		}
+
+		// Packed slots are uploaded from a packed copy of the source.
+		std::vector< unsigned char > packed;
+		if ( layout.quantized && source != nullptr )
+		{
+			packed.resize( layout.stride * count );
+			m_renderer->GetVertexQuantizer()->Quantize( layout, source, count, &packed[0] );
+			source = &packed[0];
+		}
+
+		// Static vertex data is suballocated from the geometry heap, instance data and CPU written data keep their own buffer.
+		if ( ( usage == BufferUsage::Default || usage == BufferUsage::Immutable ) && vd->GetInstancing( slot ) == Instancing::None )
+		{
+			m_allocations.push_back( m_renderer->GetGeometryHeap()->Allocate( m_strides[slot], count, source ) );
+			m_buffers.push_back( nullptr );
+			continue;
+		}
+		m_allocations.push_back( GeometryHeap::None );
+
+		if ( layout.quantized )
+		{
+			m_shadows[slot].resize( layout.sourceStride * count );
+		}
+
 		D3D11_USAGE usageDX{};
 		unsigned int CPUAccessFlags = 0; // TODO: This needs to be managed better (from parameters or XML?)
 		switch ( m_usage[slot] )
@@ -110,7 +260,7 @@ void VertexBuffer::Create( VertexBufferParameters parameters )
 
 		D3D11_BUFFER_DESC vertexBufferDesc{};
 		vertexBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-		vertexBufferDesc.ByteWidth = (UINT)(parameters.vertexDeclaration->GetSizeInBytes( slot ) * count);
+		vertexBufferDesc.ByteWidth = (UINT)(m_strides[slot] * count);
 		vertexBufferDesc.Usage = usageDX;
 		vertexBufferDesc.CPUAccessFlags = CPUAccessFlags;
 
@@ -158,15 +308,283 @@ bool VertexBuffer::Valid() const
 	return m_buffers.size() == m_strides.size();
 }
 
+void VertexBuffer::Resize( size_t bufferIndex, size_t count )
+{
+	if ( bufferIndex >= m_strides.size() ) throw unify::Exception( "Failed to resize vertex buffer (buffer index out of range)!" );
+	if ( m_locked[ bufferIndex ] ) throw unify::Exception( "Failed to resize vertex buffer (buffer locked)!" );
+
+	if ( count <= m_capacities[ bufferIndex ] )
+	{
+		m_lengths[ bufferIndex ] = count;
+		return;
+	}
+
+	// Grow geometrically, so that repeated appends copy each vertex only a constant number of times on average.
+	size_t stride = m_strides[ bufferIndex ];
+	size_t capacity = (std::max)( count, m_capacities[ bufferIndex ] * 2 );
+	size_t keepInBytes = (std::min)( m_lengths[ bufferIndex ], count ) * stride;
+
+	auto heap = m_renderer->GetGeometryHeap();
+	if ( m_allocations[ bufferIndex ] != GeometryHeap::None )
+	{
+		size_t allocation = heap->Allocate( stride, capacity, nullptr );
+		GeometryHeap::Block from = heap->Get( m_allocations[ bufferIndex ] );
+		GeometryHeap::Block to = heap->Get( allocation );
+		heap->Copy( to.buffer, to.offset * stride, from.buffer, from.offset * stride, keepInBytes );
+		heap->Free( m_allocations[ bufferIndex ] );
+		m_allocations[ bufferIndex ] = allocation;
+	}
+	else
+	{
+		D3D11_BUFFER_DESC bufferDesc{};
+		m_buffers[ bufferIndex ]->GetDesc( &bufferDesc );
+		bufferDesc.ByteWidth = (UINT)( capacity * stride );
+
+		ID3D11Buffer * buffer = nullptr;
+		HRESULT result = m_renderer->GetDxDevice()->CreateBuffer( &bufferDesc, nullptr, &buffer );
+		if ( WIN_FAILED( result ) )
+		{
+			throw exception::FailedToCreate( "Failed to resize vertex buffer!" );
+		}
+
+		// Only default buffers can be copied into.
+		if ( bufferDesc.Usage == D3D11_USAGE_DEFAULT )
+		{
+			heap->Copy( buffer, 0, m_buffers[ bufferIndex ], 0, keepInBytes );
+		}
+
+		m_buffers[ bufferIndex ]->Release();
+		m_buffers[ bufferIndex ] = buffer;
+
+		if ( m_layouts[ bufferIndex ].quantized )
+		{
+			m_shadows[ bufferIndex ].resize( capacity * m_layouts[ bufferIndex ].sourceStride );
+		}
+	}
+
+	m_capacities[ bufferIndex ] = capacity;
+	m_lengths[ bufferIndex ] = count;
+	m_streamCursors[ bufferIndex ] = capacity;
+}
+
+size_t VertexBuffer::Append( size_t bufferIndex, const VertexBuffer & from )
+{
+	if ( bufferIndex >= m_strides.size() || bufferIndex >= from.m_strides.size() ) throw unify::Exception( "Failed to append vertex buffer (buffer index out of range)!" );
+	if ( m_strides[ bufferIndex ] != from.m_strides[ bufferIndex ] ) throw unify::Exception( "Failed to append vertex buffer (strides differ)!" );
+
+	size_t offset = m_lengths[ bufferIndex ];
+	size_t count = from.m_lengths[ bufferIndex ];
+	if ( count == 0 )
+	{
+		return offset;
+	}
+
+	// Check before resizing, so a rejected append leaves us as we were.
+	size_t toOffset = 0;
+	D3D11_BUFFER_DESC bufferDesc{};
+	GetSlotBuffer( bufferIndex, toOffset )->GetDesc( &bufferDesc );
+	if ( bufferDesc.Usage != D3D11_USAGE_DEFAULT )
+	{
+		throw unify::Exception( "Failed to append vertex buffer (only static buffers can be appended to)!" );
+	}
+
+	Resize( bufferIndex, offset + count );
+
+	ID3D11Buffer * to = GetSlotBuffer( bufferIndex, toOffset );
+	size_t fromOffset = 0;
+	ID3D11Buffer * source = from.GetSlotBuffer( bufferIndex, fromOffset );
+
+	size_t stride = m_strides[ bufferIndex ];
+	m_renderer->GetGeometryHeap()->Copy( to, toOffset + offset * stride, source, fromOffset, count * stride );
+
+	// Keep our shadow only while it still matches what is on the GPU.
+	if ( bufferIndex == m_positionSlot )
+	{
+		if ( from.m_positionSlot == bufferIndex && m_positionShadow.x.size() == offset )
+		{
+			// Copied first, as appending to ourselves would insert from the vector being grown.
+			PositionShadow appended = from.m_positionShadow;
+			m_positionShadow.x.insert( m_positionShadow.x.end(), appended.x.begin(), appended.x.end() );
+			m_positionShadow.y.insert( m_positionShadow.y.end(), appended.y.begin(), appended.y.end() );
+			m_positionShadow.z.insert( m_positionShadow.z.end(), appended.z.begin(), appended.z.end() );
+		}
+		else
+		{
+			m_positionShadow = PositionShadow{};
+			m_positionSlot = GeometryHeap::None;
+		}
+	}
+	return offset;
+}
+
+const VertexBuffer::BoundingSphere & VertexBuffer::GetBoundingSphere() const
+{
+	return m_boundingSphere;
+}
+
+const VertexBuffer::PositionShadow & VertexBuffer::GetPositionShadow() const
+{
+	return m_positionShadow;
+}
+
+ID3D11Buffer * VertexBuffer::GetSlotBuffer( size_t bufferIndex, size_t & offsetInBytes ) const
+{
+	if ( m_allocations[ bufferIndex ] == GeometryHeap::None )
+	{
+		offsetInBytes = 0;
+		return m_buffers[ bufferIndex ];
+	}
+
+	GeometryHeap::Block block = m_renderer->GetGeometryHeap()->Get( m_allocations[ bufferIndex ] );
+	offsetInBytes = block.offset * block.stride;
+	return block.buffer;
+}
+
+size_t VertexBuffer::GetPositionOffset( size_t slot, const VertexQuantizer::Layout & layout ) const
+{
+	size_t element = 0;
+	for ( auto & e : m_vertexDeclaration->Elements() )
+	{
+		if ( e.InputSlot != slot ) continue;
+
+		const VertexQuantizer::Element & described = layout.elements[ element++ ];
+		if ( _stricmp( e.SemanticName.c_str(), "POSITION" ) == 0 && e.SemanticIndex == 0 && described.components >= 3 )
+		{
+			return described.sourceOffset;
+		}
+	}
+	return GeometryHeap::None;
+}
+
+void VertexBuffer::RetainPositions( size_t slot, const VertexQuantizer::Layout & layout, const void * source, size_t count )
+{
+	size_t offset = GetPositionOffset( slot, layout );
+	if ( offset == GeometryHeap::None )
+	{
+		return;
+	}
+
+	// Split into one array per axis, so queries and builds can stream them four at a time.
+	m_positionShadow.x.resize( count );
+	m_positionShadow.y.resize( count );
+	m_positionShadow.z.resize( count );
+	const unsigned char * vertex = (const unsigned char *)source + offset;
+	for ( size_t i = 0; i < count; i++, vertex += layout.sourceStride )
+	{
+		const float * position = (const float *)vertex;
+		m_positionShadow.x[ i ] = position[ 0 ];
+		m_positionShadow.y[ i ] = position[ 1 ];
+		m_positionShadow.z[ i ] = position[ 2 ];
+	}
+	m_positionSlot = slot;
+}
+
+bool VertexBuffer::ComputeBounds( size_t slot, const VertexQuantizer::Layout & layout, const void * source, size_t count )
+{
+	size_t offset = GetPositionOffset( slot, layout );
+	if ( offset == GeometryHeap::None )
+	{
+		return false;
+	}
+
+	const unsigned char * positions = (const unsigned char *)source + offset;
+	size_t stride = layout.sourceStride;
+
+	// Large buffers are split across threads, the calling thread taking the last part.
+	size_t parts = (std::max)( (size_t)1, (std::min)( (size_t)std::thread::hardware_concurrency(), count / ParallelThreshold ) );
+	size_t partSize = ( count + parts - 1 ) / parts;
+	auto inParallel = [&]( std::function< void( size_t, size_t, size_t ) > job )
+	{
+		std::vector< std::future< void > > jobs;
+		for ( size_t part = 0; part + 1 < parts; part++ )
+		{
+			jobs.push_back( std::async( std::launch::async, job, part, part * partSize, (std::min)( count, ( part + 1 ) * partSize ) ) );
+		}
+		job( parts - 1, ( parts - 1 ) * partSize, count );
+		for ( auto && pending : jobs )
+		{
+			pending.get();
+		}
+	};
+
+	std::vector< __m128 > mins( parts );
+	std::vector< __m128 > maxs( parts );
+	inParallel( [&]( size_t part, size_t begin, size_t end )
+	{
+		MinMax( positions + begin * stride, stride, end - begin, mins[ part ], maxs[ part ] );
+	} );
+
+	__m128 min = mins[ 0 ];
+	__m128 max = maxs[ 0 ];
+	for ( size_t part = 1; part < parts; part++ )
+	{
+		min = _mm_min_ps( min, mins[ part ] );
+		max = _mm_max_ps( max, maxs[ part ] );
+	}
+
+	// The sphere is centered on the box, its radius reaching the farthest position rather than the box's corners.
+	__m128 center = _mm_mul_ps( _mm_add_ps( min, max ), _mm_set1_ps( 0.5f ) );
+	std::vector< float > radii( parts );
+	inParallel( [&]( size_t part, size_t begin, size_t end )
+	{
+		radii[ part ] = MaxDistanceSquared( positions + begin * stride, stride, end - begin, center );
+	} );
+
+	alignas( 16 ) float low[ 4 ];
+	alignas( 16 ) float high[ 4 ];
+	alignas( 16 ) float middle[ 4 ];
+	_mm_store_ps( low, min );
+	_mm_store_ps( high, max );
+	_mm_store_ps( middle, center );
+	unify::BBox< float > bounds( unify::V3< float >( low[ 0 ], low[ 1 ], low[ 2 ] ), unify::V3< float >( high[ 0 ], high[ 1 ], high[ 2 ] ) );
+	m_boundingSphere.center = unify::V3< float >( middle[ 0 ], middle[ 1 ], middle[ 2 ] );
+	m_boundingSphere.radius = sqrtf( *std::max_element( radii.begin(), radii.end() ) );
+
+	// A box given by the caller is kept (it may allow for animation), but it had better hold the vertices.
+	if ( m_bboxSupplied )
+	{
+		assert( m_bbox.inf.x <= bounds.inf.x && m_bbox.inf.y <= bounds.inf.y && m_bbox.inf.z <= bounds.inf.z );
+		assert( m_bbox.sup.x >= bounds.sup.x && m_bbox.sup.y >= bounds.sup.y && m_bbox.sup.z >= bounds.sup.z );
+		return true;
+	}
+	m_bbox = bounds;
+	return true;
+}
+
 void VertexBuffer::Destroy()
 {
 	for ( auto && buffer : m_buffers )
 	{
-		buffer->Release();
+		if ( buffer )
+		{
+			buffer->Release();
+		}
+	}
+
+	// The heap is gone while the renderer tears it down.
+	auto heap = m_renderer->GetGeometryHeap();
+	for ( auto && allocation : m_allocations )
+	{
+		if ( heap && allocation != GeometryHeap::None )
+		{
+			heap->Free( allocation );
+		}
 	}
+
 	m_buffers.clear();
+	m_allocations.clear();
+	m_locked.clear();
+	m_usage.clear();
 	m_lengths.clear();
+	m_capacities.clear();
 	m_strides.clear();
+	m_layouts.clear();
+	m_shadows.clear();
+	m_lockedRanges.clear();
+	m_streamCursors.clear();
+	m_readBacks.clear();
+	m_positionShadow = PositionShadow{};
+	m_positionSlot = GeometryHeap::None;
 }
 
 size_t VertexBuffer::GetBufferCount() const
@@ -176,26 +594,133 @@ size_t VertexBuffer::GetBufferCount() const
 
 void VertexBuffer::Use( size_t startBuffer, size_t startSlot ) const
 {
-	auto dxContext = m_renderer->GetDxContext();
-	std::vector< unsigned int > offsetInBytes( m_strides.size(), 0 );
-	dxContext->IASetVertexBuffers( 0, (UINT)m_buffers.size(), &m_buffers[0], (UINT*)&m_strides[0], &offsetInBytes[0] );
+	auto heap = m_renderer->GetGeometryHeap();
+
+	std::vector< ID3D11Buffer * > buffers( m_buffers.size() );
+	std::vector< UINT > strides( m_buffers.size() );
+	std::vector< UINT > offsets( m_buffers.size(), 0 );
+
+	// Heap slots are addressed through the base vertex, so their page stays bound across draws. That only works if
+	// every per-vertex slot starts at the same vertex, otherwise we fall back to byte offsets.
+	size_t baseVertex = GeometryHeap::None;
+	bool sharedBaseVertex = true;
+	for ( size_t slot = 0; slot < m_buffers.size(); slot++ )
+	{
+		strides[ slot ] = (UINT)m_strides[ slot ];
+
+		if ( m_allocations[ slot ] == GeometryHeap::None )
+		{
+			buffers[ slot ] = m_buffers[ slot ];
+			if ( m_vertexDeclaration->GetInstancing( slot ) == Instancing::None )
+			{
+				sharedBaseVertex = false;
+			}
+			continue;
+		}
+
+		GeometryHeap::Block block = heap->Get( m_allocations[ slot ] );
+		buffers[ slot ] = block.buffer;
+		offsets[ slot ] = (UINT)( block.offset * block.stride );
+		if ( baseVertex == GeometryHeap::None )
+		{
+			baseVertex = block.offset;
+		}
+		else if ( baseVertex != block.offset )
+		{
+			sharedBaseVertex = false;
+		}
+	}
+
+	if ( baseVertex == GeometryHeap::None || ! sharedBaseVertex )
+	{
+		baseVertex = 0;
+	}
+	else
+	{
+		for ( size_t slot = 0; slot < m_buffers.size(); slot++ )
+		{
+			if ( m_allocations[ slot ] != GeometryHeap::None )
+			{
+				offsets[ slot ] = 0;
+			}
+		}
+	}
+
+	m_renderer->UseVertexBuffers( buffers, strides, offsets, baseVertex );
 }
 
 void VertexBuffer::Lock( size_t bufferIndex, unify::DataLock & lock )
+{
+	if ( bufferIndex >= m_buffers.size() ) throw exception::FailedToLock( "Failed to lock vertex  buffer (buffer index out of range)!" );
+
+	LockRange( bufferIndex, 0, m_lengths[ bufferIndex ], LockIntent::Discard, lock );
+}
+
+void VertexBuffer::LockRange( size_t bufferIndex, size_t offset, size_t count, LockIntent::TYPE intent, unify::DataLock & lock )
 {
 	if ( bufferIndex >= m_buffers.size() ) throw exception::FailedToLock( "Failed to lock vertex  buffer (buffer index out of range)!" );
 	if ( m_locked[ bufferIndex ] ) throw exception::FailedToLock( "Failed to lock vertex  buffer (buffer already locked)!" );
+	if ( ! m_buffers[ bufferIndex ] ) throw exception::FailedToLock( "Failed to lock vertex  buffer (static buffer in geometry heap)!" );
+	if ( offset + count > m_capacities[ bufferIndex ] ) throw exception::FailedToLock( "Failed to lock vertex  buffer (range out of bounds)!" );
+	if ( m_usage[ bufferIndex ] != BufferUsage::Dynamic ) throw exception::FailedToLock( "Failed to lock vertex  buffer (only dynamic buffers can be written)!" );
+
+	m_lockedRanges[ bufferIndex ] = LockedRange{ offset, count, intent };
+
+	// Locked data is written behind our back, so the shadow can't be trusted anymore.
+	if ( bufferIndex == m_positionSlot )
+	{
+		m_positionShadow = PositionShadow{};
+		m_positionSlot = GeometryHeap::None;
+	}
+
+	// Packed slots are written as declared, and packed on unlock.
+	if ( m_layouts[ bufferIndex ].quantized )
+	{
+		size_t sourceStride = m_layouts[ bufferIndex ].sourceStride;
+		lock.SetLock( &m_shadows[ bufferIndex ][ offset * sourceStride ], (unsigned int)( sourceStride * count ), unify::DataLockAccess::ReadWrite, 0 );
+		m_locked[ bufferIndex ] = true;
+		return;
+	}
 
 	auto dxContext = m_renderer->GetDxContext();
 	D3D11_MAPPED_SUBRESOURCE subresource{};
-	HRESULT result = dxContext->Map( m_buffers[ bufferIndex ], (UINT)bufferIndex, D3D11_MAP::D3D11_MAP_WRITE_DISCARD, 0, &subresource );
-	if (WIN_FAILED( result ) )
+	HRESULT result = dxContext->Map( m_buffers[ bufferIndex ], 0, intent == LockIntent::Discard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &subresource );
+	if ( WIN_FAILED( result ) )
 	{
-		throw unify::Exception( "Failed to set vertex shader!" );
-	}		
+		throw exception::FailedToLock( "Failed to lock vertex buffer!" );
+	}
 
-	lock.SetLock( subresource.pData, (unsigned int)(m_strides[bufferIndex] * m_lengths[bufferIndex]), unify::DataLockAccess::ReadWrite, 0 );
-	m_locked[bufferIndex] = true;
+	size_t stride = m_strides[ bufferIndex ];
+	lock.SetLock( (unsigned char *)subresource.pData + offset * stride, (unsigned int)( stride * count ), unify::DataLockAccess::ReadWrite, 0 );
+	m_locked[ bufferIndex ] = true;
+}
+
+size_t VertexBuffer::LockAppend( size_t bufferIndex, size_t count, unify::DataLock & lock )
+{
+	if ( bufferIndex >= m_buffers.size() ) throw exception::FailedToLock( "Failed to lock vertex  buffer (buffer index out of range)!" );
+	if ( count > m_capacities[ bufferIndex ] ) throw exception::FailedToLock( "Failed to lock vertex  buffer (append larger than buffer)!" );
+
+	// Vertices behind the cursor may still be in use by the GPU, so we only discard once we wrap.
+	size_t offset = m_streamCursors[ bufferIndex ];
+	LockIntent::TYPE intent = LockIntent::NoOverwrite;
+	if ( offset + count > m_capacities[ bufferIndex ] )
+	{
+		offset = 0;
+		intent = LockIntent::Discard;
+	}
+
+	LockRange( bufferIndex, offset, count, intent, lock );
+	m_streamCursors[ bufferIndex ] = offset + count;
+	return offset;
+}
+
+size_t VertexBuffer::StreamAppend( size_t bufferIndex, const void * source, size_t count )
+{
+	unify::DataLock lock;
+	size_t offset = LockAppend( bufferIndex, count, lock );
+	memcpy( lock.GetData< unsigned char >(), source, count * m_vertexDeclaration->GetSizeInBytes( bufferIndex ) );
+	Unlock( bufferIndex, lock );
+	return offset;
 }
 
 void VertexBuffer::LockReadOnly( size_t bufferIndex, unify::DataLock & lock ) const
@@ -203,16 +728,50 @@ void VertexBuffer::LockReadOnly( size_t bufferIndex, unify::DataLock & lock ) co
 	if ( bufferIndex >= m_buffers.size() ) throw exception::FailedToLock( "Failed to lock vertex  buffer (buffer index out of range)!" );
 	if ( m_locked[ bufferIndex ] ) throw exception::FailedToLock( "Failed to lock vertex  buffer (buffer already locked)!" );
 
+	if ( m_layouts[ bufferIndex ].quantized )
+	{
+		// Packed data can't be unpacked, only slots that keep the declared layout around can be read.
+		if ( m_shadows[ bufferIndex ].empty() ) throw exception::FailedToLock( "Failed to lock vertex  buffer (packed static buffer)!" );
+
+		lock.SetLock( (void *)&m_shadows[ bufferIndex ][0], (unsigned int)( m_layouts[ bufferIndex ].sourceStride * m_lengths[ bufferIndex ] ), unify::DataLockAccess::Readonly, 0 );
+		m_locked[ bufferIndex ] = true;
+		return;
+	}
+
+	// Vertex buffers can't be read by the CPU, so we read a staging copy instead.
+	auto dxDevice = m_renderer->GetDxDevice();
 	auto dxContext = m_renderer->GetDxContext();
+
+	size_t sizeInBytes = m_strides[ bufferIndex ] * m_lengths[ bufferIndex ];
+
+	D3D11_BUFFER_DESC bufferDesc{};
+	bufferDesc.Usage = D3D11_USAGE_STAGING;
+	bufferDesc.ByteWidth = (UINT)sizeInBytes;
+	bufferDesc.BindFlags = 0;
+	bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+
+	CComPtr< ID3D11Buffer > staging;
+	HRESULT result = dxDevice->CreateBuffer( &bufferDesc, nullptr, &staging );
+	if ( WIN_FAILED( result ) )
+	{
+		throw exception::FailedToLock( "Failed to lock vertex buffer (failed to create staging copy)!" );
+	}
+
+	size_t offsetInBytes = 0;
+	ID3D11Buffer * buffer = GetSlotBuffer( bufferIndex, offsetInBytes );
+	D3D11_BOX box{ (UINT)offsetInBytes, 0, 0, (UINT)( offsetInBytes + sizeInBytes ), 1, 1 };
+	dxContext->CopySubresourceRegion( staging, 0, 0, 0, 0, buffer, 0, &box );
+
 	D3D11_MAPPED_SUBRESOURCE subresource{};
-	HRESULT result = dxContext->Map( m_buffers[ bufferIndex ], (UINT)bufferIndex, D3D11_MAP::D3D11_MAP_WRITE_DISCARD, 0, &subresource );
-	if (WIN_FAILED( result ) )
+	result = dxContext->Map( staging, 0, D3D11_MAP_READ, 0, &subresource );
+	if ( WIN_FAILED( result ) )
 	{
-		throw unify::Exception( "Failed to set vertex shader!" );
-	}		
+		throw exception::FailedToLock( "Failed to lock vertex buffer (failed to read staging copy)!" );
+	}
 
-	lock.SetLock( subresource.pData, (unsigned int)(m_strides[bufferIndex] * m_lengths[bufferIndex]), unify::DataLockAccess::Readonly, 0 );
-	m_locked[bufferIndex] = true;
+	lock.SetLock( subresource.pData, (unsigned int)sizeInBytes, unify::DataLockAccess::Readonly, 0 );
+	m_readBacks[ bufferIndex ] = staging;
+	m_locked[ bufferIndex ] = true;
 }
 
 void VertexBuffer::Unlock( size_t bufferIndex, unify::DataLock & lock )
@@ -220,10 +779,31 @@ void VertexBuffer::Unlock( size_t bufferIndex, unify::DataLock & lock )
 	if ( bufferIndex >= m_buffers.size() ) throw exception::FailedToLock( "Failed to unlock vertex  buffer (buffer index out of range)!" );
 	if ( ! m_locked[ bufferIndex ] ) throw exception::FailedToLock( "Failed to unlock vertex  buffer (buffer not locked)!" );
 
-	auto dxDevice = m_renderer->GetDxDevice();
 	auto dxContext = m_renderer->GetDxContext();
 
-	dxContext->Unmap( m_buffers[ bufferIndex ], (UINT)bufferIndex );
+	if ( m_layouts[ bufferIndex ].quantized )
+	{
+		LockedRange range = m_lockedRanges[ bufferIndex ];
+		D3D11_MAPPED_SUBRESOURCE subresource{};
+		HRESULT result = dxContext->Map( m_buffers[ bufferIndex ], 0, range.intent == LockIntent::Discard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &subresource );
+		if ( WIN_FAILED( result ) )
+		{
+			throw exception::FailedToLock( "Failed to unlock vertex buffer (failed to map packed buffer)!" );
+		}
+
+		// A discard loses the whole buffer, the shadow still has all of it.
+		if ( range.intent == LockIntent::Discard )
+		{
+			range.count = (std::max)( range.offset + range.count, m_lengths[ bufferIndex ] );
+			range.offset = 0;
+		}
+
+		const VertexQuantizer::Layout & layout = m_layouts[ bufferIndex ];
+		unsigned char * to = (unsigned char *)subresource.pData + range.offset * layout.stride;
+		m_renderer->GetVertexQuantizer()->Quantize( layout, &m_shadows[ bufferIndex ][ range.offset * layout.sourceStride ], range.count, to );
+	}
+
+	dxContext->Unmap( m_buffers[ bufferIndex ], 0 );
 
 	m_locked[bufferIndex] = false;
 }
@@ -233,10 +813,11 @@ void VertexBuffer::UnlockReadOnly( size_t bufferIndex, unify::DataLock & lock )
 	if ( bufferIndex >= m_buffers.size() ) throw exception::FailedToLock( "Failed to unlock vertex  buffer (buffer index out of range)!" );
 	if ( ! m_locked[ bufferIndex ] ) throw exception::FailedToLock( "Failed to unlock vertex  buffer (buffer not locked)!" );
 
-	auto dxDevice = m_renderer->GetDxDevice();
-	auto dxContext = m_renderer->GetDxContext();
-
-	dxContext->Unmap( m_buffers[ bufferIndex ], (UINT)bufferIndex );
+	if ( m_readBacks[ bufferIndex ] )
+	{
+		m_renderer->GetDxContext()->Unmap( m_readBacks[ bufferIndex ], 0 );
+		m_readBacks[ bufferIndex ] = nullptr;
+	}
 	
 	m_locked[bufferIndex] = false;
 }
@@ -6,7 +6,9 @@
 #include <medx11/Renderer.h>
 #include <me/render/IVertexBuffer.h>
 #include <medx11/ConstantBuffer.h>
+#include <medx11/VertexQuantizer.h>
 #include <unify/BBox.h>
+#include <unify/V3.h>
 #include <atlbase.h>
 
 namespace medx11
@@ -14,6 +16,34 @@ namespace medx11
 	class VertexBuffer : public me::render::IVertexBuffer
 	{
 	public:
+		/// <summary>
+		/// Static vertex positions kept on the CPU, one array per axis.
+		/// </summary>
+		struct PositionShadow
+		{
+			std::vector< float > x;
+			std::vector< float > y;
+			std::vector< float > z;
+		};
+
+		struct BoundingSphere
+		{
+			unify::V3< float > center;
+			float radius;
+		};
+
+		/// <summary>
+		/// How a ranged lock treats the rest of the buffer.
+		/// </summary>
+		struct LockIntent
+		{
+			enum TYPE
+			{
+				Discard, // The whole buffer is renamed, anything outside the range is lost.
+				NoOverwrite // The caller promises not to touch vertices the GPU may still be using.
+			};
+		};
+
 		VertexBuffer( me::render::IRenderer * renderer );
 		VertexBuffer( me::render::IRenderer * renderer, me::render::VertexBufferParameters parameters );
 		~VertexBuffer();
@@ -25,6 +55,47 @@ namespace medx11
 		const unify::BBox< float > & GetBBox() const override;
 		bool Valid() const;
 
+		/// <summary>
+		/// Sphere around the positions (POSITION, semantic index 0) of the source data, centered on their box, computed
+		/// on create. The box is computed with it, unless one was given.
+		/// </summary>
+		const BoundingSphere & GetBoundingSphere() const;
+
+		/// <summary>
+		/// Change the number of vertices in a buffer, keeping existing ones. Storage grows geometrically, its contents
+		/// copied on the GPU. Dynamic buffers are rewritten on every lock, so their contents are not kept.
+		/// </summary>
+		void Resize( size_t bufferIndex, size_t count );
+
+		/// <summary>
+		/// Append the vertices of a buffer of from, with a matching stride, copying them on the GPU.
+		/// Returns the vertex offset of the first appended vertex, to rebase appended indices by (see IndexBuffer::Append).
+		/// </summary>
+		size_t Append( size_t bufferIndex, const VertexBuffer & from );
+
+		/// <summary>
+		/// Lock count vertices of a dynamic buffer from offset, up to its capacity.
+		/// </summary>
+		void LockRange( size_t bufferIndex, size_t offset, size_t count, LockIntent::TYPE intent, unify::DataLock & lock );
+
+		/// <summary>
+		/// Lock the next count vertices of a dynamic buffer used as a stream, without overwriting earlier appends, wrapping
+		/// (and discarding) once the buffer is full. Returns the vertex offset of the locked range, to draw from.
+		/// Unlock as usual.
+		/// </summary>
+		size_t LockAppend( size_t bufferIndex, size_t count, unify::DataLock & lock );
+
+		/// <summary>
+		/// Append count vertices to a stream (see LockAppend), returning their vertex offset.
+		/// </summary>
+		size_t StreamAppend( size_t bufferIndex, const void * source, size_t count );
+
+		/// <summary>
+		/// Positions (POSITION, semantic index 0) from the source data, when the renderer retains shadows. Empty for
+		/// data that is only written through locks.
+		/// </summary>
+		const PositionShadow & GetPositionShadow() const;
+
 	public: // me::render::IBuffer
 		void Destroy() override;
 
@@ -42,17 +113,57 @@ namespace medx11
 		me::render::BufferUsage::TYPE GetUsage( size_t bufferIndex ) const override;
 
 	protected:
+		/// <summary>
+		/// The Direct-X buffer holding a slot, and the byte offset of the slot's first vertex within it.
+		/// </summary>
+		ID3D11Buffer * GetSlotBuffer( size_t bufferIndex, size_t & offsetInBytes ) const;
+
+		/// <summary>
+		/// Copy positions out of source data for a slot, if the slot has them.
+		/// </summary>
+		void RetainPositions( size_t slot, const VertexQuantizer::Layout & layout, const void * source, size_t count );
+
+		/// <summary>
+		/// Byte offset of the position within a slot's declared vertex, or GeometryHeap::None if the slot has none.
+		/// </summary>
+		size_t GetPositionOffset( size_t slot, const VertexQuantizer::Layout & layout ) const;
+
+		/// <summary>
+		/// Bound the positions in source data for a slot, returning false if the slot has none. Validates, in debug, a
+		/// box given by the caller rather than replacing it.
+		/// </summary>
+		bool ComputeBounds( size_t slot, const VertexQuantizer::Layout & layout, const void * source, size_t count );
+
 		const Renderer * m_renderer;
 
 		me::render::VertexDeclaration::ptr m_vertexDeclaration;
 
 		unify::BBox< float > m_bbox;
+		bool m_bboxSupplied;
+		BoundingSphere m_boundingSphere;
 
-		std::vector< ID3D11Buffer * > m_buffers;
+		std::vector< ID3D11Buffer * > m_buffers; // Null for slots in the geometry heap.
+		std::vector< size_t > m_allocations; // Geometry heap allocation per slot, or GeometryHeap::None.
 		
 		mutable std::vector< bool > m_locked;
 		std::vector< me::render::BufferUsage::TYPE > m_usage;
 		std::vector< size_t > m_strides; // Size of each item in the buffer.
-		std::vector< size_t > m_lengths; // Number of items we can store in the buffer.
+		std::vector< size_t > m_lengths; // Number of items in the buffer.
+		std::vector< size_t > m_capacities; // Number of items we can store in the buffer.
+		std::vector< VertexQuantizer::Layout > m_layouts; // How each slot is packed, m_strides holding the packed size.
+		std::vector< std::vector< unsigned char > > m_shadows; // Declared layout of packed, lockable slots, packed on unlock.
+
+		struct LockedRange
+		{
+			size_t offset;
+			size_t count;
+			LockIntent::TYPE intent;
+		};
+		std::vector< LockedRange > m_lockedRanges;
+		std::vector< size_t > m_streamCursors; // Where the next append goes.
+		mutable std::vector< CComPtr< ID3D11Buffer > > m_readBacks; // Staging copies, while read only locked.
+
+		PositionShadow m_positionShadow;
+		size_t m_positionSlot; // Slot the shadow came from, or GeometryHeap::None.
 	};
 }
\ No newline at end of file
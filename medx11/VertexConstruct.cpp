@@ -2,6 +2,7 @@
 // All Rights Reserved
 
 #include <medx11/VertexConstruct.h>
+#include <medx11/VertexQuantizer.h>
 #include <me/exception/FailedToCreate.h>
 #include <algorithm>
 
@@ -74,11 +75,29 @@ VertexConstruct::VertexConstruct( IRenderer * renderer, const VertexDeclaration
 		throw exception::FailedToCreate( "Failed to create vertex declaration, as is empty!" );
 	}
 
+	// Describe packed elements as vertex buffers store them, elements are in slot order within each layout.
+	std::vector< VertexQuantizer::Layout > layouts;
+	std::vector< size_t > nextElement;
+	for ( size_t slot = 0; slot < vd.NumberOfSlots(); slot++ )
+	{
+		layouts.push_back( m_renderer->GetVertexQuantizer()->GetLayout( vd, slot ) );
+		nextElement.push_back( 0 );
+	}
+
 	std::vector< D3D11_INPUT_ELEMENT_DESC > elements;
 	for ( auto & e : vd.Elements() )
 	{
 		std::vector< D3D11_INPUT_ELEMENT_DESC > newElements = ToDX( e );
 
+		if ( e.InputSlot < layouts.size() )
+		{
+			const VertexQuantizer::Element & packed = layouts[ e.InputSlot ].elements[ nextElement[ e.InputSlot ]++ ];
+			if ( packed.format != VertexQuantizer::Format::None )
+			{
+				newElements[ 0 ].Format = VertexQuantizer::ToDX( packed.format );
+			}
+		}
+
 		for( auto && element : newElements )
 		{
 			elements.push_back( element );
@@ -0,0 +1,130 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#include <medx11/VertexPuller.h>
+#include <me/exception/FailedToCreate.h>
+#include <algorithm>
+
+using namespace medx11;
+using namespace me;
+using namespace render;
+
+VertexPuller::VertexPuller( Renderer * renderer, const MeshPack & pack )
+	: m_renderer{ renderer }
+	, m_vertices{ renderer }
+	, m_argsCapacity{ 0 }
+{
+	if ( pack.GetMeshes().empty() )
+	{
+		throw exception::FailedToCreate( "Vertex puller needs a mesh pack with meshes!" );
+	}
+
+	m_vertices.Add( pack.GetStride(), pack.GetVertexCount(), &pack.GetVertices()[0], BufferUsage::Immutable );
+
+	auto dxDevice = m_renderer->GetDxDevice();
+
+	// Raw rather than structured, as structured buffers can't also be index buffers.
+	const std::vector< uint32_t > & indices = pack.GetIndices();
+	D3D11_BUFFER_DESC indexDesc{};
+	indexDesc.ByteWidth = (UINT)( indices.size() * sizeof( uint32_t ) );
+	indexDesc.BindFlags = D3D11_BIND_INDEX_BUFFER | D3D11_BIND_SHADER_RESOURCE;
+	indexDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	indexDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+	D3D11_SUBRESOURCE_DATA initialData{};
+	initialData.pSysMem = &indices[0];
+	HRESULT result = dxDevice->CreateBuffer( &indexDesc, &initialData, &m_indices );
+	if ( WIN_FAILED( result ) )
+	{
+		throw exception::FailedToCreate( "Failed to create vertex puller indices!" );
+	}
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc{};
+	viewDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+	viewDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFEREX;
+	viewDesc.BufferEx.NumElements = (UINT)indices.size();
+	viewDesc.BufferEx.Flags = D3D11_BUFFEREX_SRV_FLAG_RAW;
+	result = dxDevice->CreateShaderResourceView( m_indices, &viewDesc, &m_indexView );
+	if ( WIN_FAILED( result ) )
+	{
+		throw exception::FailedToCreate( "Failed to create vertex puller index view!" );
+	}
+}
+
+VertexPuller::~VertexPuller()
+{
+}
+
+void VertexPuller::Draw( const RenderInfo & renderInfo, Effect::ptr effect, IConstantBuffer * vertexCB, IConstantBuffer * pixelCB, const MeshPack::Batch & batch, Submit::TYPE submit )
+{
+	if ( batch.entries.empty() )
+	{
+		return;
+	}
+
+	auto dxDevice = m_renderer->GetDxDevice();
+	auto dxContext = m_renderer->GetDxContext();
+
+	// Entries are streamed, in a buffer grown to the largest batch seen.
+	if ( ! m_entries || m_entries->GetLength( 0 ) < batch.entries.size() )
+	{
+		size_t capacity = m_entries ? m_entries->GetLength( 0 ) : 1024;
+		while ( capacity < batch.entries.size() )
+		{
+			capacity *= 2;
+		}
+		m_entries.reset( new DataBuffer( m_renderer ) );
+		m_entries->Add( sizeof( MeshPack::Entry ), capacity, nullptr, BufferUsage::Dynamic );
+	}
+	size_t first = m_entries->Append( 0, &batch.entries[0], batch.entries.size() );
+
+	dxContext->IASetPrimitiveTopology( D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
+
+	m_renderer->UpdateFrameConstants( renderInfo );
+
+	effect->Use( m_renderer, renderInfo );
+
+	vertexCB->Update( renderInfo, nullptr, 0 );
+	vertexCB->Use( 0, 0 );
+	pixelCB->Use( 0, 0 );
+
+	m_vertices.Use( ResourceType::VertexShader, VertexSlot );
+	dxContext->VSSetShaderResources( IndexSlot, 1, &m_indexView.p );
+	m_entries->Use( ResourceType::VertexShader, EntrySlot );
+
+	if ( submit == Submit::Instanced )
+	{
+		m_renderer->UseInstanceConstants( first, batch.entries.size() );
+		m_renderer->GetConstantRing()->Flush();
+		dxContext->DrawInstanced( batch.maxIndexCount, (UINT)batch.entries.size(), 0, 0 );
+		return;
+	}
+
+	if ( m_argsCapacity < batch.args.size() )
+	{
+		m_argsCapacity = (std::max)( m_argsCapacity * 2, batch.args.size() );
+		D3D11_BUFFER_DESC argsDesc{};
+		argsDesc.ByteWidth = (UINT)( m_argsCapacity * sizeof( MeshPack::DrawArgs ) );
+		argsDesc.Usage = D3D11_USAGE_DEFAULT;
+		argsDesc.MiscFlags = D3D11_RESOURCE_MISC_DRAWINDIRECT_ARGS;
+		m_args = nullptr;
+		HRESULT result = dxDevice->CreateBuffer( &argsDesc, nullptr, &m_args );
+		if ( WIN_FAILED( result ) )
+		{
+			throw exception::FailedToCreate( "Failed to create vertex puller draw arguments!" );
+		}
+	}
+
+	D3D11_BOX box{ 0, 0, 0, (UINT)( batch.args.size() * sizeof( MeshPack::DrawArgs ) ), 1, 1 };
+	dxContext->UpdateSubresource( m_args, 0, &box, &batch.args[0], 0, 0 );
+
+	dxContext->IASetIndexBuffer( m_indices, DXGI_FORMAT_R32_UINT, 0 );
+
+	// 11 has no multi-draw, so each mesh is its own indirect draw. SV_InstanceID restarts at 0 for each, so the group's
+	// first entry goes through the instance constants.
+	for ( size_t draw = 0; draw < batch.args.size(); draw++ )
+	{
+		m_renderer->UseInstanceConstants( first + batch.args[ draw ].startInstanceLocation, batch.args[ draw ].instanceCount );
+		m_renderer->GetConstantRing()->Flush();
+		dxContext->DrawIndexedInstancedIndirect( m_args, (UINT)( draw * sizeof( MeshPack::DrawArgs ) ) );
+	}
+}
@@ -0,0 +1,60 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#pragma once
+
+#include <medx11/Renderer.h>
+#include <medx11/MeshPack.h>
+#include <medx11/DataBuffer.h>
+#include <atlbase.h>
+#include <memory>
+
+namespace medx11
+{
+	/// <summary>
+	/// Draws many different meshes of a MeshPack in one submission, with the vertex shader pulling its own vertices.
+	/// No vertex or index buffers are bound per mesh; the shader reads, from its vertex stage:
+	///   t[VertexSlot]   StructuredBuffer of the packed vertices,
+	///   t[IndexSlot]    ByteAddressBuffer of the packed (already rebased) indices,
+	///   t[EntrySlot]    StructuredBuffer< MeshPack::Entry >, indexed by SV_InstanceID plus the first uint of the cbuffer
+	///                   at Renderer::InstanceConstantsSlot.
+	/// An entry's transform is an index into whatever transforms the effect reads, bound by the caller.
+	/// </summary>
+	class VertexPuller
+	{
+	public:
+		static const UINT VertexSlot = Renderer::InstanceDataSlot - 1;
+		static const UINT IndexSlot = Renderer::InstanceDataSlot - 2;
+		static const UINT EntrySlot = Renderer::InstanceDataSlot - 3;
+
+		struct Submit
+		{
+			enum TYPE
+			{
+				// One DrawInstanced of the batch's largest index count per instance. SV_VertexID walks the entry's indices;
+				// vertices past its index count must be culled by the shader (e.g. output a NaN position).
+				Instanced,
+				// One DrawIndexedInstancedIndirect per mesh, from an arguments buffer, with the pack's indices bound as
+				// the index buffer, so SV_VertexID is the vertex to pull.
+				Indirect
+			};
+		};
+
+		/// <summary>
+		/// Upload a pack's vertices and indices. Later additions to the pack need a new puller.
+		/// </summary>
+		VertexPuller( Renderer * renderer, const MeshPack & pack );
+		~VertexPuller();
+
+		void Draw( const me::render::RenderInfo & renderInfo, me::render::Effect::ptr effect, me::render::IConstantBuffer * vertexCB, me::render::IConstantBuffer * pixelCB, const MeshPack::Batch & batch, Submit::TYPE submit );
+
+	private:
+		Renderer * m_renderer;
+		DataBuffer m_vertices;
+		CComPtr< ID3D11Buffer > m_indices; // Bound as both index buffer and raw view.
+		CComPtr< ID3D11ShaderResourceView > m_indexView;
+		std::unique_ptr< DataBuffer > m_entries;
+		CComPtr< ID3D11Buffer > m_args;
+		size_t m_argsCapacity; // In draws.
+	};
+}
\ No newline at end of file
@@ -0,0 +1,269 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#include <medx11/VertexQuantizer.h>
+#include <DirectXPackedVector.h>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+using namespace medx11;
+using namespace me;
+using namespace render;
+
+namespace
+{
+	std::string ToUpper( std::string text )
+	{
+		std::transform( text.begin(), text.end(), text.begin(), []( char c ) { return (char)std::toupper( (unsigned char)c ); } );
+		return text;
+	}
+
+	size_t SizeOf( ElementFormat::TYPE format )
+	{
+		switch ( format )
+		{
+		case ElementFormat::Float1: case ElementFormat::Int1: case ElementFormat::UInt1: return 4;
+		case ElementFormat::Float2: case ElementFormat::Int2: case ElementFormat::UInt2: return 8;
+		case ElementFormat::Float3: case ElementFormat::Int3: case ElementFormat::UInt3: return 12;
+		case ElementFormat::Float4: case ElementFormat::Int4: case ElementFormat::UInt4: return 16;
+		case ElementFormat::Matrix4x4: return 64;
+		case ElementFormat::ColorUNorm: return 4;
+		default: return 0;
+		}
+	}
+
+	size_t FloatComponents( ElementFormat::TYPE format )
+	{
+		switch ( format )
+		{
+		case ElementFormat::Float1: return 1;
+		case ElementFormat::Float2: return 2;
+		case ElementFormat::Float3: return 3;
+		case ElementFormat::Float4: return 4;
+		default: return 0;
+		}
+	}
+
+	template< typename T >
+	T ToNorm( float value, float minimum, float scale )
+	{
+		value = (std::min)( (std::max)( value, minimum ), 1.0f );
+		return (T)std::lround( value * scale );
+	}
+}
+
+VertexQuantizer::VertexQuantizer()
+	: m_enabled{ false }
+{
+	m_rules[ "NORMAL" ] = Format::SNorm8x4;
+	m_rules[ "TANGENT" ] = Format::SNorm8x4;
+	m_rules[ "BINORMAL" ] = Format::SNorm8x4;
+	m_rules[ "TEXCOORD" ] = Format::Half2;
+	m_rules[ "COLOR" ] = Format::UNorm8x4;
+}
+
+void VertexQuantizer::SetEnabled( bool enabled )
+{
+	m_enabled = enabled;
+}
+
+bool VertexQuantizer::IsEnabled() const
+{
+	return m_enabled;
+}
+
+void VertexQuantizer::SetRule( std::string semantic, Format::TYPE format )
+{
+	m_rules[ ToUpper( semantic ) ] = format;
+}
+
+VertexQuantizer::Format::TYPE VertexQuantizer::GetRule( std::string semantic ) const
+{
+	auto itr = m_rules.find( ToUpper( semantic ) );
+	return itr == m_rules.end() ? Format::None : itr->second;
+}
+
+VertexQuantizer::Layout VertexQuantizer::GetLayout( const VertexDeclaration & vd, size_t slot ) const
+{
+	std::string key = std::to_string( slot ) + ":" + std::to_string( vd.GetSizeInBytes( slot ) );
+	for ( auto & e : vd.Elements() )
+	{
+		if ( e.InputSlot != slot ) continue;
+		key += "|" + ToUpper( e.SemanticName ) + std::to_string( e.SemanticIndex ) + "," + std::to_string( (int)e.Format ) + "," + std::to_string( (int)e.SlotClass );
+	}
+
+	std::lock_guard< std::mutex > guard( m_layoutsLock );
+	auto itr = m_layouts.find( key );
+	if ( itr == m_layouts.end() )
+	{
+		itr = m_layouts.insert( { key, ComputeLayout( vd, slot ) } ).first;
+	}
+	return itr->second;
+}
+
+VertexQuantizer::Layout VertexQuantizer::ComputeLayout( const VertexDeclaration & vd, size_t slot ) const
+{
+	Layout layout{};
+	bool packable = m_enabled;
+	for ( auto & e : vd.Elements() )
+	{
+		if ( e.InputSlot != slot ) continue;
+
+		// Instance data is written by the CPU every frame, packing it would only cost time.
+		if ( e.SlotClass != SlotClass::Vertex )
+		{
+			packable = false;
+		}
+
+		Element element{};
+		element.sourceOffset = layout.sourceStride;
+		element.sourceSize = ::SizeOf( e.Format );
+		element.components = FloatComponents( e.Format );
+		element.format = GetRule( e.SemanticName );
+		if ( element.components == 0 || element.components > Components( element.format ) )
+		{
+			element.format = Format::None;
+		}
+
+		if ( element.sourceSize == 0 )
+		{
+			packable = false;
+		}
+
+		layout.sourceStride += element.sourceSize;
+		layout.elements.push_back( element );
+	}
+
+	// Anything we can't account for byte for byte is left alone.
+	if ( layout.sourceStride != vd.GetSizeInBytes( slot ) )
+	{
+		packable = false;
+	}
+
+	for ( auto && element : layout.elements )
+	{
+		if ( ! packable )
+		{
+			element.format = Format::None;
+		}
+
+		element.offset = layout.stride;
+		layout.stride += element.format == Format::None ? element.sourceSize : SizeOf( element.format );
+		layout.quantized = layout.quantized || element.format != Format::None;
+	}
+
+	return layout;
+}
+
+void VertexQuantizer::Quantize( const Layout & layout, const void * source, size_t count, void * destination ) const
+{
+	using namespace DirectX::PackedVector;
+
+	const unsigned char * in = (const unsigned char *)source;
+	unsigned char * out = (unsigned char *)destination;
+
+	for ( size_t vertex = 0; vertex < count; vertex++, in += layout.sourceStride, out += layout.stride )
+	{
+		for ( auto && element : layout.elements )
+		{
+			const unsigned char * from = in + element.sourceOffset;
+			unsigned char * to = out + element.offset;
+
+			if ( element.format == Format::None )
+			{
+				memcpy( to, from, element.sourceSize );
+				continue;
+			}
+
+			// Missing components are zero, other than w, which is one, as the input assembler would default them.
+			float v[ 4 ] = { 0.0f, 0.0f, 0.0f, 1.0f };
+			memcpy( v, from, element.components * sizeof( float ) );
+
+			switch ( element.format )
+			{
+			case Format::Half2:
+			case Format::Half4:
+				for ( size_t i = 0; i < Components( element.format ); i++ )
+				{
+					( (HALF *)to )[ i ] = XMConvertFloatToHalf( v[ i ] );
+				}
+				break;
+			case Format::SNorm8x4:
+				for ( size_t i = 0; i < 4; i++ )
+				{
+					( (int8_t *)to )[ i ] = ToNorm< int8_t >( v[ i ], -1.0f, 127.0f );
+				}
+				break;
+			case Format::UNorm8x4:
+				for ( size_t i = 0; i < 4; i++ )
+				{
+					( (uint8_t *)to )[ i ] = ToNorm< uint8_t >( v[ i ], 0.0f, 255.0f );
+				}
+				break;
+			case Format::SNorm16x2:
+			case Format::SNorm16x4:
+				for ( size_t i = 0; i < Components( element.format ); i++ )
+				{
+					( (int16_t *)to )[ i ] = ToNorm< int16_t >( v[ i ], -1.0f, 32767.0f );
+				}
+				break;
+			case Format::UNorm16x2:
+				for ( size_t i = 0; i < 2; i++ )
+				{
+					( (uint16_t *)to )[ i ] = ToNorm< uint16_t >( v[ i ], 0.0f, 65535.0f );
+				}
+				break;
+			case Format::R10G10B10A2:
+				{
+					uint32_t packed = ToNorm< uint32_t >( v[ 0 ], 0.0f, 1023.0f );
+					packed |= ToNorm< uint32_t >( v[ 1 ], 0.0f, 1023.0f ) << 10;
+					packed |= ToNorm< uint32_t >( v[ 2 ], 0.0f, 1023.0f ) << 20;
+					packed |= ToNorm< uint32_t >( v[ 3 ], 0.0f, 3.0f ) << 30;
+					memcpy( to, &packed, sizeof( packed ) );
+				}
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+DXGI_FORMAT VertexQuantizer::ToDX( Format::TYPE format )
+{
+	switch ( format )
+	{
+	case Format::Half2: return DXGI_FORMAT_R16G16_FLOAT;
+	case Format::Half4: return DXGI_FORMAT_R16G16B16A16_FLOAT;
+	case Format::SNorm8x4: return DXGI_FORMAT_R8G8B8A8_SNORM;
+	case Format::UNorm8x4: return DXGI_FORMAT_R8G8B8A8_UNORM;
+	case Format::SNorm16x2: return DXGI_FORMAT_R16G16_SNORM;
+	case Format::SNorm16x4: return DXGI_FORMAT_R16G16B16A16_SNORM;
+	case Format::UNorm16x2: return DXGI_FORMAT_R16G16_UNORM;
+	case Format::R10G10B10A2: return DXGI_FORMAT_R10G10B10A2_UNORM;
+	default: return DXGI_FORMAT_UNKNOWN;
+	}
+}
+
+size_t VertexQuantizer::SizeOf( Format::TYPE format )
+{
+	switch ( format )
+	{
+	case Format::Half4: case Format::SNorm16x4: return 8;
+	case Format::None: return 0;
+	default: return 4;
+	}
+}
+
+size_t VertexQuantizer::Components( Format::TYPE format )
+{
+	switch ( format )
+	{
+	case Format::Half2: case Format::SNorm16x2: case Format::UNorm16x2: return 2;
+	case Format::None: return 0;
+	default: return 4;
+	}
+}
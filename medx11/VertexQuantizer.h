@@ -0,0 +1,103 @@
+// Copyright (c) 2002 - 2018, Kit10 Studios LLC
+// All Rights Reserved
+
+#pragma once
+
+#include <medx11/DirectX.h>
+#include <me/render/VertexDeclaration.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+
+namespace medx11
+{
+	/// <summary>
+	/// Packs float vertex elements into compact formats, chosen per semantic, as vertex data is uploaded.
+	/// The packed layout follows from the declaration alone, so VertexBuffer (which packs) and VertexConstruct (which
+	/// describes the packed formats to the input assembler) always agree. Only per-vertex elements are packed; the
+	/// engine still reads and writes vertices as declared, with locks converted on unlock.
+	/// Disabled by default, as packed data is lossy. A slot's layout is fixed the first time it is asked for, so
+	/// changing the rules or enabling afterwards only affects declarations not yet seen.
+	/// </summary>
+	class VertexQuantizer
+	{
+	public:
+		struct Format
+		{
+			enum TYPE
+			{
+				None, // Unchanged.
+				Half2,
+				Half4,
+				SNorm8x4,
+				UNorm8x4, // For colors.
+				SNorm16x2,
+				SNorm16x4,
+				UNorm16x2,
+				R10G10B10A2 // Unsigned normalized, for colors without meaningful alpha, as alpha keeps only 2 bits.
+			};
+		};
+
+		struct Element
+		{
+			size_t sourceOffset;
+			size_t sourceSize;
+			size_t components; // Float components in the source, 0 if the element is not float.
+			Format::TYPE format;
+			size_t offset;
+		};
+
+		/// <summary>
+		/// Where each element of a slot comes from and goes to, in declaration order.
+		/// </summary>
+		struct Layout
+		{
+			std::vector< Element > elements;
+			size_t sourceStride;
+			size_t stride;
+			bool quantized; // False if no element is packed, and the data is uploaded as is.
+		};
+
+		/// <summary>
+		/// Defaults to SNorm8x4 for normals, tangents and binormals, Half2 for texture coordinates, and UNorm8x4 for
+		/// float colors. Positions are left as floats, as Half4 is too coarse for large meshes.
+		/// </summary>
+		VertexQuantizer();
+
+		void SetEnabled( bool enabled );
+		bool IsEnabled() const;
+
+		/// <summary>
+		/// Set the format for elements of a semantic (matched without case), Format::None to leave them as floats.
+		/// An element is only packed if the format has room for its components.
+		/// </summary>
+		void SetRule( std::string semantic, Format::TYPE format );
+		Format::TYPE GetRule( std::string semantic ) const;
+
+		/// <summary>
+		/// The layout of a slot of a declaration, computed on first use and cached, so input layouts and vertex buffers
+		/// created at different times agree. Never quantized if disabled when first asked for.
+		/// </summary>
+		Layout GetLayout( const me::render::VertexDeclaration & vd, size_t slot ) const;
+
+		/// <summary>
+		/// Pack count vertices from the declared layout into the packed one.
+		/// </summary>
+		void Quantize( const Layout & layout, const void * source, size_t count, void * destination ) const;
+
+		static DXGI_FORMAT ToDX( Format::TYPE format );
+		static size_t SizeOf( Format::TYPE format );
+		static size_t Components( Format::TYPE format );
+
+	private:
+		Layout ComputeLayout( const me::render::VertexDeclaration & vd, size_t slot ) const;
+
+		bool m_enabled;
+		std::map< std::string, Format::TYPE > m_rules;
+
+		// Keyed by the slot's elements rather than the declaration's address, which may be reused once freed.
+		mutable std::map< std::string, Layout > m_layouts;
+		mutable std::mutex m_layoutsLock;
+	};
+}
\ No newline at end of file
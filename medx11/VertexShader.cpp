@@ -27,6 +27,7 @@ void VertexShader::Destroy()
 	//m_constantBuffer.reset();
 	m_vertexShader = nullptr;
 	m_vertexShaderBuffer = nullptr;
+	m_constantLayout = ConstantLayout();
 }
 
 void VertexShader::Create( VertexShaderParameters parameters )
@@ -62,6 +63,12 @@ void VertexShader::Create( VertexShaderParameters parameters )
 	result = dxDevice->CreateVertexShader( m_vertexShaderBuffer->GetBufferPointer(), m_vertexShaderBuffer->GetBufferSize(), classLinkage, &m_vertexShader );
 	assert( !WIN_FAILED( result ) );
 
+	m_constantLayout = ConstantLayout::Reflect( m_vertexShaderBuffer->GetBufferPointer(), m_vertexShaderBuffer->GetBufferSize() );
+	for ( auto && mismatch : m_constantLayout.Compare( m_parameters.constantTable, Renderer::RendererConstantSlots ) )
+	{
+		OutputDebugStringA( ( "Vertex shader \"" + m_parameters.path.ToString() + "\": " + mismatch + "\n" ).c_str() );
+	}
+
 	m_vertexDeclaration->Build( m_renderer, *this );
 }
 
@@ -77,7 +84,7 @@ VertexDeclaration::ptr VertexShader::GetVertexDeclaration() const
 
 IConstantBuffer::ptr VertexShader::CreateConstantBuffer( BufferUsage::TYPE usage ) const
 {
-	ConstantBuffer::ptr constantBuffer{ new ConstantBuffer( m_renderer, ConstantBufferParameters{ me::render::ResourceType::VertexShader, usage, m_parameters.constantTable } ) };
+	ConstantBuffer::ptr constantBuffer{ new ConstantBuffer( m_renderer, ConstantBufferParameters{ me::render::ResourceType::VertexShader, usage, m_parameters.constantTable }, m_constantLayout.GetUsedSizes( m_parameters.constantTable ), m_constantLayout.GetBindSizes( m_parameters.constantTable ) ) };
 	return constantBuffer;
 }
 
@@ -93,6 +100,11 @@ const IConstantBuffer * VertexShader::GetConstantBuffer() const
 }
 */
 
+const ConstantLayout & VertexShader::GetConstantLayout() const
+{
+	return m_constantLayout;
+}
+
 const void * VertexShader::GetBytecode() const
 {
 	return m_vertexShaderBuffer->GetBufferPointer();
@@ -5,6 +5,7 @@
 
 #include <medx11/Renderer.h>
 #include <medx11/ConstantBuffer.h>
+#include <medx11/ConstantLayout.h>
 #include <me/render/VertexDeclaration.h>
 
 namespace medx11
@@ -24,6 +25,11 @@ namespace medx11
 		void SetVertexDeclaration( me::render::VertexDeclaration::ptr vertexDeclaration ) override;
 		me::render::VertexDeclaration::ptr GetVertexDeclaration() const override;
 
+		/// <summary>
+		/// The constant buffers the compiled shader declares, reflected from its bytecode.
+		/// </summary>
+		const ConstantLayout & GetConstantLayout() const;
+
 	public: // me::render::IShader
 		me::render::IConstantBuffer::ptr CreateConstantBuffer( me::render::BufferUsage::TYPE usage ) const override;
 		const void * GetBytecode() const override;
@@ -42,5 +48,6 @@ namespace medx11
 		me::render::VertexDeclaration::ptr m_vertexDeclaration;
 		CComPtr< ID3D11VertexShader > m_vertexShader;
 		CComPtr< ID3D10Blob > m_vertexShaderBuffer;
+		ConstantLayout m_constantLayout;
 	};
 }
\ No newline at end of file